@@ -38,25 +38,16 @@ static const char preamble[PREAMBLE_SIZE] = { 'A', 'P', 'E', 'T', 'A', 'G', 'E',
 #define HEADER_SIZE (32)
 
 /* returns position of APE header or -1 if not found */
-static int find_ape_tag_slow(int fd)
+static off_t find_ape_tag_slow(int fd)
 {
-	char buf[4096];
+	char buf[65536];
 	int match = 0;
-	int pos = 0;
-
-	/* seek to start of file */
-	if (lseek(fd, pos, SEEK_SET) == -1)
-		return -1;
+	off_t pos = 0;
 
 	while (1) {
-		int i, got = read(fd, buf, sizeof(buf));
+		int i, got = pread_all(fd, buf, sizeof(buf), pos);
 
-		if (got == -1) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			break;
-		}
-		if (got == 0)
+		if (got <= 0)
 			break;
 
 		for (i = 0; i < got; i++) {
@@ -86,43 +77,45 @@ static int ape_parse_header(const char *buf, struct ape_header *h)
 	return 1;
 }
 
-static int read_header(int fd, struct ape_header *h)
+/*
+ * Reads the items of the tag whose header or footer ends at @end.
+ * Returns the number of items or -1.
+ */
+static int read_items(struct apetag *ape, int fd, off_t end)
 {
-	char buf[HEADER_SIZE];
+	struct ape_header *h = &ape->header;
+	off_t start = end;
 
-	if (read_all(fd, buf, sizeof(buf)) != sizeof(buf))
-		return 0;
+	/* ignore insane tags */
+	if (h->size > 1024 * 1024)
+		return -1;
+
+	/* size includes the footer but not the header */
+	if (AF_IS_FOOTER(h->flags))
+		start = end - h->size;
+	if (start < 0)
+		return -1;
 
-	return ape_parse_header(buf, h);
+	ape->buf = xnew(char, h->size);
+	if (pread_all(fd, ape->buf, h->size, start) != h->size) {
+		free(ape->buf);
+		ape->buf = NULL;
+		return -1;
+	}
+	return h->count;
 }
 
-/* sets fd right after the header and returns 1 if found,
- * otherwise returns 0
- */
-static int find_ape_tag(int fd, struct ape_header *h, int slow)
+int ape_read_tail(struct apetag *ape, int fd, const char *end, off_t file_size)
 {
-	int pos;
+	struct ape_header *h = &ape->header;
 
-	if (lseek(fd, -HEADER_SIZE, SEEK_END) == -1)
-		return 0;
-	if (read_header(fd, h))
-		return 1;
+	if (file_size >= HEADER_SIZE && ape_parse_header(end - HEADER_SIZE, h))
+		return read_items(ape, fd, file_size);
 
 	/* try to skip ID3v1 tag at the end of the file */
-	if (lseek(fd, -(HEADER_SIZE + 128), SEEK_END) == -1)
-		return 0;
-	if (read_header(fd, h))
-		return 1;
-
-	if (!slow)
-		return 0;
-
-	pos = find_ape_tag_slow(fd);
-	if (pos == -1)
-		return 0;
-	if (lseek(fd, pos, SEEK_SET) == -1)
-		return 0;
-	return read_header(fd, h);
+	if (file_size >= HEADER_SIZE + 128 && ape_parse_header(end - HEADER_SIZE - 128, h))
+		return read_items(ape, fd, file_size - 128);
+	return -1;
 }
 
 /*
@@ -208,35 +201,29 @@ static int ape_parse_one(const char *buf, int size, char **keyp, char **valp)
 /* return the number of comments, or -1 */
 int ape_read_tags(struct apetag *ape, int fd, int slow)
 {
-	struct ape_header *h = &ape->header;
-	int rc = -1;
-	off_t old_pos;
-
-	/* save position */
-	old_pos = lseek(fd, 0, SEEK_CUR);
-
-	if (!find_ape_tag(fd, h, slow))
-		goto fail;
-
-	if (AF_IS_FOOTER(h->flags)) {
-		/* seek back right after the header */
-		if (lseek(fd, -((int)h->size), SEEK_CUR) == -1)
-			goto fail;
-	}
-
-	/* ignore insane tags */
-	if (h->size > 1024 * 1024)
-		goto fail;
+	char tail[APE_TAIL_SIZE] = { 0 };
+	char buf[HEADER_SIZE];
+	struct stat st;
+	off_t size, pos;
+	int rc;
 
-	ape->buf = xnew(char, h->size);
-	if (read_all(fd, ape->buf, h->size) != h->size)
-		goto fail;
+	if (fstat(fd, &st))
+		return -1;
+	size = st.st_size < APE_TAIL_SIZE ? st.st_size : APE_TAIL_SIZE;
+	if (pread_all(fd, tail + APE_TAIL_SIZE - size, size, st.st_size - size) != size)
+		return -1;
 
-	rc = h->count;
+	rc = ape_read_tail(ape, fd, tail + APE_TAIL_SIZE, st.st_size);
+	if (rc >= 0 || !slow)
+		return rc;
 
-fail:
-	lseek(fd, old_pos, SEEK_SET);
-	return rc;
+	pos = find_ape_tag_slow(fd);
+	if (pos == -1)
+		return -1;
+	if (pread_all(fd, buf, HEADER_SIZE, pos) != HEADER_SIZE ||
+			!ape_parse_header(buf, &ape->header))
+		return -1;
+	return read_items(ape, fd, pos + HEADER_SIZE);
 }
 
 /* returned key-name must be free'd */
@@ -21,6 +21,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 struct ape_header {
 	/* 1000 or 2000 (1.0, 2.0) */
@@ -51,7 +52,17 @@ struct apetag {
 
 #define APETAG(name) struct apetag name = { .buf = NULL, .pos = 0, }
 
+/* APE footer, possibly followed by an ID3v1 tag */
+#define APE_TAIL_SIZE (32 + 128)
+
 int ape_read_tags(struct apetag *ape, int fd, int slow);
+
+/*
+ * Like ape_read_tags() without the slow search, for callers that already
+ * have the last bytes of the file.  The APE_TAIL_SIZE bytes before @end
+ * are the end of the file, zero padded at the front if it is shorter.
+ */
+int ape_read_tail(struct apetag *ape, int fd, const char *end, off_t file_size);
 char *ape_get_comment(struct apetag *ape, char **val);
 
 static inline void ape_free(struct apetag *ape)
@@ -0,0 +1,493 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Decodes files through the input plugins the way producer_loop() does,
+ * ip_read() into CHUNK_SIZE chunks including the pcm.c conversions, and
+ * reports per file and per plugin and codec:
+ *
+ *   speed     seconds of audio decoded per wall-clock second
+ *   cpu       user + system time of the whole process, decoder threads too
+ *   reads/s   read syscalls (/proc/self/io syscr) per second of audio
+ *   allocs/s  malloc, calloc, realloc and posix_memalign calls per second
+ *             of audio, glibc only
+ *
+ * usage: cmus-bench-decode [-l LIB_DIR] [-n PASSES]
+ *                          [-o input.PLUGIN.OPTION=VALUE]... FILE...
+ *
+ * Plugins are loaded from LIB_DIR/ip, default $CMUS_LIB_DIR or the
+ * install directory.  Each file is decoded PASSES times, the first pass
+ * also fills the page cache.  For a .cue file every track is decoded.
+ * scripts/gen_bench_corpus.py writes a set of test files.
+ */
+
+#include "input.h"
+#include "buffer.h"
+#include "options.h"
+#include "ui_curses.h"
+#include "cmus.h"
+#include "misc.h"
+#include "cue_utils.h"
+#include "path.h"
+#include "pcm.h"
+#include "stats.h"
+#include "gbuf.h"
+#include "utils.h"
+#include "xmalloc.h"
+#include "debug.h"
+#include "config/libdir.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+#define MAX_TOTALS 64
+#define MAX_OPTIONS 256
+
+struct result {
+	const char *plugin;
+	char codec[16];
+	int nr_files;
+	double audio;
+	uint64_t wall_us;
+	uint64_t cpu_us;
+	long long reads;
+	long long allocs;
+};
+
+static struct result totals[MAX_TOTALS];
+static int nr_totals;
+
+/*
+ * The ui, options and library are not linked, these stand in for what
+ * input.c and the plugins use of them.
+ */
+int ui_initialized;
+char *charset;
+int using_utf8;
+char *clipped_text_internal;
+char *id3_default_charset;
+char *icecast_default_charset;
+
+void error_msg(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+void info_msg(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+enum ui_query_answer yes_no_query(const char *format, ...)
+{
+	return UI_QUERY_ANSWER_NO;
+}
+
+int cmus_playlist_for_each(const char *buf, int size, int reverse,
+		int (*cb)(void *data, const char *line),
+		void *data)
+{
+	return 0;
+}
+
+static struct {
+	const char *name;
+	const void *data;
+	opt_set_cb set;
+} ip_options[MAX_OPTIONS];
+static int nr_ip_options;
+
+/* ip_add_options() registers the plugin options here */
+void option_add(const char *name, const void *data, opt_get_cb get,
+		opt_set_cb set, opt_toggle_cb toggle, unsigned int flags)
+{
+	if (nr_ip_options == MAX_OPTIONS)
+		return;
+	ip_options[nr_ip_options].name = name;
+	ip_options[nr_ip_options].data = data;
+	ip_options[nr_ip_options].set = set;
+	nr_ip_options++;
+}
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static atomic_long nr_allocs;
+
+/* these override the libc functions for the plugins and libraries too */
+void *malloc(size_t size)
+{
+	atomic_fetch_add_explicit(&nr_allocs, 1, memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	atomic_fetch_add_explicit(&nr_allocs, 1, memory_order_relaxed);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	atomic_fetch_add_explicit(&nr_allocs, 1, memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	atomic_fetch_add_explicit(&nr_allocs, 1, memory_order_relaxed);
+	*memptr = __libc_memalign(alignment, size);
+	return *memptr ? 0 : ENOMEM;
+}
+
+static long long get_allocs(void)
+{
+	return atomic_load_explicit(&nr_allocs, memory_order_relaxed);
+}
+#else
+static long long get_allocs(void)
+{
+	return -1;
+}
+#endif
+
+/* -1 if /proc/self/io is not available */
+static long long get_reads(void)
+{
+	FILE *f = fopen("/proc/self/io", "r");
+	long long val = -1;
+	char line[64];
+
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "syscr: %lld", &val) == 1)
+			break;
+	}
+	fclose(f);
+	return val;
+}
+
+static uint64_t get_cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* format of ip_read() output, see set_buffer_sf() in player.c */
+static sample_format_t decoded_sf(sample_format_t sf)
+{
+	if (sf_get_float(sf)) {
+		if (sf_get_channels(sf) == 1) {
+			sf &= ~SF_CHANNELS_MASK;
+			sf |= sf_channels(2);
+		}
+	} else if (sf_get_channels(sf) <= 2 && sf_get_bits(sf) <= 16) {
+		sf &= SF_RATE_MASK;
+		sf |= sf_channels(2) | sf_bits(16) | sf_signed(1);
+		sf |= sf_host_endian();
+	}
+	return sf;
+}
+
+static void add_result(struct result *sum, const struct result *r)
+{
+	sum->nr_files += r->nr_files;
+	sum->audio += r->audio;
+	sum->wall_us += r->wall_us;
+	sum->cpu_us += r->cpu_us;
+	sum->reads += r->reads;
+	sum->allocs += r->allocs;
+}
+
+static void print_result(const struct result *r, const char *name)
+{
+	double wall = r->wall_us / 1e6;
+
+	printf("%-8s %-10s %9.1f %8.3f %9.1fx %8.3f", r->plugin, r->codec, r->audio, wall,
+			wall > 0 ? r->audio / wall : 0.0, r->cpu_us / 1e6);
+	if (r->reads >= 0 && r->audio > 0)
+		printf(" %9.1f", r->reads / r->audio);
+	else
+		printf(" %9s", "-");
+	if (r->allocs >= 0 && r->audio > 0)
+		printf(" %9.1f", r->allocs / r->audio);
+	else
+		printf(" %9s", "-");
+	printf("  %s\n", name);
+}
+
+/* decodes @filename once and adds to @r, returns 0 or an ip error */
+static int decode(const char *filename, struct result *r)
+{
+	static char buffer[CHUNK_SIZE];
+	struct input_plugin *ip;
+	uint64_t start, cpu;
+	long long reads, allocs, bytes = 0;
+	char *codec;
+	int pos = 0, rc;
+
+	start = us_now();
+	cpu = get_cpu_us();
+	reads = get_reads();
+	allocs = get_allocs();
+
+	ip = ip_new(filename);
+	rc = ip_open(ip);
+	if (rc) {
+		char *msg = ip_get_error_msg(ip, rc, filename);
+
+		error_msg("%s", msg);
+		free(msg);
+		ip_delete(ip);
+		return rc;
+	}
+	ip_setup(ip);
+
+	while (1) {
+		int nr_read = ip_read(ip, buffer + pos, CHUNK_SIZE - pos);
+
+		if (nr_read < 0) {
+			char *msg;
+
+			if (nr_read == -1 && errno == EAGAIN)
+				continue;
+			msg = ip_get_error_msg(ip, nr_read, filename);
+			error_msg("%s", msg);
+			free(msg);
+			rc = nr_read;
+			break;
+		}
+		if (nr_read == 0)
+			break;
+		bytes += nr_read;
+		pos += nr_read;
+		if (pos == CHUNK_SIZE)
+			pos = 0;
+	}
+
+	r->plugin = ip_get_plugin_name(ip);
+	codec = ip_codec(ip);
+	strscpy(r->codec, codec ? codec : "-", sizeof(r->codec));
+	free(codec);
+	r->audio += (double)bytes / sf_get_second_size(decoded_sf(ip_get_sf(ip)));
+	ip_delete(ip);
+
+	r->wall_us += us_now() - start;
+	r->cpu_us += get_cpu_us() - cpu;
+	if (reads >= 0 && r->reads >= 0) {
+		/* the first get_reads() shows up in the second one */
+		r->reads += get_reads() - reads - 1;
+	} else {
+		r->reads = -1;
+	}
+	if (allocs >= 0)
+		r->allocs += get_allocs() - allocs;
+	else
+		r->allocs = -1;
+	return rc;
+}
+
+static struct result *get_total(const struct result *r)
+{
+	int i;
+
+	for (i = 0; i < nr_totals; i++) {
+		if (totals[i].plugin == r->plugin && strcmp(totals[i].codec, r->codec) == 0)
+			return &totals[i];
+	}
+	if (nr_totals == MAX_TOTALS)
+		return NULL;
+	totals[nr_totals].plugin = r->plugin;
+	strcpy(totals[nr_totals].codec, r->codec);
+	return &totals[nr_totals++];
+}
+
+/* returns 0 or -1 if decoding failed */
+static int bench_file(const char *filename, int passes)
+{
+	struct result r = { .nr_files = 1 };
+	struct result *total;
+	int pass;
+
+	for (pass = 0; pass < passes; pass++) {
+		if (decode(filename, &r))
+			return -1;
+	}
+	print_result(&r, filename);
+	total = get_total(&r);
+	if (total)
+		add_result(total, &r);
+	return 0;
+}
+
+/* every track of a cue sheet */
+static int bench_cue(const char *filename, int passes)
+{
+	int i, n, rc = 0;
+
+	n = cue_get_ntracks(filename);
+	if (n <= 0) {
+		error_msg("%s: invalid cue sheet", filename);
+		return -1;
+	}
+	for (i = 1; i <= n; i++) {
+		char *url = construct_cue_url(filename, i);
+
+		if (bench_file(url, passes))
+			rc = -1;
+		free(url);
+	}
+	return rc;
+}
+
+static int set_option(const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	int i;
+
+	if (eq == NULL) {
+		error_msg("%s: expected NAME=VALUE", arg);
+		return -1;
+	}
+	for (i = 0; i < nr_ip_options; i++) {
+		if (strlen(ip_options[i].name) == eq - arg &&
+				strncmp(ip_options[i].name, arg, eq - arg) == 0) {
+			ip_options[i].set((void *)ip_options[i].data, eq + 1);
+			return 0;
+		}
+	}
+	error_msg("%.*s: no such option", (int)(eq - arg), arg);
+	return -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-l LIB_DIR] [-n PASSES] "
+			"[-o input.PLUGIN.OPTION=VALUE]... FILE...\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *opts[MAX_OPTIONS];
+	int nr_opts = 0, passes = 1, failed = 0;
+	char *line, *next;
+	GBUF(buf);
+	int i, c;
+
+	while ((c = getopt(argc, argv, "l:n:o:")) != -1) {
+		switch (c) {
+		case 'l':
+			cmus_lib_dir = optarg;
+			break;
+		case 'n':
+			passes = atoi(optarg);
+			if (passes < 1)
+				usage(argv[0]);
+			break;
+		case 'o':
+			if (nr_opts < MAX_OPTIONS)
+				opts[nr_opts++] = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		usage(argv[0]);
+
+	if (cmus_lib_dir == NULL)
+		cmus_lib_dir = getenv("CMUS_LIB_DIR");
+	if (cmus_lib_dir == NULL)
+		cmus_lib_dir = LIBDIR "/cmus";
+
+	charset = xstrdup("UTF-8");
+	using_utf8 = 1;
+	id3_default_charset = xstrdup("ISO-8859-1");
+	icecast_default_charset = xstrdup("ISO-8859-1");
+
+	debug_init();
+	pcm_init();
+	ip_load_plugins();
+	ip_add_options();
+	for (i = 0; i < nr_opts; i++) {
+		if (set_option(opts[i]))
+			return 2;
+	}
+
+	printf("%-8s %-10s %9s %8s %10s %8s %9s %9s  %s\n", "plugin", "codec", "audio_s",
+			"wall_s", "speed", "cpu_s", "reads/s", "allocs/s", "file");
+	for (i = optind; i < argc; i++) {
+		const char *ext = get_extension(argv[i]);
+		int rc;
+
+		if (ext && strcasecmp(ext, "cue") == 0)
+			rc = bench_cue(argv[i], passes);
+		else
+			rc = bench_file(argv[i], passes);
+		if (rc)
+			failed++;
+	}
+
+	printf("\n");
+	for (i = 0; i < nr_totals; i++) {
+		char name[32];
+
+		snprintf(name, sizeof(name), "(%d files)", totals[i].nr_files);
+		print_result(&totals[i], name);
+	}
+
+	/* per call latency of ops->read from stats.c, without the histogram */
+	stats_format(&buf);
+	printf("\n");
+	for (line = buf.buffer; *line; line = next) {
+		char *hist;
+
+		next = strchr(line, '\n');
+		next = next ? next + 1 : line + strlen(line);
+		if (strncmp(line, "ip_read_us ", 11))
+			continue;
+		hist = strstr(line, " hist");
+		printf("%.*s\n", (int)((hist && hist < next ? hist : next - 1) - line), line);
+	}
+	gbuf_free(&buf);
+	return failed ? 1 : 0;
+}
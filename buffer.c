@@ -20,6 +20,9 @@
 #include "xmalloc.h"
 #include "locking.h"
 #include "debug.h"
+#include "rt.h"
+
+#include <string.h>
 
 /*
  * chunk can be accessed by either consumer OR producer, not both at same time
@@ -50,16 +53,51 @@ static struct chunk *buffer_chunks = NULL;
 static unsigned int buffer_ridx;
 static unsigned int buffer_widx;
 
+/* number of filled chunks */
+static unsigned int buffer_filled;
+
+/* see buffer_set_target() */
+static unsigned int buffer_target;
+
+/* bytes of buffer_chunks kept in RAM, see buffer_mlock() */
+static size_t buffer_locked;
+
 void buffer_init(void)
 {
-	free(buffer_chunks);
+	int locked = buffer_locked != 0, rc;
+
+	buffer_free();
 	buffer_chunks = xnew(struct chunk, buffer_nr_chunks);
+	buffer_target = buffer_nr_chunks;
 	buffer_reset();
+	if (locked && (rc = buffer_mlock(1)))
+		d_print("could not lock resized buffer: %s\n", strerror(rc));
 }
 
 void buffer_free(void)
 {
+	if (buffer_locked)
+		buffer_mlock(0);
 	free(buffer_chunks);
+	buffer_chunks = NULL;
+}
+
+int buffer_mlock(int lock)
+{
+	size_t size = buffer_nr_chunks * sizeof(struct chunk);
+	int rc;
+
+	if (!lock == !buffer_locked || !buffer_chunks)
+		return 0;
+	if (lock) {
+		rc = rt_mlock(buffer_chunks, size);
+		if (rc == 0)
+			buffer_locked = size;
+	} else {
+		rc = rt_munlock(buffer_chunks, buffer_locked);
+		buffer_locked = 0;
+	}
+	return rc;
 }
 
 /*
@@ -100,7 +138,7 @@ int buffer_get_wpos(char **pos)
 
 	cmus_mutex_lock(&buffer_mutex);
 	c = &buffer_chunks[buffer_widx];
-	if (!c->filled) {
+	if (!c->filled && buffer_filled < buffer_target) {
 		size = CHUNK_SIZE - c->h;
 		*pos = c->data + c->h;
 	}
@@ -122,6 +160,7 @@ void buffer_consume(int count)
 		c->l = 0;
 		c->h = 0;
 		c->filled = 0;
+		buffer_filled--;
 		buffer_ridx++;
 		buffer_ridx %= buffer_nr_chunks;
 	}
@@ -141,6 +180,7 @@ int buffer_fill(int count)
 
 	if (CHUNK_SIZE - c->h < 1024 || (count == 0 && c->h > 0)) {
 		c->filled = 1;
+		buffer_filled++;
 		buffer_widx++;
 		buffer_widx %= buffer_nr_chunks;
 		filled = 1;
@@ -157,6 +197,7 @@ void buffer_reset(void)
 	cmus_mutex_lock(&buffer_mutex);
 	buffer_ridx = 0;
 	buffer_widx = 0;
+	buffer_filled = 0;
 	for (i = 0; i < buffer_nr_chunks; i++) {
 		buffer_chunks[i].l = 0;
 		buffer_chunks[i].h = 0;
@@ -170,40 +211,26 @@ int buffer_get_filled_chunks(void)
 	int c;
 
 	cmus_mutex_lock(&buffer_mutex);
-	if (buffer_ridx < buffer_widx) {
-		/*
-		 * |__##########____|
-		 *    r         w
-		 *
-		 * |############____|
-		 *  r           w
-		 */
-		c = buffer_widx - buffer_ridx;
-	} else if (buffer_ridx > buffer_widx) {
-		/*
-		 * |#######______###|
-		 *         w     r
-		 *
-		 * |_____________###|
-		 *  w            r
-		 */
-		c = buffer_nr_chunks - buffer_ridx + buffer_widx;
-	} else {
-		/*
-		 * |################|
-		 *     r
-		 *     w
-		 *
-		 * |________________|
-		 *     r
-		 *     w
-		 */
-		if (buffer_chunks[buffer_ridx].filled) {
-			c = buffer_nr_chunks;
-		} else {
-			c = 0;
-		}
-	}
+	c = buffer_filled;
+	cmus_mutex_unlock(&buffer_mutex);
+	return c;
+}
+
+void buffer_set_target(unsigned int nr_chunks)
+{
+	cmus_mutex_lock(&buffer_mutex);
+	if (nr_chunks == 0 || nr_chunks > buffer_nr_chunks)
+		nr_chunks = buffer_nr_chunks;
+	buffer_target = nr_chunks;
+	cmus_mutex_unlock(&buffer_mutex);
+}
+
+int buffer_get_target(void)
+{
+	int c;
+
+	cmus_mutex_lock(&buffer_mutex);
+	c = buffer_target;
 	cmus_mutex_unlock(&buffer_mutex);
 	return c;
 }
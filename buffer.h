@@ -37,6 +37,12 @@ extern unsigned int buffer_nr_chunks;
 
 void buffer_init(void);
 void buffer_free(void);
+
+/*
+ * Locks the buffer into RAM, faulting all of it in, or unlocks it.  Kept
+ * over buffer_init().  Returns 0 or an errno value.
+ */
+int buffer_mlock(int lock);
 int buffer_get_rpos(char **pos);
 int buffer_get_wpos(char **pos);
 void buffer_consume(int count);
@@ -44,4 +50,11 @@ int buffer_fill(int count);
 void buffer_reset(void);
 int buffer_get_filled_chunks(void);
 
+/*
+ * The producer sees the buffer as full once @nr_chunks chunks are filled.
+ * Can be changed at any time, 0 or more than buffer_nr_chunks means all.
+ */
+void buffer_set_target(unsigned int nr_chunks);
+int buffer_get_target(void);
+
 #endif
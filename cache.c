@@ -46,8 +46,10 @@
 
 #define CACHE_RESERVED_PATTERN  	0xff
 
-#define CACHE_ENTRY_USED_SIZE		28
-#define CACHE_ENTRY_RESERVED_SIZE	52
+#define CACHE_ENTRY_USED_SIZE		32
+#define CACHE_ENTRY_RESERVED_SIZE	48
+
+#define CACHE_TI_DURATION_ESTIMATED	0x01
 #define CACHE_ENTRY_TOTAL_SIZE	(CACHE_ENTRY_RESERVED_SIZE + CACHE_ENTRY_USED_SIZE)
 
 // Cmus Track Cache version X + 4 bytes flags
@@ -64,6 +66,9 @@ struct cache_entry {
 	int32_t duration;
 	int32_t bitrate;
 	int32_t bpm;
+	// CACHE_TI_* bits, the reserved pattern in entries written before
+	// this field existed
+	uint32_t flags;
 
 	// when introducing new fields decrease the reserved space accordingly
 	uint8_t _reserved[CACHE_ENTRY_RESERVED_SIZE];
@@ -143,6 +148,8 @@ static struct track_info *cache_entry_to_ti(struct cache_entry *e)
 	ti->mtime = e->mtime;
 	ti->play_count = e->play_count;
 	ti->bpm = e->bpm;
+	if (e->flags != 0xffffffff)
+		ti->duration_estimated = !!(e->flags & CACHE_TI_DURATION_ESTIMATED);
 
 	// count strings (filename + codec + codec_profile + key/val pairs)
 	count = 0;
@@ -344,6 +351,7 @@ static void write_ti(int fd, struct gbuf *buf, struct track_info *ti, unsigned i
 	e.mtime = ti->mtime;
 	e.play_count = ti->play_count;
 	e.bpm = ti->bpm;
+	e.flags = ti->duration_estimated ? CACHE_TI_DURATION_ESTIMATED : 0;
 	len[count] = strlen(proc_filename) + 1;
 	e.size += len[count++];
 	len[count] = (ti->codec ? strlen(ti->codec) : 0) + 1;
@@ -423,7 +431,7 @@ static struct track_info *ip_get_ti(const char *filename)
 	int rc;
 
 	ip = ip_new(filename);
-	rc = ip_open(ip);
+	rc = ip_probe(ip);
 	if (rc) {
 		ip_delete(ip);
 		return NULL;
@@ -434,6 +442,7 @@ static struct track_info *ip_get_ti(const char *filename)
 		ti = track_info_new(filename);
 		track_info_set_comments(ti, comments);
 		ti->duration = ip_duration(ip);
+		ti->duration_estimated = ip_duration_estimated(ip);
 		ti->bitrate = ip_bitrate(ip);
 		ti->codec = ip_codec(ip);
 		ti->codec_profile = ip_codec_profile(ip);
@@ -514,7 +523,8 @@ struct track_info **cache_refresh(int *count, int force)
 
 		if (!is_url(ti->filename)) {
 			rc = stat(ti->filename, &st);
-			if (!rc && !force && ti->mtime == st.st_mtime) {
+			if (!rc && !force && ti->mtime == st.st_mtime &&
+					!ti->duration_estimated) {
 				// unchanged
 				track_info_unref(ti);
 				tis[i] = NULL;
@@ -463,6 +463,40 @@ static struct track_info *cmus_get_next_from_other_thread(void)
 	return ti;
 }
 
+struct peek_data {
+	struct track_info **tis;
+	int max;
+	int n;
+};
+
+static int peek_queue_cb(void *data, struct track_info *ti)
+{
+	struct peek_data *d = data;
+
+	track_info_ref(ti);
+	d->tis[d->n++] = ti;
+	return d->n == d->max;
+}
+
+int cmus_peek_next_tracks(struct track_info **tis, int max)
+{
+	struct peek_data d = { tis, max, 0 };
+
+	if (max <= 0 || player_repeat_current)
+		return 0;
+
+	play_queue_for_each(peek_queue_cb, &d, NULL);
+	if (d.n == max)
+		return d.n;
+	if (stop_after_queue && (d.n > 0 || play_queue_active))
+		return d.n;
+	if (play_library)
+		d.n += lib_peek_next(tis + d.n, max - d.n);
+	else
+		d.n += pl_peek_next(tis + d.n, max - d.n);
+	return d.n;
+}
+
 struct track_info *cmus_get_next_track(void)
 {
 	pthread_t this_thread = pthread_self();
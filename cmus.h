@@ -89,6 +89,12 @@ void cmus_prev_album(void);
 
 extern int cmus_next_track_request_fd;
 struct track_info *cmus_get_next_track(void);
+
+/*
+ * Fills @tis with up to @max referenced tracks which would be played after
+ * the current one, without side effects.  Main thread only.
+ */
+int cmus_peek_next_tracks(struct track_info **tis, int max);
 void cmus_provide_next_track(void);
 void cmus_track_request_init(void);
 
@@ -48,6 +48,7 @@
 #include "op.h"
 #include "mpris.h"
 #include "job.h"
+#include "stats.h"
 
 #include <stdlib.h>
 #include <ctype.h>
@@ -1562,6 +1563,23 @@ static void cmd_pl_delete(char *arg)
 		pl_delete_by_name(arg);
 }
 
+static void cmd_stats(char *arg)
+{
+	GBUF(buf);
+	int flag = parse_flags((const char **)&arg, "r");
+
+	if (flag == -1)
+		return;
+	if (flag == 'r') {
+		stats_reset();
+		info_msg("statistics reset");
+		return;
+	}
+	stats_summary(&buf);
+	info_msg("%s", buf.buffer);
+	gbuf_free(&buf);
+}
+
 static void cmd_version(char *arg)
 {
 	info_msg(VERSION);
@@ -2972,6 +2990,7 @@ struct command commands[] = {
 	{"showbind", cmd_showbind, 1, 1, expand_unbind_args, 0, 0},
 	{"shuffle", cmd_reshuffle, 0, 0, NULL, 0, CMD_HIDDEN},
 	{"source", cmd_source, 1, 1, expand_files, 0, CMD_UNSAFE},
+	{"stats", cmd_stats, 0, 1, NULL, 0, 0},
 	{"toggle", cmd_toggle, 1, 1, expand_toptions, 0, 0},
 	{"tqueue", cmd_tqueue, 0, 1, NULL, 0, 0},
 	{"unbind", cmd_unbind, 1, 1, expand_unbind_args, 0, 0},
@@ -21,8 +21,143 @@
 #include "cue_utils.h"
 #include "xmalloc.h"
 #include "cue.h"
+#include "locking.h"
+#include "debug.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Adding a directory of CD rips looks at every cue sheet once for the
+ * track count and then once or twice more per track from the cue input
+ * plugin, so parsed sheets are kept around for a while.
+ */
+#define CUE_CACHE_SIZE 8
+
+struct cue_cache_entry {
+	char *filename;
+	time_t mtime;
+	off_t size;
+	struct cue_sheet *cd;
+	int refcount;
+	/* file changed, freed once the last reference is dropped */
+	unsigned int stale : 1;
+	/* cue_cache_clock at the last lookup */
+	unsigned int used;
+};
+
+static struct cue_cache_entry cue_cache[CUE_CACHE_SIZE];
+static unsigned int cue_cache_clock;
+static pthread_mutex_t cue_cache_mutex = CMUS_MUTEX_INITIALIZER;
+
+#define cue_cache_lock() cmus_mutex_lock(&cue_cache_mutex)
+#define cue_cache_unlock() cmus_mutex_unlock(&cue_cache_mutex)
+
+static void cue_cache_entry_free(struct cue_cache_entry *e)
+{
+	free(e->filename);
+	cue_free(e->cd);
+	memset(e, 0, sizeof(*e));
+}
+
+/* returns a cached sheet of @filename with a reference taken, or NULL */
+static struct cue_sheet *cue_cache_lookup(const char *filename, const struct stat *st)
+{
+	int i;
+
+	for (i = 0; i < CUE_CACHE_SIZE; i++) {
+		struct cue_cache_entry *e = &cue_cache[i];
+
+		if (!e->cd || e->stale || strcmp(e->filename, filename))
+			continue;
+		if (e->mtime == st->st_mtime && e->size == st->st_size) {
+			e->refcount++;
+			e->used = ++cue_cache_clock;
+			return e->cd;
+		}
+		if (e->refcount)
+			e->stale = 1;
+		else
+			cue_cache_entry_free(e);
+	}
+	return NULL;
+}
+
+static void cue_cache_insert(const char *filename, const struct stat *st,
+		struct cue_sheet *cd)
+{
+	struct cue_cache_entry *e = NULL;
+	int i;
+
+	/* least recently used entry nobody holds */
+	for (i = 0; i < CUE_CACHE_SIZE; i++) {
+		struct cue_cache_entry *c = &cue_cache[i];
+
+		if (c->refcount)
+			continue;
+		if (!e || !c->cd || (e->cd && c->used < e->used))
+			e = c;
+	}
+	/* all in use, cue_cache_put() frees @cd */
+	if (!e)
+		return;
+
+	if (e->cd)
+		cue_cache_entry_free(e);
+	e->filename = xstrdup(filename);
+	e->mtime = st->st_mtime;
+	e->size = st->st_size;
+	e->cd = cd;
+	e->refcount = 1;
+	e->used = ++cue_cache_clock;
+}
+
+struct cue_sheet *cue_cache_get(const char *filename)
+{
+	struct cue_sheet *cd;
+	struct stat st;
+
+	if (stat(filename, &st))
+		return NULL;
+
+	cue_cache_lock();
+	cd = cue_cache_lookup(filename, &st);
+	cue_cache_unlock();
+	if (cd)
+		return cd;
+
+	/* parse without the lock, another thread may do the same */
+	cd = cue_from_file(filename);
+	if (!cd)
+		return NULL;
+	d_print("parsed %s\n", filename);
+
+	cue_cache_lock();
+	cue_cache_insert(filename, &st, cd);
+	cue_cache_unlock();
+	return cd;
+}
+
+void cue_cache_put(struct cue_sheet *cd)
+{
+	int i;
+
+	cue_cache_lock();
+	for (i = 0; i < CUE_CACHE_SIZE; i++) {
+		struct cue_cache_entry *e = &cue_cache[i];
+
+		if (e->cd != cd)
+			continue;
+		if (--e->refcount == 0 && e->stale)
+			cue_cache_entry_free(e);
+		cue_cache_unlock();
+		return;
+	}
+	cue_cache_unlock();
+	cue_free(cd);
+}
 
 char *associated_cue(const char *filename)
 {
@@ -52,11 +187,11 @@ char *associated_cue(const char *filename)
 
 int cue_get_ntracks(const char *filename)
 {
-	struct cue_sheet *cd = cue_from_file(filename);
+	struct cue_sheet *cd = cue_cache_get(filename);
 	if (!cd)
 		return -1;
 	size_t n = cd->num_tracks;
-	cue_free(cd);
+	cue_cache_put(cd);
 	return n;
 }
 
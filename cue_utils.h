@@ -21,9 +21,19 @@
 
 #include <stdio.h>
 
+struct cue_sheet;
+
 char *associated_cue(const char *filename);
 int cue_get_ntracks(const char *filename);
 char *construct_cue_url(const char *cue_filename, int track_n);
 
+/*
+ * Returns the parsed cue sheet @filename, from a small cache shared by
+ * all threads as long as the file's mtime and size are unchanged.
+ * The sheet must not be modified and is released with cue_cache_put().
+ */
+struct cue_sheet *cue_cache_get(const char *filename);
+void cue_cache_put(struct cue_sheet *cd);
+
 
 #endif
@@ -50,6 +50,29 @@ ssize_t read_all(int fd, void *buf, size_t count)
 	return pos;
 }
 
+ssize_t pread_all(int fd, void *buf, size_t count, off_t offset)
+{
+	char *buffer = buf;
+	ssize_t pos = 0;
+
+	while (count - pos > 0) {
+		ssize_t rc;
+
+		rc = pread(fd, buffer + pos, count - pos, offset + pos);
+		if (rc == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		if (rc == 0) {
+			/* eof */
+			break;
+		}
+		pos += rc;
+	}
+	return pos;
+}
+
 ssize_t write_all(int fd, const void *buf, size_t count)
 {
 	const char *buffer = buf;
@@ -23,6 +23,8 @@
 #include <sys/types.h> /* ssize_t */
 
 ssize_t read_all(int fd, void *buf, size_t count);
+/* like read_all() but at @offset, doesn't move the file position */
+ssize_t pread_all(int fd, void *buf, size_t count, off_t offset);
 ssize_t write_all(int fd, const void *buf, size_t count);
 
 /* @filename  file to mmap for reading
@@ -17,6 +17,7 @@
  */
 
 #include "id3.h"
+#include "ape.h"
 #include "xmalloc.h"
 #include "convert.h"
 #include "uchar.h"
@@ -26,6 +27,9 @@
 #include "file.h"
 
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdint.h>
 #include <errno.h>
 #include <stdio.h>
@@ -980,6 +984,14 @@ static void decode_ufid(struct id3tag *id3, const char *buf, int len)
 }
 
 
+/* frames v2_add_frame() decodes, everything else is skipped without copying */
+static int v2_frame_wanted(const struct v2_frame_header *fh)
+{
+	return !strncmp(fh->id, "RVA2", 4) || !strncmp(fh->id, "UFID", 4) ||
+		!strncmp(fh->id, "TXXX", 4) || !strncmp(fh->id, "COM", 3) ||
+		frame_tab_index(fh->id) >= 0;
+}
+
 static void v2_add_frame(struct id3tag *id3, struct v2_frame_header *fh, const char *buf)
 {
 	int encoding;
@@ -1040,28 +1052,21 @@ static void unsync(unsigned char *buf, int *lenp)
 	*lenp = d;
 }
 
-static int v2_read(struct id3tag *id3, int fd, const struct v2_header *header)
+/* bigger tags are mmapped, they usually contain pictures that are never read */
+#define V2_MAP_MIN_SIZE	(64 * 1024)
+
+static int v2_parse(struct id3tag *id3, const char *buf, int buf_size,
+		const struct v2_header *header)
 {
-	char *buf;
-	int rc, buf_size;
 	int frame_start, i;
 	int frame_header_size;
 
-	buf_size = header->size;
-	buf = xnew(char, buf_size);
-	rc = read_all(fd, buf, buf_size);
-	if (rc == -1) {
-		free(buf);
-		return rc;
-	}
-
 	frame_start = 0;
 	if (header->flags & V2_HEADER_EXTENDED) {
 		struct v2_extended_header ext;
 
 		if (!v2_extended_header_parse(&ext, buf) || ext.size > buf_size) {
 			id3_debug("extended header corrupted\n");
-			free(buf);
 			return -2;
 		}
 		frame_start = ext.size;
@@ -1076,6 +1081,7 @@ static int v2_read(struct id3tag *id3, int fd, const struct v2_header *header)
 	while (i < buf_size - frame_header_size) {
 		struct v2_frame_header fh;
 		int len_unsync;
+		char *frame;
 
 		if (header->ver_major == 2) {
 			if (!v2_2_0_frame_header_parse(&fh, buf + i))
@@ -1106,16 +1112,54 @@ static int v2_read(struct id3tag *id3, int fd, const struct v2_header *header)
 
 		len_unsync = fh.size;
 
-		if ((fh.flags & V2_FRAME_UNSYNC) || (header->flags & V2_HEADER_UNSYNC))
-			unsync((unsigned char *)(buf + i), (int *)&fh.size);
-
-		v2_add_frame(id3, &fh, buf + i);
+		if (len_unsync > 0 && v2_frame_wanted(&fh)) {
+			/* the buffer may be read-only and unsync works in place */
+			frame = xnew(char, fh.size);
+			memcpy(frame, buf + i, fh.size);
+			if ((fh.flags & V2_FRAME_UNSYNC) || (header->flags & V2_HEADER_UNSYNC))
+				unsync((unsigned char *)frame, (int *)&fh.size);
+			v2_add_frame(id3, &fh, frame);
+			free(frame);
+		}
 
 		i += len_unsync;
 	}
+	return 0;
+}
+
+static int v2_read(struct id3tag *id3, int fd, off_t offset, off_t file_size,
+		const struct v2_header *header)
+{
+	size_t size = header->size;
+	char *buf;
+	int rc;
 
+	if (offset < 0 || offset >= file_size)
+		return -2;
+	if (size > file_size - offset)
+		size = file_size - offset;
+
+	if (size >= V2_MAP_MIN_SIZE) {
+		long page = sysconf(_SC_PAGESIZE);
+		off_t start = offset & ~(off_t)(page - 1);
+		size_t len = size + (offset - start);
+		void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, start);
+
+		if (map != MAP_FAILED) {
+			rc = v2_parse(id3, (char *)map + (offset - start), size, header);
+			munmap(map, len);
+			return rc;
+		}
+	}
+
+	buf = xnew(char, size);
+	if (pread_all(fd, buf, size, offset) != size) {
+		free(buf);
+		return -1;
+	}
+	rc = v2_parse(id3, buf, size, header);
 	free(buf);
-	return 0;
+	return rc;
 }
 
 int id3_tag_size(const char *buf, int buf_size)
@@ -1155,75 +1199,64 @@ void id3_free(struct id3tag *id3)
 		free(id3->v2[i]);
 }
 
-int id3_read_tags(struct id3tag *id3, int fd, unsigned int flags)
-{
-	off_t off;
-	int rc;
+/*
+ * Everything is read with pread() so the file position is left alone:
+ * the first 10 bytes, the last TAIL_SIZE bytes and the ID3v2 body.
+ */
+#define TAIL_SIZE	APE_TAIL_SIZE
 
-	if (flags & ID3_V2) {
-		struct v2_header header;
-		char buf[138];
-
-		rc = read_all(fd, buf, 10);
-		if (rc == -1)
-			goto rc_error;
-		if (v2_header_parse(&header, buf)) {
-			rc = v2_read(id3, fd, &header);
-			if (rc)
-				goto rc_error;
-			/* get v1 if needed */
-		} else {
-			/* get v2 from end and optionally v1 */
-
-			off = lseek(fd, -138, SEEK_END);
-			if (off == -1)
-				goto error;
-			rc = read_all(fd, buf, 138);
-			if (rc == -1)
-				goto rc_error;
-
-			if (is_v1(buf + 10)) {
-				if (flags & ID3_V1) {
-					memcpy(id3->v1, buf + 10, 128);
-					id3->has_v1 = 1;
-				}
-				if (v2_footer_parse(&header, buf)) {
-					/* footer at end of file - 128 */
-					off = lseek(fd, -((off_t) header.size + 138), SEEK_END);
-					if (off == -1)
-						goto error;
-					rc = v2_read(id3, fd, &header);
-					if (rc)
-						goto rc_error;
-				}
-			} else if (v2_footer_parse(&header, buf + 128)) {
-				/* footer at end of file */
-				off = lseek(fd, -((off_t) header.size + 10), SEEK_END);
-				if (off == -1)
-					goto error;
-				rc = v2_read(id3, fd, &header);
-				if (rc)
-					goto rc_error;
+static int read_tags(struct id3tag *id3, unsigned int flags, struct apetag *ape, int fd)
+{
+	char head[10], tail[TAIL_SIZE] = { 0 };
+	char *end = tail + TAIL_SIZE;
+	struct v2_header header;
+	struct stat st;
+	off_t n;
+	int rc = 0;
+
+	if (fstat(fd, &st))
+		return -1;
+	n = st.st_size < TAIL_SIZE ? st.st_size : TAIL_SIZE;
+	if (pread_all(fd, end - n, n, st.st_size - n) != n)
+		return -1;
+
+	if ((flags & ID3_V2) && pread_all(fd, head, 10, 0) == 10 &&
+			v2_header_parse(&header, head)) {
+		rc = v2_read(id3, fd, 10, st.st_size, &header);
+	} else if (flags & ID3_V2) {
+		/* get v2 from end */
+		if (st.st_size >= 138 && is_v1(end - 128)) {
+			if (v2_footer_parse(&header, end - 138)) {
+				/* footer at end of file - 128 */
+				rc = v2_read(id3, fd, st.st_size - 138 - header.size,
+						st.st_size, &header);
 			}
-			return 0;
+		} else if (st.st_size >= 10 && v2_footer_parse(&header, end - 10)) {
+			/* footer at end of file */
+			rc = v2_read(id3, fd, st.st_size - 10 - header.size,
+					st.st_size, &header);
 		}
 	}
-	if (flags & ID3_V1) {
-		off = lseek(fd, -128, SEEK_END);
-		if (off == -1)
-			goto error;
-		rc = read_all(fd, id3->v1, 128);
-		if (rc == -1)
-			goto rc_error;
-		id3->has_v1 = is_v1(id3->v1);
+	if ((flags & ID3_V1) && st.st_size >= 128 && is_v1(end - 128)) {
+		memcpy(id3->v1, end - 128, 128);
+		id3->has_v1 = 1;
 	}
-	return 0;
-error:
-	rc = -1;
-rc_error:
+
+	if (ape)
+		ape_read_tail(ape, fd, end, st.st_size);
 	return rc;
 }
 
+int id3_read_tags(struct id3tag *id3, int fd, unsigned int flags)
+{
+	return read_tags(id3, flags, NULL, fd);
+}
+
+int id3_ape_read_tags(struct id3tag *id3, unsigned int flags, struct apetag *ape, int fd)
+{
+	return read_tags(id3, flags, ape, fd);
+}
+
 static char *v1_get_str(const char *buf, int len)
 {
 	char in[32];
@@ -74,6 +74,15 @@ void id3_init(struct id3tag *id3);
 void id3_free(struct id3tag *id3);
 
 int id3_read_tags(struct id3tag *id3, int fd, unsigned int flags);
+
+struct apetag;
+
+/*
+ * id3_read_tags() and ape_read_tags() without the slow APE search, in one
+ * pass over the file.  The APE items are in @ape, ape->buf is NULL if
+ * there are none.  Returns like id3_read_tags().
+ */
+int id3_ape_read_tags(struct id3tag *id3, unsigned int flags, struct apetag *ape, int fd);
 char *id3_get_comment(struct id3tag *id3, enum id3_key key);
 
 char const *id3_get_genre(uint16_t id);
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "index_store.h"
+#include "misc.h"
+#include "file.h"
+#include "xmalloc.h"
+#include "xstrjoin.h"
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC	"CIDX"
+#define INDEX_VERSION	1
+/* anything bigger is not an index */
+#define INDEX_MAX_SIZE	(16 * 1024 * 1024)
+
+struct index_header {
+	char magic[4];
+	uint32_t version;
+	int64_t mtime;
+	int64_t size;
+	uint32_t path_len;
+	uint32_t data_len;
+};
+
+static char *index_dir(void)
+{
+	return xstrjoin(cmus_config_dir, "/index");
+}
+
+static char *index_path(const char *filename, const char *kind)
+{
+	char *dir = index_dir();
+	char *path = xnew(char, strlen(dir) + strlen(kind) + 19);
+	const unsigned char *p = (const unsigned char *)filename;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	/* FNV-1a, collisions are caught by the path in the header */
+	while (*p) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	sprintf(path, "%s/%s-%016llx", dir, kind, (unsigned long long)h);
+	free(dir);
+	return path;
+}
+
+/*
+ * Removes an entry that can never be used again.  Skipped if it was
+ * replaced since it was opened as @fd.
+ */
+static void remove_stale(const char *path, int fd)
+{
+	struct stat a, b;
+
+	if (fstat(fd, &a) == 0 && stat(path, &b) == 0 &&
+			a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+		d_print("removing %s\n", path);
+		unlink(path);
+	}
+}
+
+void *index_store_load(const char *filename, const char *kind, size_t *size)
+{
+	struct index_header h;
+	struct stat st;
+	char *path, *buf = NULL;
+	int fd, stale;
+
+	if (stat(filename, &st) == -1)
+		return NULL;
+
+	path = index_path(filename, kind);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		free(path);
+		return NULL;
+	}
+
+	/* a different path is a hash collision, that entry isn't ours */
+	stale = 1;
+	if (read_all(fd, &h, sizeof(h)) != sizeof(h))
+		goto out;
+	if (memcmp(h.magic, INDEX_MAGIC, 4) || h.version != INDEX_VERSION)
+		goto out;
+	if (h.path_len != strlen(filename) || h.data_len > INDEX_MAX_SIZE) {
+		stale = 0;
+		goto out;
+	}
+
+	buf = xnew(char, h.path_len + h.data_len);
+	if (read_all(fd, buf, h.path_len) != h.path_len)
+		goto bad;
+	if (memcmp(buf, filename, h.path_len)) {
+		stale = 0;
+		goto bad;
+	}
+	/* the file changed, the entry is rebuilt under the same name */
+	if (h.mtime != st.st_mtime || h.size != st.st_size)
+		goto bad;
+	if (read_all(fd, buf + h.path_len, h.data_len) != h.data_len)
+		goto bad;
+
+	stale = 0;
+	memmove(buf, buf + h.path_len, h.data_len);
+	*size = h.data_len;
+	goto out;
+bad:
+	free(buf);
+	buf = NULL;
+out:
+	if (stale)
+		remove_stale(path, fd);
+	close(fd);
+	free(path);
+	return buf;
+}
+
+int index_store_save(const char *filename, const char *kind,
+		const void *data, size_t size)
+{
+	struct index_header h;
+	struct stat st;
+	char *dir, *path, *tmp;
+	int fd, rc = -1;
+
+	if (stat(filename, &st) == -1 || size > INDEX_MAX_SIZE)
+		return -1;
+
+	dir = index_dir();
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		d_print("%s: %s\n", dir, strerror(errno));
+		free(dir);
+		return -1;
+	}
+	free(dir);
+
+	path = index_path(filename, kind);
+	tmp = xstrjoin(path, ".XXXXXX");
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		goto out;
+
+	memcpy(h.magic, INDEX_MAGIC, 4);
+	h.version = INDEX_VERSION;
+	h.mtime = st.st_mtime;
+	h.size = st.st_size;
+	h.path_len = strlen(filename);
+	h.data_len = size;
+	if (write_all(fd, &h, sizeof(h)) != sizeof(h) ||
+			write_all(fd, filename, h.path_len) != h.path_len ||
+			write_all(fd, data, size) != size) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+
+	/* replace atomically, a concurrent reader sees either version */
+	rc = rename(tmp, path);
+	if (rc)
+		unlink(tmp);
+out:
+	if (rc)
+		d_print("%s: %s\n", path, strerror(errno));
+	free(tmp);
+	free(path);
+	return rc;
+}
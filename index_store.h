@@ -0,0 +1,37 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_INDEX_STORE_H
+#define CMUS_INDEX_STORE_H
+
+#include <stddef.h>
+
+/*
+ * Sidecar store for per-file data that is slow to rebuild, such as seek
+ * tables.  Entries live in $CMUS_HOME/index/, one file per @kind and path,
+ * and are removed by index_store_load() once the file's mtime or size
+ * changes.  Safe to call from any thread.
+ */
+
+/* returns malloced data or NULL if there is no valid entry */
+void *index_store_load(const char *filename, const char *kind, size_t *size);
+
+/* returns 0 on success, -1 on error */
+int index_store_save(const char *filename, const char *kind,
+		const void *data, size_t size);
+
+#endif
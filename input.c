@@ -34,6 +34,8 @@
 #include "ui_curses.h"
 #include "locking.h"
 #include "xstrjoin.h"
+#include "stats.h"
+#include "netbuf.h"
 
 #include <unistd.h>
 #include <stdbool.h>
@@ -52,9 +54,15 @@
 
 struct input_plugin {
 	const struct input_plugin_ops *ops;
+	/* name of the plugin ops belongs to, for stats */
+	const char *plugin_name;
 	struct input_plugin_data data;
 	unsigned int open : 1;
 	unsigned int eof : 1;
+	/* regular file, always readable so select() is not needed */
+	unsigned int local_file : 1;
+	/* opened by ip_probe(), can't be read */
+	unsigned int probe : 1;
 	int http_code;
 	char *http_reason;
 
@@ -75,18 +83,32 @@ struct input_plugin {
 	void (*pcm_convert_in_place)(void *, int);
 	/*
 	 * 4  if 8-bit mono
-	 * 2  if 8-bit stereo or 16-bit mono
+	 * 2  if 8-bit stereo, 16-bit mono or float mono
 	 * 1  otherwise
 	 */
 	int pcm_convert_scale;
+
+	/* end of the range the kernel was asked to read ahead */
+	off_t readahead_end;
+	/* bytes decoded since the range was last checked */
+	int readahead_count;
 };
 
+/*
+ * For local files keep READAHEAD_SIZE bytes ahead of the decoder in the
+ * page cache.  The file position is checked after every READAHEAD_CHECK
+ * decoded bytes, which is at most 256 KiB of input.
+ */
+#define READAHEAD_SIZE	(4 * 1024 * 1024)
+#define READAHEAD_CHECK	(256 * 1024)
+
 struct ip {
 	struct list_head node;
 	char *name;
 	void *handle;
 
 	int priority;
+	unsigned int abi_version;
 	const char * const *extensions;
 	const char * const *mime_types;
 	const struct input_plugin_ops *ops;
@@ -107,6 +129,8 @@ static pthread_rwlock_t ip_lock = CMUS_RWLOCK_INITIALIZER;
 static int http_connection_timeout = 5e3;
 static int http_read_timeout = 5e3;
 
+int stream_buffer_seconds = 4;
+
 static const char *pl_mime_types[] = {
 	"audio/m3u",
 	"audio/x-scpls",
@@ -197,7 +221,8 @@ static void keyvals_add_basic_auth(struct growing_keyvals *c,
 	}
 }
 
-static int do_http_get(struct http_get *hg, const char *uri, int redirections)
+static int do_http_get(struct http_get *hg, const char *uri, long long offset,
+		int redirections)
 {
 	GROWING_KEYVALS(h);
 	int i, rc;
@@ -224,6 +249,12 @@ static int do_http_get(struct http_get *hg, const char *uri, int redirections)
 	keyvals_add(&h, "Icy-MetaData", xstrdup("1"));
 	if (hg->uri.user && hg->uri.pass)
 		keyvals_add_basic_auth(&h, hg->uri.user, hg->uri.pass, "Authorization");
+	if (offset) {
+		char range[32];
+
+		snprintf(range, sizeof(range), "bytes=%lld-", offset);
+		keyvals_add(&h, "Range", xstrdup(range));
+	}
 	keyvals_terminate(&h);
 
 	rc = http_get(hg, h.keyvals, http_read_timeout);
@@ -241,6 +272,12 @@ static int do_http_get(struct http_get *hg, const char *uri, int redirections)
 
 	switch (hg->code) {
 	case 200: /* OK */
+		if (offset)
+			return -IP_ERROR_HTTP_STATUS;
+		return 0;
+	case 206: /* Partial Content */
+		if (!offset)
+			return -IP_ERROR_HTTP_STATUS;
 		return 0;
 	/*
 	 * 3xx Codes (Redirections)
@@ -262,7 +299,7 @@ static int do_http_get(struct http_get *hg, const char *uri, int redirections)
 		http_get_free(hg);
 		close(hg->fd);
 
-		rc = do_http_get(hg, redirloc, redirections);
+		rc = do_http_get(hg, redirloc, offset, redirections);
 
 		free(redirloc);
 		return rc;
@@ -271,7 +308,69 @@ static int do_http_get(struct http_get *hg, const char *uri, int redirections)
 	}
 }
 
-static int setup_remote(struct input_plugin *ip, const struct keyval *headers, int sock)
+static int get_metaint(const struct keyval *headers)
+{
+	const char *val = keyvals_get_val(headers, "icy-metaint");
+	long int lint;
+
+	if (val && str_to_int(val, &lint) == 0 && lint >= 0)
+		return lint;
+	return 0;
+}
+
+/* netbuf_connect_func */
+static int reconnect_remote(const char *uri, long long offset, int *metaint)
+{
+	struct http_get hg;
+	int rc;
+
+	rc = do_http_get(&hg, uri, offset, 0);
+	if (rc) {
+		d_print("reconnect failed: %d\n", rc);
+		if (hg.fd >= 0)
+			close(hg.fd);
+		http_get_free(&hg);
+		return -1;
+	}
+	*metaint = get_metaint(hg.headers);
+	http_get_free(&hg);
+	return hg.fd;
+}
+
+static void setup_netbuf(struct input_plugin *ip, const struct keyval *headers,
+		const char *uri)
+{
+	long long content_length = -1;
+	long int kbps = 320, lint;
+	const char *val;
+	size_t size;
+	int fd;
+
+	if (stream_buffer_seconds == 0)
+		return;
+
+	/* size the buffer for the advertised bitrate */
+	val = keyvals_get_val(headers, "icy-br");
+	if (val && str_to_int(val, &lint) == 0 && lint > 0 && lint <= 10000)
+		kbps = lint;
+	size = (size_t)stream_buffer_seconds * kbps * 1000 / 8;
+	if (size < 64 * 1024)
+		size = 64 * 1024;
+
+	val = keyvals_get_val(headers, "Content-Length");
+	if (val && str_to_int(val, &lint) == 0 && lint > 0)
+		content_length = lint;
+
+	/* plugins may close ip->data.fd, the thread reads its own */
+	fd = dup(ip->data.fd);
+	if (fd == -1)
+		return;
+	ip->data.netbuf = netbuf_new(fd, ip->data.metaint, content_length, size,
+			uri, reconnect_remote);
+}
+
+static int setup_remote(struct input_plugin *ip, const struct keyval *headers,
+		int sock, const char *uri)
 {
 	const char *val;
 
@@ -299,15 +398,9 @@ static int setup_remote(struct input_plugin *ip, const struct keyval *headers, i
 	ip->data.fd = sock;
 	ip->data.metadata = xnew(char, 16 * 255 + 1);
 
-	val = keyvals_get_val(headers, "icy-metaint");
-	if (val) {
-		long int lint;
-
-		if (str_to_int(val, &lint) == 0 && lint >= 0) {
-			ip->data.metaint = lint;
-			d_print("metaint: %d\n", ip->data.metaint);
-		}
-	}
+	ip->data.metaint = get_metaint(headers);
+	if (ip->data.metaint)
+		d_print("metaint: %d\n", ip->data.metaint);
 
 	val = keyvals_get_val(headers, "icy-name");
 	if (val)
@@ -321,6 +414,7 @@ static int setup_remote(struct input_plugin *ip, const struct keyval *headers, i
 	if (val)
 		ip->data.icy_url = to_utf8(val, icecast_default_charset);
 
+	setup_netbuf(ip, headers, uri);
 	return 0;
 }
 
@@ -336,7 +430,7 @@ static int handle_line(void *data, const char *uri)
 	struct http_get hg;
 
 	rpd->count++;
-	rpd->rc = do_http_get(&hg, uri, 0);
+	rpd->rc = do_http_get(&hg, uri, 0, 0);
 	if (rpd->rc) {
 		rpd->ip->http_code = hg.code;
 		rpd->ip->http_reason = hg.reason;
@@ -348,7 +442,7 @@ static int handle_line(void *data, const char *uri)
 		return 0;
 	}
 
-	rpd->rc = setup_remote(rpd->ip, hg.headers, hg.fd);
+	rpd->rc = setup_remote(rpd->ip, hg.headers, hg.fd, uri);
 	http_get_free(&hg);
 	return 1;
 }
@@ -380,7 +474,7 @@ static int open_remote(struct input_plugin *ip)
 	const char *val;
 	int rc;
 
-	rc = do_http_get(&hg, d->filename, 0);
+	rc = do_http_get(&hg, d->filename, 0, 0);
 	if (rc) {
 		ip->http_code = hg.code;
 		ip->http_reason = hg.reason;
@@ -402,7 +496,7 @@ static int open_remote(struct input_plugin *ip)
 		}
 	}
 
-	rc = setup_remote(ip, hg.headers, hg.fd);
+	rc = setup_remote(ip, hg.headers, hg.fd, d->filename);
 	http_get_free(&hg);
 	return rc;
 }
@@ -418,7 +512,8 @@ static void ip_init(struct input_plugin *ip, char *filename)
 			.fd         = -1,
 			.filename   = filename,
 			.remote     = is_http_url(filename),
-			.channel_map = CHANNEL_MAP_INIT
+			.channel_map = CHANNEL_MAP_INIT,
+			.read_offset = -1
 		}
 	};
 	*ip = t;
@@ -427,8 +522,14 @@ static void ip_init(struct input_plugin *ip, char *filename)
 static void ip_reset(struct input_plugin *ip, int close_fd)
 {
 	int fd = ip->data.fd;
+	int probe = ip->probe;
+	if (ip->data.netbuf)
+		netbuf_free(ip->data.netbuf);
 	free(ip->data.metadata);
+	free(ip->codec);
+	free(ip->codec_profile);
 	ip_init(ip, ip->data.filename);
+	ip->probe = probe;
 	if (fd != -1) {
 		if (close_fd)
 			close(fd);
@@ -439,6 +540,42 @@ static void ip_reset(struct input_plugin *ip, int close_fd)
 	}
 }
 
+static unsigned int get_abi_version_locked(const struct input_plugin_ops *ops)
+{
+	struct ip *ip;
+
+	list_for_each_entry(ip, &ip_head, node) {
+		if (ip->ops == ops)
+			return ip->abi_version;
+	}
+	return IP_ABI_VERSION;
+}
+
+static int use_probe_locked(struct input_plugin *ip)
+{
+	return ip->probe && get_abi_version_locked(ip->ops) >= 3 && ip->ops->probe;
+}
+
+/* ops->probe for ip_probe() if the plugin has one, ops->open otherwise */
+static int call_open_locked(struct input_plugin *ip)
+{
+	if (use_probe_locked(ip))
+		return ip->ops->probe(&ip->data);
+	return ip->ops->open(&ip->data);
+}
+
+static int call_open(struct input_plugin *ip)
+{
+	int probe;
+
+	ip_rdlock();
+	probe = use_probe_locked(ip);
+	ip_unlock();
+	if (probe)
+		return ip->ops->probe(&ip->data);
+	return ip->ops->open(&ip->data);
+}
+
 static int open_file_locked(struct input_plugin *ip)
 {
 	const struct input_plugin_ops *ops;
@@ -460,7 +597,7 @@ static int open_file_locked(struct input_plugin *ip)
 
 	while (1) {
 		ip->ops = ops;
-		rc = ip->ops->open(&ip->data);
+		rc = call_open_locked(ip);
 		if (rc != -IP_ERROR_UNSUPPORTED_FILE_TYPE)
 			break;
 
@@ -540,7 +677,8 @@ void ip_load_plugins(void)
 			error_msg("%s: missing symbol", filename);
 			err = true;
 		}
-		if (!abi_version_ptr || *abi_version_ptr != IP_ABI_VERSION) {
+		/* versions 3 to 5 only appended ops->probe, ->duration_estimated and ->exit */
+		if (!abi_version_ptr || *abi_version_ptr < 2 || *abi_version_ptr > IP_ABI_VERSION) {
 			error_msg("%s: incompatible plugin version", filename);
 			err = true;
 		}
@@ -550,6 +688,7 @@ void ip_load_plugins(void)
 			continue;
 		}
 		ip->priority = *priority_ptr;
+		ip->abi_version = *abi_version_ptr;
 
 		ip->name = xstrndup(d->d_name, ext - d->d_name);
 		ip->handle = so;
@@ -561,6 +700,34 @@ void ip_load_plugins(void)
 	ip_unlock();
 }
 
+static void (*parked_drop)(void);
+
+void ip_set_parked(void (*drop)(void))
+{
+	parked_drop = drop;
+}
+
+void ip_drop_parked(void)
+{
+	void (*drop)(void) = parked_drop;
+
+	parked_drop = NULL;
+	if (drop)
+		drop();
+}
+
+void ip_exit_plugins(void)
+{
+	struct ip *ip;
+
+	ip_rdlock();
+	list_for_each_entry(ip, &ip_head, node) {
+		if (ip->abi_version >= 5 && ip->ops->exit)
+			ip->ops->exit();
+	}
+	ip_unlock();
+}
+
 struct input_plugin *ip_new(const char *filename)
 {
 	struct input_plugin *ip = xnew(struct input_plugin, 1);
@@ -577,24 +744,78 @@ void ip_delete(struct input_plugin *ip)
 	free(ip);
 }
 
+static void readahead_update(struct input_plugin *ip)
+{
+#ifdef POSIX_FADV_WILLNEED
+	off_t pos = ip->data.read_offset;
+
+	if (pos == -1)
+		pos = lseek(ip->data.fd, 0, SEEK_CUR);
+	ip->readahead_count = 0;
+	if (pos == -1)
+		return;
+	/* after seeking backwards start over */
+	if (pos + READAHEAD_SIZE < ip->readahead_end)
+		ip->readahead_end = pos;
+	if (pos + READAHEAD_SIZE / 2 < ip->readahead_end)
+		return;
+	if (ip->readahead_end < pos)
+		ip->readahead_end = pos;
+	posix_fadvise(ip->data.fd, ip->readahead_end,
+			pos + READAHEAD_SIZE - ip->readahead_end, POSIX_FADV_WILLNEED);
+	ip->readahead_end = pos + READAHEAD_SIZE;
+#endif
+}
+
+static void setup_local_file(struct input_plugin *ip)
+{
+	struct stat st;
+
+	if (ip->data.remote || ip->data.fd == -1)
+		return;
+	if (fstat(ip->data.fd, &st) || !S_ISREG(st.st_mode))
+		return;
+	ip->local_file = 1;
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(ip->data.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	readahead_update(ip);
+}
+
+static const char *get_plugin_name(const struct input_plugin_ops *ops)
+{
+	const char *name = "unknown";
+	struct ip *ip;
+
+	ip_rdlock();
+	list_for_each_entry(ip, &ip_head, node) {
+		if (ip->ops == ops) {
+			name = ip->name;
+			break;
+		}
+	}
+	ip_unlock();
+	return name;
+}
+
 int ip_open(struct input_plugin *ip)
 {
 	int rc;
 
 	BUG_ON(ip->open);
 
-	/* set fd and ops, call ops->open */
+	/* set fd and ops, call ops->open or ops->probe */
 	if (ip->data.remote) {
 		rc = open_remote(ip);
 		if (rc == 0)
-			rc = ip->ops->open(&ip->data);
+			rc = call_open(ip);
 	} else {
 		if (is_cdda_url(ip->data.filename)) {
 			ip->ops = get_ops_by_mime_type("x-content/audio-cdda");
-			rc = ip->ops ? ip->ops->open(&ip->data) : 1;
+			rc = ip->ops ? call_open(ip) : 1;
 		} else if (is_cue_url(ip->data.filename)) {
 			ip->ops = get_ops_by_mime_type("application/x-cue");
-			rc = ip->ops ? ip->ops->open(&ip->data) : 1;
+			rc = ip->ops ? call_open(ip) : 1;
 		} else
 			rc = open_file(ip);
 	}
@@ -606,9 +827,18 @@ int ip_open(struct input_plugin *ip)
 		return rc;
 	}
 	ip->open = 1;
+	ip->plugin_name = get_plugin_name(ip->ops);
+	if (!ip->probe)
+		setup_local_file(ip);
 	return 0;
 }
 
+int ip_probe(struct input_plugin *ip)
+{
+	ip->probe = 1;
+	return ip_open(ip);
+}
+
 void ip_setup(struct input_plugin *ip)
 {
 	unsigned int bits, is_signed, channels;
@@ -622,7 +852,12 @@ void ip_setup(struct input_plugin *ip)
 	ip->pcm_convert = NULL;
 	ip->pcm_convert_in_place = NULL;
 
-	if (bits <= 16 && channels <= 2) {
+	if (sf_get_float(sf)) {
+		if (channels == 1) {
+			ip->pcm_convert = pcm_float_1ch_to_2ch;
+			ip->pcm_convert_scale = 2;
+		}
+	} else if (bits <= 16 && channels <= 2) {
 		unsigned int mask = ((bits >> 2) & 4) | (is_signed << 1);
 
 		ip->pcm_convert = pcm_conv[mask | (channels - 1)];
@@ -643,6 +878,8 @@ int ip_close(struct input_plugin *ip)
 
 	rc = ip->ops->close(&ip->data);
 	BUG_ON(ip->data.private);
+	if (ip->data.netbuf)
+		netbuf_free(ip->data.netbuf);
 	if (ip->data.fd != -1)
 		close(ip->data.fd);
 	free(ip->data.metadata);
@@ -650,6 +887,8 @@ int ip_close(struct input_plugin *ip)
 	free(ip->data.icy_genre);
 	free(ip->data.icy_url);
 	free(ip->http_reason);
+	free(ip->codec);
+	free(ip->codec_profile);
 
 	ip_init(ip, ip->data.filename);
 	return rc;
@@ -659,40 +898,58 @@ int ip_read(struct input_plugin *ip, char *buffer, int count)
 {
 	struct timeval tv;
 	fd_set readfds;
-	/* 4608 seems to be optimal for mp3s, 4096 for oggs */
-	char tmp[8 * 1024];
+	uint64_t start;
 	char *buf;
 	int sample_size;
 	int rc;
 
 	BUG_ON(count <= 0);
+	BUG_ON(ip->probe);
 
-	FD_ZERO(&readfds);
-	FD_SET(ip->data.fd, &readfds);
-	/* zero timeout -> return immediately */
-	tv.tv_sec = 0;
-	tv.tv_usec = 50e3;
-	rc = select(ip->data.fd + 1, &readfds, NULL, NULL, &tv);
-	if (rc == -1) {
-		if (errno == EINTR)
+	if (ip->local_file) {
+		if (ip->readahead_count >= READAHEAD_CHECK)
+			readahead_update(ip);
+	} else if (ip->data.netbuf) {
+		if (!netbuf_wait(ip->data.netbuf, 50)) {
 			errno = EAGAIN;
-		return -1;
-	}
-	if (rc == 0) {
-		errno = EAGAIN;
-		return -1;
+			return -1;
+		}
+	} else {
+		FD_ZERO(&readfds);
+		FD_SET(ip->data.fd, &readfds);
+		/* zero timeout -> return immediately */
+		tv.tv_sec = 0;
+		tv.tv_usec = 50e3;
+		rc = select(ip->data.fd + 1, &readfds, NULL, NULL, &tv);
+		if (rc == -1) {
+			if (errno == EINTR)
+				errno = EAGAIN;
+			return -1;
+		}
+		if (rc == 0) {
+			errno = EAGAIN;
+			return -1;
+		}
 	}
 
 	buf = buffer;
 	if (ip->pcm_convert_scale > 1) {
-		/* use tmp buffer for 16-bit mono and 8-bit */
-		buf = tmp;
+		/*
+		 * 16-bit mono, 8-bit and float mono: read to the tail of
+		 * buffer and expand towards the head.  Output never overtakes
+		 * unread input, see pcm.h.
+		 */
 		count /= ip->pcm_convert_scale;
-		if (count > sizeof(tmp))
-			count = sizeof(tmp);
+		if (count >= 16)
+			count &= ~15;
+		else
+			count -= count % sf_get_frame_size(ip->data.sf);
+		buf = buffer + count * (ip->pcm_convert_scale - 1);
 	}
 
+	start = us_now();
 	rc = ip->ops->read(&ip->data, buf, count);
+	stats_ip_read(ip->plugin_name, us_now() - start);
 	if (rc == -1 && (errno == EAGAIN || errno == EINTR)) {
 		errno = EAGAIN;
 		return -1;
@@ -708,7 +965,8 @@ int ip_read(struct input_plugin *ip, char *buffer, int count)
 	if (ip->pcm_convert_in_place != NULL)
 		ip->pcm_convert_in_place(buf, rc / sample_size);
 	if (ip->pcm_convert != NULL)
-		ip->pcm_convert(buffer, tmp, rc / sample_size);
+		ip->pcm_convert(buffer, buf, rc / sample_size);
+	ip->readahead_count += rc;
 	return rc * ip->pcm_convert_scale;
 }
 
@@ -719,8 +977,11 @@ int ip_seek(struct input_plugin *ip, double offset)
 	if (ip->data.remote)
 		return -IP_ERROR_FUNCTION_NOT_SUPPORTED;
 	rc = ip->ops->seek(&ip->data, offset);
-	if (rc == 0)
+	if (rc == 0) {
 		ip->eof = 0;
+		/* check the readahead range on next read */
+		ip->readahead_count = READAHEAD_CHECK;
+	}
 	return rc;
 }
 
@@ -769,6 +1030,18 @@ int ip_duration(struct input_plugin *ip)
 	return ip->duration;
 }
 
+int ip_duration_estimated(struct input_plugin *ip)
+{
+	int has_op;
+
+	if (ip->data.remote)
+		return 0;
+	ip_rdlock();
+	has_op = get_abi_version_locked(ip->ops) >= 4 && ip->ops->duration_estimated;
+	ip_unlock();
+	return has_op && ip->ops->duration_estimated(&ip->data) > 0;
+}
+
 int ip_bitrate(struct input_plugin *ip)
 {
 	if (ip->data.remote)
@@ -791,7 +1064,7 @@ char *ip_codec(struct input_plugin *ip)
 		return NULL;
 	if (!ip->codec)
 		ip->codec = ip->ops->codec(&ip->data);
-	return ip->codec;
+	return ip->codec ? xstrdup(ip->codec) : NULL;
 }
 
 char *ip_codec_profile(struct input_plugin *ip)
@@ -800,7 +1073,7 @@ char *ip_codec_profile(struct input_plugin *ip)
 		return NULL;
 	if (!ip->codec_profile)
 		ip->codec_profile = ip->ops->codec_profile(&ip->data);
-	return ip->codec_profile;
+	return ip->codec_profile ? xstrdup(ip->codec_profile) : NULL;
 }
 
 sample_format_t ip_get_sf(struct input_plugin *ip)
@@ -820,6 +1093,12 @@ const char *ip_get_filename(struct input_plugin *ip)
 	return ip->data.filename;
 }
 
+const char *ip_get_plugin_name(struct input_plugin *ip)
+{
+	BUG_ON(!ip->open);
+	return ip->plugin_name;
+}
+
 const char *ip_get_metadata(struct input_plugin *ip)
 {
 	BUG_ON(!ip->open);
@@ -25,7 +25,11 @@
 
 struct input_plugin;
 
+/* size of the jitter buffer of http streams in seconds, 0 disables it */
+extern int stream_buffer_seconds;
+
 void ip_load_plugins(void);
+void ip_exit_plugins(void);
 
 /*
  * allocates new struct input_plugin.
@@ -43,6 +47,12 @@ void ip_delete(struct input_plugin *ip);
  */
 int ip_open(struct input_plugin *ip);
 
+/*
+ * like ip_open() but only for reading tags, duration, bitrate and codec.
+ * uses the plugin's lightweight probe if it has one.
+ */
+int ip_probe(struct input_plugin *ip);
+
 void ip_setup(struct input_plugin *ip);
 
 /*
@@ -50,6 +60,14 @@ void ip_setup(struct input_plugin *ip);
  */
 int ip_close(struct input_plugin *ip);
 
+/*
+ * A plugin may keep a decoder open after close in case the next track
+ * continues it, and registers @drop to release it.  The player calls
+ * ip_drop_parked() after opening the next track and when it stops.
+ */
+void ip_set_parked(void (*drop)(void));
+void ip_drop_parked(void);
+
 /*
  * errors: IP_ERROR_{ERRNO, FILE_FORMAT}
  */
@@ -66,14 +84,19 @@ int ip_seek(struct input_plugin *ip, double offset);
 int ip_read_comments(struct input_plugin *ip, struct keyval **comments);
 
 int ip_duration(struct input_plugin *ip);
+/* 1 if ip_duration() and ip_bitrate() are only estimates */
+int ip_duration_estimated(struct input_plugin *ip);
 int ip_bitrate(struct input_plugin *ip);
 int ip_current_bitrate(struct input_plugin *ip);
+/* return a malloced copy, the cached string stays with @ip */
 char *ip_codec(struct input_plugin *ip);
 char *ip_codec_profile(struct input_plugin *ip);
 
 sample_format_t ip_get_sf(struct input_plugin *ip);
 void ip_get_channel_map(struct input_plugin *ip, channel_position_t *channel_map);
 const char *ip_get_filename(struct input_plugin *ip);
+/* name of the plugin that opened the file, e.g. "flac" */
+const char *ip_get_plugin_name(struct input_plugin *ip);
 const char *ip_get_metadata(struct input_plugin *ip);
 int ip_is_remote(struct input_plugin *ip);
 int ip_metadata_changed(struct input_plugin *ip);
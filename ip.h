@@ -23,12 +23,14 @@
 #include "sf.h"
 #include "channelmap.h"
 
+#include <sys/types.h>
+
 #ifndef __GNUC__
 #include <fcntl.h>
 #include <unistd.h>
 #endif
 
-#define IP_ABI_VERSION 2
+#define IP_ABI_VERSION 5
 
 enum {
 	/* no error */
@@ -83,6 +85,15 @@ struct input_plugin_data {
 	sample_format_t sf;
 	channel_position_t channel_map[CHANNELS_MAX];
 	void *private;
+
+	/* filled by ip-layer, jitter buffer of a remote stream or NULL */
+	struct netbuf *netbuf;
+
+	/*
+	 * filled by plugins that read with pread(), which leaves the file
+	 * position alone: offset of the next read, -1 otherwise
+	 */
+	off_t read_offset;
 };
 
 struct input_plugin_ops {
@@ -97,6 +108,26 @@ struct input_plugin_ops {
 	long (*bitrate_current)(struct input_plugin_data *ip_data);
 	char *(*codec)(struct input_plugin_data *ip_data);
 	char *(*codec_profile)(struct input_plugin_data *ip_data);
+
+	/*
+	 * Optional, ABI 3.  Like open but only has to make read_comments,
+	 * duration, bitrate, codec and codec_profile work, by parsing the
+	 * headers and tags without setting up the decoder.  close must
+	 * handle both.
+	 */
+	int (*probe)(struct input_plugin_data *ip_data);
+
+	/*
+	 * Optional, ABI 4.  Returns 1 if duration and bitrate are only
+	 * estimates that a later probe of the same file may improve.
+	 */
+	int (*duration_estimated)(struct input_plugin_data *ip_data);
+
+	/*
+	 * Optional, ABI 5.  Called once before cmus exits, after every file
+	 * is closed, to stop threads the plugin started.
+	 */
+	int (*exit)(void);
 };
 
 struct input_plugin_opt {
@@ -22,20 +22,67 @@
 #include "../id3.h"
 #include "../comment.h"
 #include "../read_wrapper.h"
+#include "../index_store.h"
+#include "../utils.h"
 #include "aac.h"
 
 #include <neaacdec.h>
 
 #include <stdio.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 /* FAAD_MIN_STREAMSIZE == 768, 6 == # of channels */
 #define BUFFER_SIZE	(FAAD_MIN_STREAMSIZE * 6 * 4)
 
+/* ADTS sampling_frequency_index */
+static const unsigned int adts_rates[] = {
+	96000, 88200, 64000, 48000, 44100, 32000, 24000,
+	22050, 16000, 12000, 11025, 8000, 7350
+};
+
+/*
+ * Frame index for seeking and exact durations.  It is built by reading
+ * only the ADTS headers the first time the file is seeked, and kept with
+ * index_store.  Until then the duration is estimated.  Samples are counted at the
+ * ADTS sample rate, which is half the output rate with implicit SBR.
+ */
+#define INDEX_VERSION		1
+/* frames between entries */
+#define INDEX_INTERVAL		16
+#define SCAN_BUFFER_SIZE	(64 * 1024)
+
+struct index_header {
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t interval;
+	uint32_t nr_entries;
+	uint64_t nr_samples;
+	/* offset after the last frame */
+	uint64_t end;
+};
+
+struct index_entry {
+	uint64_t offset;
+	/* samples before this frame */
+	uint64_t sample;
+};
+
+struct scan_buf {
+	int fd;
+	int error;
+	off_t size;
+	/* file offset of buf[0] */
+	off_t pos;
+	int len;
+	unsigned char buf[SCAN_BUFFER_SIZE];
+};
+
 struct aac_private {
 	char rbuf[BUFFER_SIZE];
 	int rbuf_len;
@@ -54,6 +101,17 @@ struct aac_private {
 	char *overflow_buf;
 	int overflow_buf_len;
 
+	/* output bytes to drop after a seek */
+	unsigned int skip;
+
+	/* first frame, 0 if unknown */
+	unsigned int adts_rate;
+	off_t data_start;
+
+	/* header followed by the entries, see aac_load_index() */
+	struct index_header *index;
+	unsigned int index_failed : 1;
+
 	NeAACDecHandle decoder;	/* typedef void * */
 };
 
@@ -192,6 +250,247 @@ static int buffer_fill_frame(struct input_plugin_data *ip_data)
 	/* not reached */
 }
 
+/* returns frame length or 0, 'data' must point to at least 7 bytes */
+static int adts_header(const unsigned char *data, unsigned int *rate, unsigned int *samples)
+{
+	int len = parse_frame(data);
+	int idx = (data[2] >> 2) & 0x0F;
+
+	if (len < 7 || idx >= N_ELEMENTS(adts_rates))
+		return 0;
+	*rate = adts_rates[idx];
+	*samples = 1024 * ((data[6] & 0x03) + 1);
+	return len;
+}
+
+static struct scan_buf *scan_open(int fd)
+{
+	struct scan_buf *s;
+	struct stat st;
+
+	if (fstat(fd, &st) == -1)
+		return NULL;
+	s = xnew(struct scan_buf, 1);
+	s->fd = fd;
+	s->error = 0;
+	s->size = st.st_size;
+	s->pos = 0;
+	s->len = 0;
+	return s;
+}
+
+/* returns 'count' bytes at 'offset' or NULL at eof and on errors */
+static const unsigned char *scan_get(struct scan_buf *s, off_t offset, int count)
+{
+	if (offset + count > s->size)
+		return NULL;
+
+	if (offset < s->pos || offset + count > s->pos + s->len) {
+		ssize_t rc;
+
+		do {
+			rc = pread(s->fd, s->buf, SCAN_BUFFER_SIZE, offset);
+		} while (rc == -1 && errno == EINTR);
+		if (rc == -1) {
+			s->error = 1;
+			return NULL;
+		}
+		s->pos = offset;
+		s->len = rc;
+		if (rc < count)
+			return NULL;
+	}
+	return s->buf + (offset - s->pos);
+}
+
+/* finds the next header that is followed by another one, like after
+ * garbage in a broken stream.  returns -1 if there is none within 32KB.
+ */
+static off_t scan_resync(struct scan_buf *s, off_t offset, unsigned int adts_rate)
+{
+	off_t end = offset + 32768;
+
+	for (; offset < end; offset++) {
+		const unsigned char *data = scan_get(s, offset, 7);
+		unsigned int rate, samples;
+		int len;
+
+		if (data == NULL)
+			return -1;
+		len = adts_header(data, &rate, &samples);
+		if (len == 0 || rate != adts_rate)
+			continue;
+
+		data = scan_get(s, offset, len + 7);
+		if (data == NULL) {
+			if (s->error)
+				return -1;
+			/* last frame */
+			if (offset + len <= s->size)
+				return offset;
+			continue;
+		}
+		len = adts_header(data + len, &rate, &samples);
+		if (len && rate == adts_rate)
+			return offset;
+	}
+	return -1;
+}
+
+/* returns length of the frame at '*offset', moving it past garbage
+ * first, or 0 at the end of the stream
+ */
+static int scan_frame(struct scan_buf *s, off_t *offset, unsigned int adts_rate,
+		unsigned int *samples)
+{
+	const unsigned char *data = scan_get(s, *offset, 7);
+	unsigned int rate;
+	int len;
+
+	if (data == NULL)
+		return 0;
+	len = adts_header(data, &rate, samples);
+	if (len == 0 || rate != adts_rate) {
+		*offset = scan_resync(s, *offset + 1, adts_rate);
+		if (*offset == -1)
+			return 0;
+		data = scan_get(s, *offset, 7);
+		len = adts_header(data, &rate, samples);
+	}
+	/* the decoder stops at a truncated frame too */
+	if (*offset + len > s->size)
+		return 0;
+	return len;
+}
+
+static int aac_scan_index(struct input_plugin_data *ip_data)
+{
+	struct aac_private *priv = ip_data->private;
+	struct index_header *h;
+	struct index_entry *e = NULL;
+	struct scan_buf *s;
+	off_t offset = priv->data_start;
+	off_t end = offset;
+	uint64_t sample = 0;
+	unsigned long frames = 0;
+	int nr = 0, alloc = 0;
+
+	s = scan_open(ip_data->fd);
+	if (s == NULL)
+		return -1;
+
+	while (1) {
+		unsigned int samples;
+		int len = scan_frame(s, &offset, priv->adts_rate, &samples);
+
+		if (len == 0)
+			break;
+		if (frames % INDEX_INTERVAL == 0) {
+			if (nr == alloc) {
+				alloc = alloc ? alloc * 2 : 256;
+				e = xrenew(struct index_entry, e, alloc);
+			}
+			e[nr].offset = offset;
+			e[nr].sample = sample;
+			nr++;
+		}
+		frames++;
+		sample += samples;
+		offset += len;
+		end = offset;
+	}
+
+	if (s->error || nr == 0) {
+		d_print("index scan failed\n");
+		free(s);
+		free(e);
+		return -1;
+	}
+	free(s);
+
+	h = xmalloc(sizeof(*h) + nr * sizeof(*e));
+	h->version = INDEX_VERSION;
+	h->sample_rate = priv->adts_rate;
+	h->interval = INDEX_INTERVAL;
+	h->nr_entries = nr;
+	h->nr_samples = sample;
+	h->end = end;
+	memcpy(h + 1, e, nr * sizeof(*e));
+	free(e);
+
+	d_print("%lu frames, %d entries\n", frames, nr);
+	priv->index = h;
+	return 0;
+}
+
+static int aac_set_index(struct aac_private *priv, void *data, size_t size)
+{
+	struct index_header *h = data;
+	const struct index_entry *e = (const struct index_entry *)(h + 1);
+	uint64_t prev_offset = 0, prev_sample = 0;
+	int i;
+
+	if (size < sizeof(*h) || h->version != INDEX_VERSION ||
+			h->sample_rate != priv->adts_rate ||
+			h->interval != INDEX_INTERVAL || h->nr_entries == 0 ||
+			size != sizeof(*h) + (size_t)h->nr_entries * sizeof(*e))
+		return -1;
+	for (i = 0; i < h->nr_entries; i++) {
+		if ((i && e[i].offset <= prev_offset) || e[i].offset >= h->end ||
+				(i && e[i].sample <= prev_sample))
+			return -1;
+		prev_offset = e[i].offset;
+		prev_sample = e[i].sample;
+	}
+	if (h->nr_samples <= prev_sample)
+		return -1;
+
+	priv->index = h;
+	return 0;
+}
+
+/* returns 0 if priv->index is usable, never scans the file */
+static int aac_load_stored_index(struct input_plugin_data *ip_data)
+{
+	struct aac_private *priv = ip_data->private;
+	struct index_header *h;
+	size_t size;
+
+	if (priv->index)
+		return 0;
+	if (ip_data->remote || priv->adts_rate == 0 || priv->index_failed)
+		return -1;
+
+	h = index_store_load(ip_data->filename, "aac", &size);
+	if (h) {
+		if (aac_set_index(priv, h, size) == 0)
+			return 0;
+		free(h);
+	}
+	return -1;
+}
+
+/* like aac_load_stored_index() but scans the file if there is no index */
+static int aac_load_index(struct input_plugin_data *ip_data)
+{
+	struct aac_private *priv = ip_data->private;
+	struct index_header *h;
+
+	if (aac_load_stored_index(ip_data) == 0)
+		return 0;
+	if (ip_data->remote || priv->adts_rate == 0 || priv->index_failed)
+		return -1;
+
+	if (aac_scan_index(ip_data)) {
+		priv->index_failed = 1;
+		return -1;
+	}
+	h = priv->index;
+	index_store_save(ip_data->filename, "aac", h,
+			sizeof(*h) + h->nr_entries * sizeof(struct index_entry));
+	return 0;
+}
+
 static void aac_get_channel_map(struct input_plugin_data *ip_data)
 {
 	struct aac_private *priv = ip_data->private;
@@ -243,6 +542,22 @@ static int aac_open(struct input_plugin_data *ip_data)
 		goto out;
 	}
 
+	/* where aac_scan_index() starts */
+	if (!ip_data->remote && buffer_length(ip_data) >= 7) {
+		off_t pos = lseek(ip_data->fd, 0, SEEK_CUR);
+		unsigned int samples;
+
+		if (pos != -1 && adts_header(buffer_data(ip_data), &priv->adts_rate, &samples)) {
+			const unsigned char *data = buffer_data(ip_data);
+
+			priv->data_start = pos - buffer_length(ip_data);
+			/* ADTS profile, aac_estimate_duration() may not run */
+			priv->object_type = ((data[2] >> 6) & 0x03) + 1;
+		} else {
+			priv->adts_rate = 0;
+		}
+	}
+
 	/* in case of a bug, make sure there is at least some data
 	 * in the buffer for NeAACDecInit() to work with.
 	 */
@@ -290,6 +605,7 @@ static int aac_close(struct input_plugin_data *ip_data)
 	struct aac_private *priv = ip_data->private;
 
 	NeAACDecClose(priv->decoder);
+	free(priv->index);
 	free(priv);
 	ip_data->private = NULL;
 	return 0;
@@ -363,28 +679,124 @@ static int aac_read(struct input_plugin_data *ip_data, char *buffer, int count)
 	struct aac_private *priv = ip_data->private;
 	int rc;
 
-	/* use overflow from previous call (if any) */
-	if (priv->overflow_buf_len) {
-		int len = priv->overflow_buf_len;
+	while (1) {
+		/* use overflow from previous call (if any) */
+		if (priv->overflow_buf_len) {
+			rc = priv->overflow_buf_len;
+			if (rc > count)
+				rc = count;
+
+			memcpy(buffer, priv->overflow_buf, rc);
+			priv->overflow_buf += rc;
+			priv->overflow_buf_len -= rc;
+		} else {
+			do {
+				rc = decode_one_frame(ip_data, buffer, count);
+			} while (rc == -2);
+			if (rc <= 0)
+				return rc;
+		}
 
-		if (len > count)
-			len = count;
+		if (priv->skip == 0)
+			return rc;
 
-		memcpy(buffer, priv->overflow_buf, len);
-		priv->overflow_buf += len;
-		priv->overflow_buf_len -= len;
-		return len;
+		/* decoding up to the seek position */
+		if (rc <= priv->skip) {
+			priv->skip -= rc;
+			continue;
+		}
+		rc -= priv->skip;
+		memmove(buffer, buffer + priv->skip, rc);
+		priv->skip = 0;
+		return rc;
 	}
-
-	do {
-		rc = decode_one_frame(ip_data, buffer, count);
-	} while (rc == -2);
-	return rc;
 }
 
 static int aac_seek(struct input_plugin_data *ip_data, double offset)
 {
-	return -IP_ERROR_FUNCTION_NOT_SUPPORTED;
+	struct aac_private *priv = ip_data->private;
+	const struct index_entry *e;
+	struct scan_buf *s;
+	uint64_t target, sample;
+	off_t pos, prev = -1;
+	uint64_t prev_sample = 0;
+	int lo, hi;
+
+	if (aac_load_index(ip_data))
+		return -IP_ERROR_FUNCTION_NOT_SUPPORTED;
+
+	e = (const struct index_entry *)(priv->index + 1);
+	target = offset * priv->adts_rate;
+	if (target >= priv->index->nr_samples) {
+		/* next read returns eof */
+		pos = priv->index->end;
+		target = sample = 0;
+		goto out;
+	}
+
+	/* last entry before the target */
+	lo = 0;
+	hi = priv->index->nr_entries - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+
+		if (e[mid].sample <= target)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	/* start one entry earlier so the target frame has a predecessor */
+	if (lo > 0)
+		lo--;
+	pos = e[lo].offset;
+	sample = e[lo].sample;
+
+	s = scan_open(ip_data->fd);
+	if (s == NULL)
+		return -IP_ERROR_ERRNO;
+	while (1) {
+		unsigned int samples;
+		int len = scan_frame(s, &pos, priv->adts_rate, &samples);
+
+		if (len == 0) {
+			int err = s->error;
+
+			free(s);
+			if (err)
+				return -IP_ERROR_ERRNO;
+			/* file changed since the index was made */
+			errno = EINVAL;
+			return -IP_ERROR_ERRNO;
+		}
+		if (sample + samples > target)
+			break;
+		prev = pos;
+		prev_sample = sample;
+		sample += samples;
+		pos += len;
+	}
+	free(s);
+
+	/* the decoder outputs nothing for the first frame after a reset but
+	 * it primes the overlap for the frame containing the target
+	 */
+	if (prev != -1) {
+		pos = prev;
+		sample = prev_sample;
+	}
+out:
+	if (lseek(ip_data->fd, pos, SEEK_SET) == -1)
+		return -IP_ERROR_ERRNO;
+
+	priv->rbuf_pos = 0;
+	priv->rbuf_len = 0;
+	priv->overflow_buf_len = 0;
+	NeAACDecPostSeekReset(priv->decoder, 0);
+
+	/* 16-bit samples, sample_rate is twice adts_rate with implicit SBR */
+	priv->skip = (target - sample) * priv->sample_rate / priv->adts_rate *
+		priv->channels * 2;
+	return 0;
 }
 
 static int aac_read_comments(struct input_plugin_data *ip_data,
@@ -419,7 +831,8 @@ out:
 	return 0;
 }
 
-static int aac_duration(struct input_plugin_data *ip_data)
+/* decodes a few frames for the bitrate and object type */
+static int aac_estimate_duration(struct input_plugin_data *ip_data)
 {
 	struct aac_private *priv = ip_data->private;
 	NeAACDecFrameInfo frame_info;
@@ -473,6 +886,27 @@ static int aac_duration(struct input_plugin_data *ip_data)
 	return ((file_size / bytes) * samples) / priv->sample_rate;
 }
 
+/* exact with a stored index, the file is only scanned for seeking */
+static int aac_duration(struct input_plugin_data *ip_data)
+{
+	struct aac_private *priv = ip_data->private;
+	const struct index_header *h;
+
+	if (aac_load_stored_index(ip_data))
+		return aac_estimate_duration(ip_data);
+
+	h = priv->index;
+	priv->bitrate = 8 * (h->end - priv->data_start) * h->sample_rate / h->nr_samples;
+	return h->nr_samples / h->sample_rate;
+}
+
+static int aac_duration_estimated(struct input_plugin_data *ip_data)
+{
+	struct aac_private *priv = ip_data->private;
+
+	return priv->index == NULL;
+}
+
 static long aac_bitrate(struct input_plugin_data *ip_data)
 {
 	struct aac_private *priv = ip_data->private;
@@ -531,7 +965,8 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate = aac_bitrate,
 	.bitrate_current = aac_current_bitrate,
 	.codec = aac_codec,
-	.codec_profile = aac_codec_profile
+	.codec_profile = aac_codec_profile,
+	.duration_estimated = aac_duration_estimated
 };
 
 const int ip_priority = 50;
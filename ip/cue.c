@@ -38,8 +38,33 @@ struct cue_private {
 	double start_offset;
 	double current_offset;
 	double end_offset;
+
+	/* decoded data past end_offset, the start of the next track */
+	char *pending;
+	int pending_pos;
+	int pending_len;
+
+	unsigned int probe : 1;
 };
 
+/*
+ * The decoder of a track that was played to the end, kept open in case
+ * the next track continues in the same file.  Only used by the player
+ * thread, probing never touches it.  The player drops it through
+ * ip_drop_parked() once another track is open or playback stops.
+ */
+static struct {
+	struct input_plugin *child;
+	/* end of the closed track in the child */
+	double offset;
+	char *pending;
+	int pending_pos;
+	int pending_len;
+} parked;
+
+/* offsets in cue sheets are in 1/75 s, anything closer is the same spot */
+#define SAME_OFFSET(a, b) (fabs((a) - (b)) < 0.001)
+
 
 static int _parse_cue_url(const char *url, char **filename, int *track_n)
 {
@@ -82,7 +107,59 @@ static char *_make_absolute_path(const char *abs_filename, const char *rel_filen
 }
 
 
-static int cue_open(struct input_plugin_data *ip_data)
+static void free_pending(struct cue_private *priv)
+{
+	free(priv->pending);
+	priv->pending = NULL;
+	priv->pending_pos = 0;
+	priv->pending_len = 0;
+}
+
+static void drop_parked(void)
+{
+	if (!parked.child)
+		return;
+	ip_delete(parked.child);
+	free(parked.pending);
+	memset(&parked, 0, sizeof(parked));
+}
+
+static void park_child(struct cue_private *priv)
+{
+	drop_parked();
+	parked.child = priv->child;
+	parked.offset = priv->end_offset;
+	parked.pending = priv->pending;
+	parked.pending_pos = priv->pending_pos;
+	parked.pending_len = priv->pending_len;
+	priv->child = NULL;
+	priv->pending = NULL;
+	priv->pending_len = 0;
+	ip_set_parked(drop_parked);
+}
+
+/* takes the parked decoder if it is positioned at the start of @t */
+static int unpark_child(struct cue_private *priv, const char *filename,
+		struct cue_track *t)
+{
+	if (!parked.child)
+		return 0;
+	if (strcmp(ip_get_filename(parked.child), filename) ||
+			!SAME_OFFSET(parked.offset, t->offset)) {
+		drop_parked();
+		return 0;
+	}
+
+	d_print("continuing %s at %.3f\n", filename, t->offset);
+	priv->child = parked.child;
+	priv->pending = parked.pending;
+	priv->pending_pos = parked.pending_pos;
+	priv->pending_len = parked.pending_len;
+	memset(&parked, 0, sizeof(parked));
+	return 1;
+}
+
+static int do_cue_open(struct input_plugin_data *ip_data, int probe)
 {
 	int rc;
 	char *child_filename;
@@ -90,7 +167,8 @@ static int cue_open(struct input_plugin_data *ip_data)
 	struct cue_track *t;
 	struct cue_private *priv;
 
-	priv = xnew(struct cue_private, 1);
+	priv = xnew0(struct cue_private, 1);
+	priv->probe = probe;
 
 	rc = _parse_cue_url(ip_data->filename, &priv->cue_filename, &priv->track_n);
 	if (rc) {
@@ -98,7 +176,7 @@ static int cue_open(struct input_plugin_data *ip_data)
 		goto url_parse_failed;
 	}
 
-	cd = cue_from_file(priv->cue_filename);
+	cd = cue_cache_get(priv->cue_filename);
 	if (cd == NULL) {
 		rc = -IP_ERROR_FILE_FORMAT;
 		goto cue_parse_failed;
@@ -111,22 +189,30 @@ static int cue_open(struct input_plugin_data *ip_data)
 	}
 
 	child_filename = _make_absolute_path(priv->cue_filename, t->file);
+	if (!probe && unpark_child(priv, child_filename, t)) {
+		free(child_filename);
+		priv->start_offset = t->offset;
+		priv->current_offset = t->offset;
+		goto child_ready;
+	}
 	priv->child = ip_new(child_filename);
 	free(child_filename);
 
-	rc = ip_open(priv->child);
+	rc = probe ? ip_probe(priv->child) : ip_open(priv->child);
 	if (rc)
 		goto ip_open_failed;
 
-	ip_setup(priv->child);
-
 	priv->start_offset = t->offset;
 	priv->current_offset = t->offset;
 
-	rc = ip_seek(priv->child, priv->start_offset);
-	if (rc)
-		goto ip_open_failed;
+	if (!probe) {
+		ip_setup(priv->child);
+		rc = ip_seek(priv->child, priv->start_offset);
+		if (rc)
+			goto ip_open_failed;
+	}
 
+child_ready:
 	if (t->length >= 0)
 		priv->end_offset = priv->start_offset + t->length;
 	else
@@ -140,14 +226,14 @@ static int cue_open(struct input_plugin_data *ip_data)
 	ip_data->sf = ip_get_sf(priv->child);
 	ip_get_channel_map(priv->child, ip_data->channel_map);
 
-	cue_free(cd);
+	cue_cache_put(cd);
 	return 0;
 
 ip_open_failed:
 	ip_delete(priv->child);
 
 cue_read_failed:
-	cue_free(cd);
+	cue_cache_put(cd);
 
 cue_parse_failed:
 	free(priv->cue_filename);
@@ -159,6 +245,18 @@ url_parse_failed:
 }
 
 
+static int cue_open(struct input_plugin_data *ip_data)
+{
+	return do_cue_open(ip_data, 0);
+}
+
+
+static int cue_probe(struct input_plugin_data *ip_data)
+{
+	return do_cue_open(ip_data, 1);
+}
+
+
 static int cue_close(struct input_plugin_data *ip_data)
 {
 	struct cue_private *priv = ip_data->private;
@@ -166,7 +264,12 @@ static int cue_close(struct input_plugin_data *ip_data)
 	close(ip_data->fd);
 	ip_data->fd = -1;
 
-	ip_delete(priv->child);
+	/* played to the end, the next track may continue in the same file */
+	if (!priv->probe && priv->current_offset >= priv->end_offset)
+		park_child(priv);
+	else
+		ip_delete(priv->child);
+	free_pending(priv);
 	free(priv->cue_filename);
 
 	free(priv);
@@ -178,7 +281,7 @@ static int cue_close(struct input_plugin_data *ip_data)
 
 static int cue_read(struct input_plugin_data *ip_data, char *buffer, int count)
 {
-	int rc;
+	int rc, from_pending = 0;
 	sample_format_t sf;
 	double len;
 	double rem_len;
@@ -187,9 +290,15 @@ static int cue_read(struct input_plugin_data *ip_data, char *buffer, int count)
 	if (priv->current_offset >= priv->end_offset)
 		return 0;
 
-	rc = ip_read(priv->child, buffer, count);
-	if (rc <= 0)
-		return rc;
+	if (priv->pending_len) {
+		rc = min_i(count, priv->pending_len);
+		memcpy(buffer, priv->pending + priv->pending_pos, rc);
+		from_pending = 1;
+	} else {
+		rc = ip_read(priv->child, buffer, count);
+		if (rc <= 0)
+			return rc;
+	}
 
 	sf = ip_get_sf(priv->child);
 	len = (double)rc / sf_get_second_size(sf);
@@ -197,9 +306,25 @@ static int cue_read(struct input_plugin_data *ip_data, char *buffer, int count)
 	rem_len = priv->end_offset - priv->current_offset;
 	priv->current_offset += len;
 
-	if (priv->current_offset >= priv->end_offset)
-		rc = lround(rem_len * sf_get_rate(sf)) * sf_get_frame_size(sf);
+	if (priv->current_offset >= priv->end_offset) {
+		int n = lround(rem_len * sf_get_rate(sf)) * sf_get_frame_size(sf);
+
+		if (n < rc && !from_pending) {
+			/* start of the next track, keep it for a seamless transition */
+			priv->pending = xmalloc(rc - n);
+			memcpy(priv->pending, buffer + n, rc - n);
+			priv->pending_len = rc - n;
+		}
+		if (n < rc)
+			rc = n;
+	}
 
+	if (from_pending) {
+		priv->pending_pos += rc;
+		priv->pending_len -= rc;
+		if (!priv->pending_len)
+			free_pending(priv);
+	}
 	return rc;
 }
 
@@ -213,6 +338,7 @@ static int cue_seek(struct input_plugin_data *ip_data, double offset)
 		new_offset = priv->end_offset;
 
 	priv->current_offset = new_offset;
+	free_pending(priv);
 
 	return ip_seek(priv->child, new_offset);
 }
@@ -221,7 +347,7 @@ static int cue_seek(struct input_plugin_data *ip_data, double offset)
 static int cue_read_comments(struct input_plugin_data *ip_data, struct keyval **comments)
 {
 	struct cue_private *priv = ip_data->private;
-	struct cue_sheet *cd = cue_from_file(priv->cue_filename);
+	struct cue_sheet *cd = cue_cache_get(priv->cue_filename);
 	struct cue_track *t;
 	int rc;
 	char buf[32] = { 0 };
@@ -267,11 +393,11 @@ static int cue_read_comments(struct input_plugin_data *ip_data, struct keyval **
 	keyvals_terminate(&c);
 	*comments = c.keyvals;
 
-	cue_free(cd);
+	cue_cache_put(cd);
 	return 0;
 
 get_track_failed:
-	cue_free(cd);
+	cue_cache_put(cd);
 
 cue_parse_failed:
 	return rc;
@@ -286,6 +412,15 @@ static int cue_duration(struct input_plugin_data *ip_data)
 }
 
 
+/* the last track ends where the child does, the bitrate is the child's */
+static int cue_duration_estimated(struct input_plugin_data *ip_data)
+{
+	struct cue_private *priv = ip_data->private;
+
+	return ip_duration_estimated(priv->child);
+}
+
+
 static long cue_bitrate(struct input_plugin_data *ip_data)
 {
 	struct cue_private *priv = ip_data->private;
@@ -329,6 +464,8 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate_current = cue_current_bitrate,
 	.codec           = cue_codec,
 	.codec_profile   = cue_codec_profile,
+	.probe           = cue_probe,
+	.duration_estimated = cue_duration_estimated,
 };
 
 const int ip_priority = 50;
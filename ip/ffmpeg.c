@@ -26,6 +26,8 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
@@ -40,6 +42,13 @@
 #define AVCODEC_MAX_AUDIO_FRAME_SIZE 192000
 #endif
 
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 48, 101)
+#define USE_SEND_RECEIVE 1
+#endif
+
+/* upper limit of input.ffmpeg.demux_packets */
+#define MAX_QUEUE 64
+
 struct ffmpeg_input {
 	AVPacket pkt;
 	int curr_pkt_size;
@@ -48,6 +57,17 @@ struct ffmpeg_input {
 
 	unsigned long curr_size;
 	unsigned long curr_duration;
+
+#ifdef USE_SEND_RECEIVE
+	/* packets of stream_index read but not sent to the decoder yet */
+	AVPacket *queue[MAX_QUEUE];
+	int queue_head;
+	int queue_len;
+	AVFrame *frame;
+	unsigned int eof : 1;
+	/* end of stream sent to the decoder */
+	unsigned int draining : 1;
+#endif
 };
 
 struct ffmpeg_output {
@@ -65,11 +85,23 @@ struct ffmpeg_private {
 
 	struct ffmpeg_input *input;
 	struct ffmpeg_output *output;
+
+	/* codec profile when opened by ffmpeg_probe() */
+	int profile;
+
+	/* time spent in ffmpeg_fill_buffer() and bytes it returned */
+	uint64_t decode_us;
+	uint64_t decoded_bytes;
 };
 
+/* options */
+static int ffmpeg_thread_count;
+static int ffmpeg_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+static int ffmpeg_demux_packets = 8;
+
 static struct ffmpeg_input *ffmpeg_input_create(void)
 {
-	struct ffmpeg_input *input = xnew(struct ffmpeg_input, 1);
+	struct ffmpeg_input *input = xnew0(struct ffmpeg_input, 1);
 
 	if (av_new_packet(&input->pkt, 0) != 0) {
 		free(input);
@@ -77,15 +109,38 @@ static struct ffmpeg_input *ffmpeg_input_create(void)
 	}
 	input->curr_pkt_size = 0;
 	input->curr_pkt_buf = input->pkt.data;
+#ifdef USE_SEND_RECEIVE
+	for (int i = 0; i < MAX_QUEUE; i++)
+		input->queue[i] = av_packet_alloc();
+	input->frame = av_frame_alloc();
+#endif
 	return input;
 }
 
+#ifdef USE_SEND_RECEIVE
+static void ffmpeg_input_drop_queue(struct ffmpeg_input *input)
+{
+	while (input->queue_len) {
+		av_packet_unref(input->queue[input->queue_head]);
+		input->queue_head = (input->queue_head + 1) % MAX_QUEUE;
+		input->queue_len--;
+	}
+	input->eof = 0;
+	input->draining = 0;
+}
+#endif
+
 static void ffmpeg_input_free(struct ffmpeg_input *input)
 {
 #if LIBAVCODEC_VERSION_MAJOR >= 56
 	av_packet_unref(&input->pkt);
 #else
 	av_free_packet(&input->pkt);
+#endif
+#ifdef USE_SEND_RECEIVE
+	for (int i = 0; i < MAX_QUEUE; i++)
+		av_packet_free(&input->queue[i]);
+	av_frame_free(&input->frame);
 #endif
 	free(input);
 }
@@ -202,6 +257,9 @@ static int ffmpeg_open(struct input_plugin_data *ip_data)
 			break;
 		}
 
+		/* decoders without thread support ignore these */
+		cc->thread_count = ffmpeg_thread_count;
+		cc->thread_type = ffmpeg_thread_type;
 		if (avcodec_open2(cc, codec, NULL) < 0) {
 			d_print("could not open codec: %d, %s\n", cc->codec_id, avcodec_get_name(cc->codec_id));
 			err = -IP_ERROR_UNSUPPORTED_FILE_TYPE;
@@ -269,6 +327,14 @@ static int ffmpeg_open(struct input_plugin_data *ip_data)
 		ip_data->sf |= sf_bits(32) | sf_signed(1);
 		av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_S32,  0);
 		break;
+	case AV_SAMPLE_FMT_FLT:
+	case AV_SAMPLE_FMT_FLTP:
+	case AV_SAMPLE_FMT_DBL:
+	case AV_SAMPLE_FMT_DBLP:
+		/* float codecs (aac, mp3, vorbis, opus...), avoid s16 rounding */
+		ip_data->sf |= sf_host_float();
+		av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_FLT,  0);
+		break;
 	/* AV_SAMPLE_FMT_S16 */
 	default:
 		ip_data->sf |= sf_bits(16) | sf_signed(1);
@@ -277,6 +343,8 @@ static int ffmpeg_open(struct input_plugin_data *ip_data)
 	}
 	swr_init(swr);
 	ip_data->sf |= sf_host_endian();
+	d_print("%s: %d threads, type %d\n", codec->name, cc->thread_count,
+			cc->active_thread_type);
 #if LIBAVCODEC_VERSION_MAJOR >= 60
 	channel_map_init_waveex(cc->ch_layout.nb_channels, cc->ch_layout.u.mask, ip_data->channel_map);
 #else
@@ -285,23 +353,215 @@ static int ffmpeg_open(struct input_plugin_data *ip_data)
 	return 0;
 }
 
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 48, 101)
+/*
+ * avformat_find_stream_info() decodes packets to fill in whatever the
+ * container headers leave out.  Skip it, and opening the decoder, when
+ * the headers already give the codec and the duration.
+ */
+static int ffmpeg_probe(struct input_plugin_data *ip_data)
+{
+	struct ffmpeg_private *priv;
+	AVFormatContext *ic = NULL;
+	AVCodecParameters *cp = NULL;
+	AVCodec const *codec;
+	AVStream *st = NULL;
+	int err, i, tries;
+
+	ffmpeg_init();
+
+	err = avformat_open_input(&ic, ip_data->filename, NULL, NULL);
+	if (err < 0) {
+		d_print("av_open failed: %d\n", err);
+		return -IP_ERROR_FILE_FORMAT;
+	}
+
+	for (tries = 0; tries < 2; tries++) {
+		if (tries) {
+			d_print("headers incomplete, reading stream info\n");
+			err = avformat_find_stream_info(ic, NULL);
+			if (err < 0) {
+				d_print("unable to find stream info: %d\n", err);
+				avformat_close_input(&ic);
+				return -IP_ERROR_FILE_FORMAT;
+			}
+		}
+
+		st = NULL;
+		for (i = 0; i < ic->nb_streams; i++) {
+			if (ic->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+				st = ic->streams[i];
+				break;
+			}
+		}
+		if (!st)
+			continue;
+		cp = st->codecpar;
+		if (ic->duration == AV_NOPTS_VALUE && st->duration != AV_NOPTS_VALUE)
+			ic->duration = av_rescale_q(st->duration, st->time_base, AV_TIME_BASE_Q);
+		if (cp->codec_id != AV_CODEC_ID_NONE && ic->duration != AV_NOPTS_VALUE)
+			break;
+	}
+	if (!st) {
+		d_print("could not find audio stream\n");
+		avformat_close_input(&ic);
+		return -IP_ERROR_FILE_FORMAT;
+	}
+
+	codec = avcodec_find_decoder(cp->codec_id);
+	if (!codec) {
+		d_print("codec not found: %d, %s\n", cp->codec_id, avcodec_get_name(cp->codec_id));
+		avformat_close_input(&ic);
+		return -IP_ERROR_UNSUPPORTED_FILE_TYPE;
+	}
+
+	if (!ic->bit_rate) {
+		int64_t size = ic->pb ? avio_size(ic->pb) : -1;
+
+		if (cp->bit_rate > 0)
+			ic->bit_rate = cp->bit_rate;
+		else if (size > 0 && ic->duration > 0)
+			ic->bit_rate = av_rescale(size * 8, AV_TIME_BASE, ic->duration);
+	}
+
+	priv = xnew0(struct ffmpeg_private, 1);
+	priv->input_context = ic;
+	priv->codec = codec;
+	priv->profile = cp->profile;
+	ip_data->private = priv;
+	return 0;
+}
+#endif
+
 static int ffmpeg_close(struct input_plugin_data *ip_data)
 {
 	struct ffmpeg_private *priv = ip_data->private;
 
-	avcodec_close(priv->codec_context);
+	if (priv->decode_us && priv->decoded_bytes) {
+		double audio = (double)priv->decoded_bytes / sf_get_second_size(ip_data->sf);
+
+		d_print("%s: %.1f s decoded in %.3f s, %.0fx realtime\n", priv->codec->name,
+				audio, priv->decode_us / 1e6, audio * 1e6 / priv->decode_us);
+	}
+
+	/* only the format context if opened by ffmpeg_probe() */
+	if (priv->codec_context) {
+		avcodec_close(priv->codec_context);
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 48, 101)
-	avcodec_free_context(&priv->codec_context);
+		avcodec_free_context(&priv->codec_context);
 #endif
+	}
 	avformat_close_input(&priv->input_context);
 	swr_free(&priv->swr);
-	ffmpeg_input_free(priv->input);
-	ffmpeg_output_free(priv->output);
+	if (priv->input)
+		ffmpeg_input_free(priv->input);
+	if (priv->output)
+		ffmpeg_output_free(priv->output);
 	free(priv);
 	ip_data->private = NULL;
 	return 0;
 }
 
+static int ffmpeg_convert_frame(struct input_plugin_data *ip_data, AVCodecContext *cc,
+				AVFrame *frame, struct ffmpeg_output *output, SwrContext *swr)
+{
+	int res = swr_convert(swr,
+			&output->buffer,
+			frame->nb_samples,
+			(const uint8_t **)frame->extended_data,
+			frame->nb_samples);
+	if (res < 0)
+		res = 0;
+	output->buffer_pos = output->buffer;
+#if LIBAVCODEC_VERSION_MAJOR >= 60
+	output->buffer_used_len = res * cc->ch_layout.nb_channels * sf_get_sample_size(ip_data->sf);
+#else
+	output->buffer_used_len = res * cc->channels * sf_get_sample_size(ip_data->sf);
+#endif
+	return output->buffer_used_len;
+}
+
+#ifdef USE_SEND_RECEIVE
+/*
+ * Reads packets of the audio stream until input.ffmpeg.demux_packets are
+ * queued, so the decoder gets a batch at a time and frame threads can work
+ * on them in parallel.
+ */
+static void ffmpeg_demux(AVFormatContext *ic, struct ffmpeg_input *input)
+{
+	while (!input->eof && input->queue_len < ffmpeg_demux_packets) {
+		AVPacket *pkt = input->queue[(input->queue_head + input->queue_len) % MAX_QUEUE];
+
+		if (av_read_frame(ic, pkt) < 0) {
+			input->eof = 1;
+			break;
+		}
+		if (pkt->stream_index != input->stream_index) {
+			av_packet_unref(pkt);
+			continue;
+		}
+		input->curr_size += pkt->size;
+		input->curr_duration += pkt->duration;
+		input->queue_len++;
+	}
+}
+
+/*
+ * This returns the number of bytes added to the buffer.
+ * It returns < 0 on error.  0 on EOF.
+ */
+static int ffmpeg_fill_buffer(struct input_plugin_data *ip_data, AVFormatContext *ic, AVCodecContext *cc,
+			      struct ffmpeg_input *input, struct ffmpeg_output *output, SwrContext *swr)
+{
+	while (1) {
+		int rc = avcodec_receive_frame(cc, input->frame);
+
+		if (rc == 0) {
+			rc = ffmpeg_convert_frame(ip_data, cc, input->frame, output, swr);
+			av_frame_unref(input->frame);
+			if (rc > 0)
+				return rc;
+			continue;
+		}
+		if (rc == AVERROR_EOF)
+			return 0;
+		if (rc != AVERROR(EAGAIN)) {
+			d_print("avcodec_receive_frame() returned %d\n", rc);
+			return -IP_ERROR_INTERNAL;
+		}
+
+		/* the decoder needs more input */
+		if (input->queue_len == 0)
+			ffmpeg_demux(ic, input);
+		if (input->queue_len == 0) {
+			/* drain the frames the decoder (threads) still hold */
+			if (input->draining)
+				return 0;
+			avcodec_send_packet(cc, NULL);
+			input->draining = 1;
+			continue;
+		}
+		while (input->queue_len) {
+			AVPacket *pkt = input->queue[input->queue_head];
+
+			rc = avcodec_send_packet(cc, pkt);
+			if (rc == AVERROR(EAGAIN))
+				break;
+			if (rc < 0) {
+				char errstr[AV_ERROR_MAX_STRING_SIZE];
+
+				/* skip the packet, one bad frame should not end the track */
+				if (av_strerror(rc, errstr, sizeof(errstr)))
+					snprintf(errstr, sizeof(errstr), "%d", rc);
+				d_print("avcodec_send_packet(): %s\n", errstr);
+			}
+			av_packet_unref(pkt);
+			input->queue_head = (input->queue_head + 1) % MAX_QUEUE;
+			input->queue_len--;
+		}
+	}
+}
+#else
 /*
  * This returns the number of bytes added to the buffer.
  * It returns < 0 on error.  0 on EOF.
@@ -346,31 +606,7 @@ static int ffmpeg_fill_buffer(struct input_plugin_data *ip_data, AVFormatContext
 			AVPacket avpkt;
 			av_new_packet(&avpkt, input->curr_pkt_size);
 			memcpy(avpkt.data, input->curr_pkt_buf, input->curr_pkt_size);
-#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 48, 101)
-			int send_result = avcodec_send_packet(cc, &avpkt);
-			if (send_result != 0) {
-				if (send_result != AVERROR(EAGAIN)) {
-					d_print("avcodec_send_packet() returned %d\n", send_result);
-					char errstr[AV_ERROR_MAX_STRING_SIZE];
-					if (!av_strerror(send_result, errstr, AV_ERROR_MAX_STRING_SIZE ))
-					{
-						d_print("av_strerror(): %s\n", errstr);
-					} else {
-						d_print("av_strerror(): Description for error cannot be found\n");
-					}
-					av_packet_unref(&avpkt);
-					return -IP_ERROR_INTERNAL;
-				}
-				len = 0;
-			} else {
-				len = input->curr_pkt_size;
-			}
-
-			int recv_result = avcodec_receive_frame(cc, frame);
-			got_frame = (recv_result == 0) ? 1 : 0;
-#else
 			len = avcodec_decode_audio4(cc, frame, &got_frame, &avpkt);
-#endif
 #if LIBAVCODEC_VERSION_MAJOR >= 56
 			av_packet_unref(&avpkt);
 #else
@@ -385,19 +621,7 @@ static int ffmpeg_fill_buffer(struct input_plugin_data *ip_data, AVFormatContext
 		input->curr_pkt_size -= len;
 		input->curr_pkt_buf += len;
 		if (got_frame) {
-			int res = swr_convert(swr,
-					&output->buffer,
-					frame->nb_samples,
-					(const uint8_t **)frame->extended_data,
-					frame->nb_samples);
-			if (res < 0)
-				res = 0;
-			output->buffer_pos = output->buffer;
-#if LIBAVCODEC_VERSION_MAJOR >= 60
-			output->buffer_used_len = res * cc->ch_layout.nb_channels * sf_get_sample_size(ip_data->sf);
-#else
-			output->buffer_used_len = res * cc->channels * sf_get_sample_size(ip_data->sf);
-#endif
+			ffmpeg_convert_frame(ip_data, cc, frame, output, swr);
 #if LIBAVCODEC_VERSION_MAJOR >= 56
 			av_frame_free(&frame);
 #else
@@ -409,6 +633,7 @@ static int ffmpeg_fill_buffer(struct input_plugin_data *ip_data, AVFormatContext
 	/* This should never get here. */
 	return -IP_ERROR_INTERNAL;
 }
+#endif
 
 static int ffmpeg_read(struct input_plugin_data *ip_data, char *buffer, int count)
 {
@@ -418,11 +643,15 @@ static int ffmpeg_read(struct input_plugin_data *ip_data, char *buffer, int coun
 	int out_size;
 
 	if (output->buffer_used_len == 0) {
+		uint64_t start = us_now();
+
 		rc = ffmpeg_fill_buffer(ip_data, priv->input_context, priv->codec_context,
 				priv->input, priv->output, priv->swr);
+		priv->decode_us += us_now() - start;
 		if (rc <= 0) {
 			return rc;
 		}
+		priv->decoded_bytes += rc;
 	}
 	out_size = min_i(output->buffer_used_len, count);
 	memcpy(buffer, output->buffer_pos, out_size);
@@ -442,6 +671,9 @@ static int ffmpeg_seek(struct input_plugin_data *ip_data, double offset)
 	avcodec_flush_buffers(priv->codec_context);
 	/* Force reading a new packet in next ffmpeg_fill_buffer(). */
 	priv->input->curr_pkt_size = 0;
+#ifdef USE_SEND_RECEIVE
+	ffmpeg_input_drop_queue(priv->input);
+#endif
 
 	ret = av_seek_frame(priv->input_context, priv->input->stream_index, pts, 0);
 
@@ -525,10 +757,92 @@ static char *ffmpeg_codec_profile(struct input_plugin_data *ip_data)
 {
 	struct ffmpeg_private *priv = ip_data->private;
 	const char *profile;
-	profile = av_get_profile_name(priv->codec, priv->codec_context->profile);
+	profile = av_get_profile_name(priv->codec,
+			priv->codec_context ? priv->codec_context->profile : priv->profile);
 	return profile ? xstrdup(profile) : NULL;
 }
 
+static int ffmpeg_set_int(const char *val, int *var, long min, long max)
+{
+	long tmp;
+
+	if (str_to_int(val, &tmp) == -1 || tmp < min || tmp > max) {
+		errno = EINVAL;
+		return -IP_ERROR_ERRNO;
+	}
+	*var = tmp;
+	return 0;
+}
+
+static int ffmpeg_get_int(char **val, int var)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%d", var);
+	*val = xstrdup(buf);
+	return 0;
+}
+
+static int ffmpeg_set_demux_packets(const char *val)
+{
+	return ffmpeg_set_int(val, &ffmpeg_demux_packets, 1, MAX_QUEUE);
+}
+
+static int ffmpeg_get_demux_packets(char **val)
+{
+	return ffmpeg_get_int(val, ffmpeg_demux_packets);
+}
+
+/* 0 lets ffmpeg pick one thread per CPU */
+static int ffmpeg_set_thread_count(const char *val)
+{
+	return ffmpeg_set_int(val, &ffmpeg_thread_count, 0, 64);
+}
+
+static int ffmpeg_get_thread_count(char **val)
+{
+	return ffmpeg_get_int(val, ffmpeg_thread_count);
+}
+
+/* "frame", "slice" or "frame,slice" */
+static int ffmpeg_set_thread_type(const char *val)
+{
+	int type = 0;
+
+	while (*val) {
+		size_t len = strcspn(val, ",");
+
+		if (len == 5 && strncmp(val, "frame", 5) == 0) {
+			type |= FF_THREAD_FRAME;
+		} else if (len == 5 && strncmp(val, "slice", 5) == 0) {
+			type |= FF_THREAD_SLICE;
+		} else {
+			errno = EINVAL;
+			return -IP_ERROR_ERRNO;
+		}
+		val += len;
+		if (*val == ',')
+			val++;
+	}
+	if (!type) {
+		errno = EINVAL;
+		return -IP_ERROR_ERRNO;
+	}
+	ffmpeg_thread_type = type;
+	return 0;
+}
+
+static int ffmpeg_get_thread_type(char **val)
+{
+	if (ffmpeg_thread_type == FF_THREAD_FRAME)
+		*val = xstrdup("frame");
+	else if (ffmpeg_thread_type == FF_THREAD_SLICE)
+		*val = xstrdup("slice");
+	else
+		*val = xstrdup("frame,slice");
+	return 0;
+}
+
 const struct input_plugin_ops ip_ops = {
 	.open = ffmpeg_open,
 	.close = ffmpeg_close,
@@ -539,7 +853,10 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate = ffmpeg_bitrate,
 	.bitrate_current = ffmpeg_current_bitrate,
 	.codec = ffmpeg_codec,
-	.codec_profile = ffmpeg_codec_profile
+	.codec_profile = ffmpeg_codec_profile,
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 48, 101)
+	.probe = ffmpeg_probe,
+#endif
 };
 
 const int ip_priority = 30;
@@ -553,5 +870,10 @@ const char *const ip_extensions[] = {
 	NULL
 };
 const char *const ip_mime_types[] = { NULL };
-const struct input_plugin_opt ip_options[] = { { NULL } };
+const struct input_plugin_opt ip_options[] = {
+	{ "demux_packets", ffmpeg_set_demux_packets, ffmpeg_get_demux_packets },
+	{ "thread_count", ffmpeg_set_thread_count, ffmpeg_get_thread_count },
+	{ "thread_type", ffmpeg_set_thread_type, ffmpeg_get_thread_type },
+	{ NULL },
+};
 const unsigned ip_abi_version = IP_ABI_VERSION;
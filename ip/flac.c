@@ -21,11 +21,13 @@
 #include "../xmalloc.h"
 #include "../debug.h"
 #include "../utils.h"
+#include "../file.h"
 
 #include <FLAC/export.h>
 #include <FLAC/stream_decoder.h>
 #include <FLAC/metadata.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
@@ -193,6 +195,42 @@ static FLAC__StreamDecoderWriteStatus write_cb(const Dec *dec, const FLAC__Frame
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
+static void set_stream_info(struct input_plugin_data *ip_data, unsigned int sample_rate,
+		unsigned int channels, unsigned int bits_per_sample, uint64_t total_samples)
+{
+	struct flac_private *priv = ip_data->private;
+	int bits = 0;
+
+	if (bits_per_sample >= 4 && bits_per_sample <= 32) {
+		bits = priv->bps = bits_per_sample;
+		bits = 8 * ((bits + 7) / 8);
+	}
+
+	ip_data->sf = sf_rate(sample_rate) |
+		sf_bits(bits) |
+		sf_signed(1) |
+		sf_channels(channels);
+	if (!ip_data->remote && total_samples && sample_rate) {
+		priv->duration = (double) total_samples / sample_rate;
+		if (priv->duration >= 1 && priv->len >= 1)
+			priv->bitrate = priv->len * 8 / priv->duration;
+	}
+}
+
+/* @str is "KEY=value", not necessarily null-terminated */
+static void add_comment(struct growing_keyvals *c, const char *str, size_t len)
+{
+	const char *val = memchr(str, '=', len);
+	char *key;
+
+	if (!val)
+		return;
+	key = xstrndup(str, val - str);
+	val++;
+	comments_add(c, key, xstrndup(val, str + len - val));
+	free(key);
+}
+
 /* You should make a copy of metadata with FLAC__metadata_object_clone() if you will
  * need it elsewhere. Since metadata blocks can potentially be large, by
  * default the decoder only calls the metadata callback for the STREAMINFO
@@ -208,22 +246,9 @@ static void metadata_cb(const Dec *dec, const FLAC__StreamMetadata *metadata, vo
 	case FLAC__METADATA_TYPE_STREAMINFO:
 		{
 			const FLAC__StreamMetadata_StreamInfo *si = &metadata->data.stream_info;
-			int bits = 0;
-
-			if (si->bits_per_sample >= 4 && si->bits_per_sample <= 32) {
-				bits = priv->bps = si->bits_per_sample;
-				bits = 8 * ((bits + 7) / 8);
-			}
 
-			ip_data->sf = sf_rate(si->sample_rate) |
-				sf_bits(bits) |
-				sf_signed(1) |
-				sf_channels(si->channels);
-			if (!ip_data->remote && si->total_samples) {
-				priv->duration = (double) si->total_samples / si->sample_rate;
-				if (priv->duration >= 1 && priv->len >= 1)
-					priv->bitrate = priv->len * 8 / priv->duration;
-			}
+			set_stream_info(ip_data, si->sample_rate, si->channels,
+					si->bits_per_sample, si->total_samples);
 		}
 		break;
 	case FLAC__METADATA_TYPE_VORBIS_COMMENT:
@@ -236,16 +261,10 @@ static void metadata_cb(const Dec *dec, const FLAC__StreamMetadata *metadata, vo
 
 			nr = metadata->data.vorbis_comment.num_comments;
 			for (i = 0; i < nr; i++) {
-				const char *str = (const char *)metadata->data.vorbis_comment.comments[i].entry;
-				char *key, *val;
-
-				val = strchr(str, '=');
-				if (!val)
-					continue;
-				key = xstrndup(str, val - str);
-				val = xstrdup(val + 1);
-				comments_add(&c, key, val);
-				free(key);
+				const FLAC__StreamMetadata_VorbisComment_Entry *e =
+					&metadata->data.vorbis_comment.comments[i];
+
+				add_comment(&c, (const char *)e->entry, e->length);
 			}
 			keyvals_terminate(&c);
 			priv->comments = c.keyvals;
@@ -267,8 +286,10 @@ static void free_priv(struct input_plugin_data *ip_data)
 	struct flac_private *priv = ip_data->private;
 	int save = errno;
 
-	F(finish)(priv->dec);
-	F(delete)(priv->dec);
+	if (priv->dec) {
+		F(finish)(priv->dec);
+		F(delete)(priv->dec);
+	}
 	if (priv->comments)
 		keyvals_free(priv->comments);
 	free(priv->buf);
@@ -409,6 +430,124 @@ static int flac_open(struct input_plugin_data *ip_data)
 	return 0;
 }
 
+static uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void parse_vorbis_comment(struct input_plugin_data *ip_data,
+		const unsigned char *buf, uint32_t len)
+{
+	struct flac_private *priv = ip_data->private;
+	GROWING_KEYVALS(c);
+	uint32_t pos, nr, i;
+
+	if (len < 8 || get_le32(buf) > len - 8)
+		return;
+	pos = 4 + get_le32(buf);
+	nr = get_le32(buf + pos);
+	pos += 4;
+	for (i = 0; i < nr && len - pos >= 4; i++) {
+		uint32_t size = get_le32(buf + pos);
+
+		pos += 4;
+		if (size > len - pos)
+			break;
+		add_comment(&c, (const char *)buf + pos, size);
+		pos += size;
+	}
+	keyvals_terminate(&c);
+	priv->comments = c.keyvals;
+}
+
+/*
+ * Reads STREAMINFO and VORBIS_COMMENT directly, seeking over the other
+ * metadata blocks.  Pictures and padding are never read and no decoder
+ * is allocated.
+ */
+static int flac_probe(struct input_plugin_data *ip_data)
+{
+	struct flac_private *priv;
+	unsigned char buf[34];
+	off_t pos = 0, size;
+	int last = 0;
+
+	if (ip_data->remote)
+		return flac_open(ip_data);
+
+	size = lseek(ip_data->fd, 0, SEEK_END);
+	if (size == -1)
+		return -IP_ERROR_ERRNO;
+
+	priv = xnew0(struct flac_private, 1);
+	priv->duration = -1;
+	priv->bitrate = -1;
+	priv->len = size;
+	ip_data->private = priv;
+	ip_data->sf = 0;
+
+	if (pread_all(ip_data->fd, buf, 10, 0) != 10)
+		goto format;
+	/* libFLAC skips ID3v2 tags too */
+	if (memcmp(buf, "ID3", 3) == 0) {
+		pos = 10 + ((buf[6] & 0x7f) << 21 | (buf[7] & 0x7f) << 14 |
+				(buf[8] & 0x7f) << 7 | (buf[9] & 0x7f));
+		if (buf[5] & 0x10)
+			pos += 10;
+		if (pread_all(ip_data->fd, buf, 4, pos) != 4)
+			goto format;
+	}
+	if (memcmp(buf, "fLaC", 4))
+		goto format;
+	pos += 4;
+
+	while (!last) {
+		uint32_t len;
+		int type;
+
+		if (pread_all(ip_data->fd, buf, 4, pos) != 4)
+			goto format;
+		last = buf[0] & 0x80;
+		type = buf[0] & 0x7f;
+		len = buf[1] << 16 | buf[2] << 8 | buf[3];
+		pos += 4;
+
+		if (type == FLAC__METADATA_TYPE_STREAMINFO && len >= 34) {
+			if (pread_all(ip_data->fd, buf, 34, pos) != 34)
+				goto format;
+			set_stream_info(ip_data,
+					buf[10] << 12 | buf[11] << 4 | buf[12] >> 4,
+					((buf[12] >> 1) & 7) + 1,
+					((buf[12] & 1) << 4 | buf[13] >> 4) + 1,
+					(uint64_t)(buf[13] & 0xf) << 32 | (uint32_t)buf[14] << 24 |
+					buf[15] << 16 | buf[16] << 8 | buf[17]);
+		} else if (type == FLAC__METADATA_TYPE_VORBIS_COMMENT && !priv->comments) {
+			unsigned char *vc = xnew(unsigned char, len);
+
+			if (pread_all(ip_data->fd, vc, len, pos) != len) {
+				free(vc);
+				goto format;
+			}
+			parse_vorbis_comment(ip_data, vc, len);
+			free(vc);
+		}
+		pos += len;
+	}
+
+	if (!ip_data->sf)
+		goto format;
+	if (!sf_get_bits(ip_data->sf)) {
+		free_priv(ip_data);
+		return -IP_ERROR_SAMPLE_FORMAT;
+	}
+	if (sf_get_channels(ip_data->sf) > 8)
+		goto format;
+	return 0;
+format:
+	free_priv(ip_data);
+	return -IP_ERROR_FILE_FORMAT;
+}
+
 static int flac_close(struct input_plugin_data *ip_data)
 {
 	free_priv(ip_data);
@@ -513,7 +652,8 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate = flac_bitrate,
 	.bitrate_current = flac_bitrate,
 	.codec = flac_codec,
-	.codec_profile = flac_codec_profile
+	.codec_profile = flac_codec_profile,
+	.probe = flac_probe
 };
 
 const int ip_priority = 50;
@@ -25,10 +25,16 @@
 #include "../debug.h"
 #include "../utils.h"
 #include "../comment.h"
+#include "../index_store.h"
+#include "../locking.h"
+#include "../misc.h"
 
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -67,9 +73,253 @@ static struct nomad_callbacks callbacks = {
 	.close = close_func
 };
 
+static enum nomad_duration duration_mode = NOMAD_DURATION_ESTIMATE;
+
+static const char * const duration_mode_names[] = {
+	"fast", "estimate", "exact", NULL
+};
+
+static void load_index(struct nomad *nomad, const char *filename)
+{
+	size_t size;
+	void *index = index_store_load(filename, "mp3", &size);
+
+	if (index) {
+		nomad_set_index(nomad, index, size);
+		free(index);
+	}
+}
+
+/* only from the scan thread or at exit, see scan_queue_add() */
+static void save_seek_index(const char *filename, void *index, size_t size)
+{
+	size_t old_size;
+	void *old = index_store_load(filename, "mp3", &old_size);
+
+	free(old);
+	/* e.g. a count that finished while the file played covers more */
+	if (old && old_size >= size)
+		return;
+	index_store_save(filename, "mp3", index, size);
+}
+
+static void save_index(struct nomad *nomad, const char *filename)
+{
+	void *index;
+	size_t size = nomad_get_index(nomad, &index);
+
+	if (size) {
+		save_seek_index(filename, index, size);
+		free(index);
+	}
+}
+
+/*
+ * Files whose frames couldn't be counted keep their estimate, so that they
+ * aren't probed and queued again on every cache update.  The mark goes
+ * away with the entry once the file changes.
+ */
+static int scan_failed(const char *filename)
+{
+	size_t size;
+	void *mark = index_store_load(filename, "mp3-failed", &size);
+
+	free(mark);
+	return mark != NULL;
+}
+
+static void set_scan_failed(const char *filename)
+{
+	d_print("can't count frames of %s\n", filename);
+	index_store_save(filename, "mp3-failed", "", 1);
+}
+
 /* ------------------------------------------------------------------------- */
 
-static int mad_open(struct input_plugin_data *ip_data)
+/*
+ * Files with an estimated duration are counted exactly by a thread with
+ * idle I/O priority.  The count goes to index_store, where the next probe
+ * of the file finds it.  The same thread writes the seek indexes learned
+ * while playing, so that open and close never write to index_store.
+ */
+#define SCAN_QUEUE_SIZE 4096
+
+struct scan_job {
+	char *filename;
+	/* index to save, NULL to count the frames */
+	void *index;
+	size_t size;
+};
+
+static pthread_mutex_t scan_mutex = CMUS_MUTEX_INITIALIZER;
+static pthread_cond_t scan_cond = CMUS_COND_INITIALIZER;
+static struct scan_job scan_queue[SCAN_QUEUE_SIZE];
+static int scan_queue_len;
+static pthread_t scan_thread;
+static int scan_thread_started;
+static int scan_stop;
+
+static int scan_stopped(void)
+{
+	int rc;
+
+	cmus_mutex_lock(&scan_mutex);
+	rc = scan_stop;
+	cmus_mutex_unlock(&scan_mutex);
+	return rc;
+}
+
+/* aborts the scan of a long file when cmus exits */
+static ssize_t scan_read_func(void *datasource, void *buffer, size_t count)
+{
+	if (scan_stopped()) {
+		errno = EINTR;
+		return -1;
+	}
+	return read_func(datasource, buffer, count);
+}
+
+static struct nomad_callbacks scan_callbacks = {
+	.read = scan_read_func,
+	.lseek = lseek_func,
+	.close = close_func
+};
+
+static void scan_file(char *filename)
+{
+	struct input_plugin_data ip_data = { .filename = filename };
+	struct nomad *nomad;
+
+	ip_data.fd = open(filename, O_RDONLY);
+	if (ip_data.fd == -1) {
+		set_scan_failed(filename);
+		return;
+	}
+	/* on error nomad_open_callbacks closes the fd */
+	if (nomad_open_callbacks(&nomad, &ip_data, &scan_callbacks)) {
+		if (!scan_stopped())
+			set_scan_failed(filename);
+		return;
+	}
+
+	load_index(nomad, filename);
+	if (nomad_info(nomad)->duration_estimated) {
+		if (nomad_scan_duration(nomad, NOMAD_DURATION_EXACT) == 0)
+			save_index(nomad, filename);
+		else if (!scan_stopped())
+			set_scan_failed(filename);
+	}
+	nomad_close(nomad);
+}
+
+static void *scan_loop(void *arg)
+{
+	if (set_idle_io_priority())
+		d_print("ioprio_set: %s\n", strerror(errno));
+
+	cmus_mutex_lock(&scan_mutex);
+	while (1) {
+		struct scan_job job;
+
+		while (scan_queue_len == 0 && !scan_stop)
+			pthread_cond_wait(&scan_cond, &scan_mutex);
+		if (scan_stop)
+			break;
+
+		job = scan_queue[0];
+		scan_queue_len--;
+		memmove(scan_queue, scan_queue + 1, scan_queue_len * sizeof(scan_queue[0]));
+		cmus_mutex_unlock(&scan_mutex);
+
+		if (job.index)
+			save_seek_index(job.filename, job.index, job.size);
+		else
+			scan_file(job.filename);
+		free(job.filename);
+		free(job.index);
+
+		cmus_mutex_lock(&scan_mutex);
+	}
+	cmus_mutex_unlock(&scan_mutex);
+	return NULL;
+}
+
+/* takes @index, which is dropped if the job can't be queued */
+static void scan_queue_add(const char *filename, void *index, size_t size)
+{
+	int i;
+
+	cmus_mutex_lock(&scan_mutex);
+	if (scan_stop)
+		goto drop;
+	for (i = 0; !index && i < scan_queue_len; i++) {
+		if (!scan_queue[i].index && strcmp(scan_queue[i].filename, filename) == 0)
+			goto drop;
+	}
+	/* the next probe or play of the file tries again */
+	if (scan_queue_len == SCAN_QUEUE_SIZE)
+		goto drop;
+
+	if (!scan_thread_started) {
+		int rc = pthread_create(&scan_thread, NULL, scan_loop, NULL);
+
+		if (rc) {
+			d_print("pthread_create: %s\n", strerror(rc));
+			goto drop;
+		}
+		scan_thread_started = 1;
+	}
+	scan_queue[scan_queue_len].filename = xstrdup(filename);
+	scan_queue[scan_queue_len].index = index;
+	scan_queue[scan_queue_len].size = size;
+	scan_queue_len++;
+	pthread_cond_signal(&scan_cond);
+	cmus_mutex_unlock(&scan_mutex);
+	return;
+drop:
+	cmus_mutex_unlock(&scan_mutex);
+	free(index);
+}
+
+static void scan_later(const char *filename)
+{
+	scan_queue_add(filename, NULL, 0);
+}
+
+static void save_index_later(struct nomad *nomad, const char *filename)
+{
+	void *index;
+	size_t size = nomad_get_index(nomad, &index);
+
+	if (size)
+		scan_queue_add(filename, index, size);
+}
+
+static void scan_exit(void)
+{
+	int i;
+
+	cmus_mutex_lock(&scan_mutex);
+	scan_stop = 1;
+	pthread_cond_signal(&scan_cond);
+	cmus_mutex_unlock(&scan_mutex);
+
+	if (scan_thread_started)
+		pthread_join(scan_thread, NULL);
+	for (i = 0; i < scan_queue_len; i++) {
+		/* seek indexes are cheap to keep, unlike a count cut short */
+		if (scan_queue[i].index)
+			save_seek_index(scan_queue[i].filename,
+					scan_queue[i].index, scan_queue[i].size);
+		free(scan_queue[i].filename);
+		free(scan_queue[i].index);
+	}
+	scan_queue_len = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int mad_open_common(struct input_plugin_data *ip_data, int probe)
 {
 	struct nomad *nomad;
 	const struct nomad_info *info;
@@ -84,6 +334,22 @@ static int mad_open(struct input_plugin_data *ip_data)
 	}
 	ip_data->private = nomad;
 
+	if (!ip_data->remote) {
+		load_index(nomad, ip_data->filename);
+		if (!nomad_info(nomad)->duration_estimated) {
+			/* exact from the header or the index */
+		} else if (duration_mode == NOMAD_DURATION_FAST ||
+				scan_failed(ip_data->filename)) {
+			nomad_keep_estimate(nomad);
+		} else if (nomad_scan_duration(nomad, NOMAD_DURATION_ESTIMATE)) {
+			d_print("scan failed: %s\n", strerror(errno));
+		}
+		/* counting every frame is left to the scan thread */
+		if ((probe || duration_mode == NOMAD_DURATION_EXACT) &&
+				nomad_info(nomad)->duration_estimated)
+			scan_later(ip_data->filename);
+	}
+
 	info = nomad_info(nomad);
 
 	/* always 16-bit signed little-endian */
@@ -93,11 +359,24 @@ static int mad_open(struct input_plugin_data *ip_data)
 	return 0;
 }
 
+static int mad_open(struct input_plugin_data *ip_data)
+{
+	return mad_open_common(ip_data, 0);
+}
+
+/* same as open, but the duration may be counted in the background */
+static int mad_probe(struct input_plugin_data *ip_data)
+{
+	return mad_open_common(ip_data, 1);
+}
+
 static int mad_close(struct input_plugin_data *ip_data)
 {
 	struct nomad *nomad;
 
 	nomad = ip_data->private;
+	if (!ip_data->remote)
+		save_index_later(nomad, ip_data->filename);
 	nomad_close(nomad);
 	ip_data->fd = -1;
 	ip_data->private = NULL;
@@ -126,24 +405,19 @@ static int mad_read_comments(struct input_plugin_data *ip_data,
 	struct nomad *nomad = ip_data->private;
 	const struct nomad_lame *lame = nomad_lame(nomad);
 	struct id3tag id3;
-	int fd, rc, save, i;
+	int rc, i;
 	APETAG(ape);
 	GROWING_KEYVALS(c);
 
-	fd = open(ip_data->filename, O_RDONLY);
-	if (fd == -1) {
-		return -1;
-	}
 	d_print("filename: %s\n", ip_data->filename);
 
+	/* tags are read with pread(), the decoder's position is kept */
 	id3_init(&id3);
-	rc = id3_read_tags(&id3, fd, ID3_V1 | ID3_V2);
-	save = errno;
-	close(fd);
-	errno = save;
+	rc = id3_ape_read_tags(&id3, ID3_V1 | ID3_V2, &ape, ip_data->fd);
 	if (rc) {
 		if (rc == -1) {
 			d_print("error: %s\n", strerror(errno));
+			ape_free(&ape);
 			return -1;
 		}
 		d_print("corrupted tag?\n");
@@ -160,11 +434,7 @@ static int mad_read_comments(struct input_plugin_data *ip_data,
 next:
 	id3_free(&id3);
 
-	rc = ape_read_tags(&ape, ip_data->fd, 0);
-	if (rc < 0)
-		goto out;
-
-	for (i = 0; i < rc; i++) {
+	for (i = 0; ape.buf && i < ape.header.count; i++) {
 		char *k, *v;
 		k = ape_get_comment(&ape, &v);
 		if (!k)
@@ -172,8 +442,6 @@ next:
 		comments_add(&c, k, v);
 		free(k);
 	}
-
-out:
 	ape_free(&ape);
 
 	/* add last so the other tags get preference */
@@ -200,6 +468,19 @@ static int mad_duration(struct input_plugin_data *ip_data)
 	return nomad_info(nomad)->duration;
 }
 
+static int mad_duration_estimated(struct input_plugin_data *ip_data)
+{
+	struct nomad *nomad = ip_data->private;
+
+	return nomad_info(nomad)->duration_estimated;
+}
+
+static int mad_exit(void)
+{
+	scan_exit();
+	return 0;
+}
+
 static long mad_bitrate(struct input_plugin_data *ip_data)
 {
 	struct nomad *nomad = ip_data->private;
@@ -275,13 +556,39 @@ const struct input_plugin_ops ip_ops = {
 	.bitrate = mad_bitrate,
 	.bitrate_current = mad_current_bitrate,
 	.codec = mad_codec,
-	.codec_profile = mad_codec_profile
+	.codec_profile = mad_codec_profile,
+	.probe = mad_probe,
+	.duration_estimated = mad_duration_estimated,
+	.exit = mad_exit
 };
 
+static int mad_set_duration(const char *val)
+{
+	int i;
+
+	for (i = 0; duration_mode_names[i]; i++) {
+		if (strcasecmp(val, duration_mode_names[i]) == 0) {
+			duration_mode = i;
+			return 0;
+		}
+	}
+	errno = EINVAL;
+	return -IP_ERROR_ERRNO;
+}
+
+static int mad_get_duration(char **val)
+{
+	*val = xstrdup(duration_mode_names[duration_mode]);
+	return 0;
+}
+
 const int ip_priority = 55;
 const char * const ip_extensions[] = { "mp3", "mp2", NULL };
 const char * const ip_mime_types[] = {
 	"audio/mpeg", "audio/x-mp3", "audio/x-mpeg", NULL
 };
-const struct input_plugin_opt ip_options[] = { { NULL } };
+const struct input_plugin_opt ip_options[] = {
+	{ "duration", mad_set_duration, mad_get_duration },
+	{ NULL },
+};
 const unsigned ip_abi_version = IP_ABI_VERSION;
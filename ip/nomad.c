@@ -33,6 +33,7 @@
 
 #include <mad.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
 #include <unistd.h>
@@ -42,6 +43,10 @@
 #define INPUT_BUFFER_SIZE	(5 * 8192)
 #define SEEK_IDX_INTERVAL	15
 
+/* NOMAD_DURATION_ESTIMATE reads this many headers at each of the points */
+#define ESTIMATE_POINTS		8
+#define ESTIMATE_FRAMES		32
+
 /* the number of samples of silence the decoder inserts at start */
 #define DECODERDELAY		529
 
@@ -51,6 +56,25 @@
 struct seek_idx_entry {
 	off_t offset;
 	mad_timer_t timer;
+	/* frames before this one, cur_frame for LAME files */
+	unsigned long frame;
+};
+
+/* serialised seek index, see nomad_get_index() */
+#define INDEX_VERSION		1
+
+struct index_header {
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t frame_samples;
+	uint32_t nr_entries;
+	/* 0 if unknown */
+	uint64_t nr_frames;
+};
+
+struct index_entry {
+	uint64_t offset;
+	uint64_t frame;
 };
 
 struct nomad {
@@ -68,6 +92,7 @@ struct nomad {
 	unsigned int has_lame : 1;
 	unsigned int seen_first_frame : 1;
 	unsigned int readEOF : 1;
+	unsigned int seeked : 1;
 	int start_drop_frames;
 	int start_drop_samples;
 	int end_drop_samples;
@@ -79,7 +104,16 @@ struct nomad {
 	struct {
 		int size;
 		struct seek_idx_entry *table;
+		/* entries that came from nomad_set_index() */
+		int loaded;
+		/* exact number of frames, 0 if not known yet */
+		unsigned long nr_frames;
+		unsigned int nr_frames_loaded : 1;
 	} seek_idx;
+	/* samples per frame */
+	int frame_samples;
+	/* offset of the first frame, after any ID3v2 tag */
+	off_t data_start;
 
 	struct {
 		unsigned long long int bitrate_sum;
@@ -372,6 +406,45 @@ static void handle_lost_sync(struct nomad *nomad)
 /* Builds a seek index as the file is decoded
  * NOTE: increases nomad->timer (current position)
  */
+static unsigned long timer_to_frames(struct nomad *nomad, mad_timer_t timer)
+{
+	unsigned long samples = mad_timer_count(timer, (enum mad_units)nomad->info.sample_rate);
+
+	return (samples + nomad->frame_samples / 2) / nomad->frame_samples;
+}
+
+static mad_timer_t frames_to_timer(struct nomad *nomad, unsigned long frames)
+{
+	unsigned long long samples = (unsigned long long)frames * nomad->frame_samples;
+	mad_timer_t timer;
+
+	mad_timer_set(&timer, samples / nomad->info.sample_rate,
+			samples % nomad->info.sample_rate, nomad->info.sample_rate);
+	return timer;
+}
+
+/*
+ * Xing files without LAME header seek by the TOC and the timer is only
+ * approximate afterwards, don't index them.
+ */
+static int has_seek_index(struct nomad *nomad)
+{
+	return !nomad->has_xing || nomad->has_lame;
+}
+
+/* file offset of nomad->stream.this_frame */
+static off_t this_frame_offset(struct nomad *nomad)
+{
+	/* offset = ftell() */
+	off_t offset = nomad->input_offset;
+
+	/* subtract by buffer length to get offset to start of buffer */
+	offset -= (nomad->stream.bufend - nomad->input_buffer);
+	/* then add offset to the current frame */
+	offset += (nomad->stream.this_frame - nomad->input_buffer);
+	return offset;
+}
+
 static void build_seek_index(struct nomad *nomad)
 {
 	mad_timer_t timer_now = nomad->timer;
@@ -380,24 +453,19 @@ static void build_seek_index(struct nomad *nomad)
 
 	mad_timer_add(&nomad->timer, nomad->frame.header.duration);
 
-	if (nomad->has_xing)
+	if (!has_seek_index(nomad))
 		return;
 
 	if (nomad->timer.seconds < (nomad->seek_idx.size + 1) * SEEK_IDX_INTERVAL)
 		return;
 
-	/* offset = ftell() */
-	offset = nomad->input_offset;
-	/* subtract by buffer length to get offset to start of buffer */
-	offset -= (nomad->stream.bufend - nomad->input_buffer);
-	/* then add offset to the current frame */
-	offset += (nomad->stream.this_frame - nomad->input_buffer);
-
+	offset = this_frame_offset(nomad);
 	idx = nomad->seek_idx.size;
 
 	nomad->seek_idx.table = xrenew(struct seek_idx_entry, nomad->seek_idx.table, idx + 1);
 	nomad->seek_idx.table[idx].offset = offset;
 	nomad->seek_idx.table[idx].timer = timer_now;
+	nomad->seek_idx.table[idx].frame = timer_to_frames(nomad, timer_now);
 
 	nomad->seek_idx.size++;
 }
@@ -411,6 +479,7 @@ static void calc_frames_fast(struct nomad *nomad)
 		nomad->info.nr_frames = nomad->info.filesize /
 			(nomad->stream.next_frame - nomad->stream.this_frame);
 		mad_timer_multiply(&nomad->timer, nomad->info.nr_frames);
+		nomad->info.duration_estimated = 1;
 	}
 }
 
@@ -458,15 +527,16 @@ static int scan(struct nomad *nomad)
 			continue;
 		}
 
-		build_seek_index(nomad);
-
 		// first valid frame
+		nomad->data_start = this_frame_offset(nomad);
 		nomad->info.sample_rate = header->samplerate;
+		nomad->frame_samples = 32 * MAD_NSBSAMPLES(header);
 		nomad->info.channels = MAD_NCHANNELS(header);
 		nomad->info.layer = header->layer;
 		nomad->info.dual_channel = header->mode == MAD_MODE_DUAL_CHANNEL;
 		nomad->info.joint_stereo = header->mode == MAD_MODE_JOINT_STEREO;
 
+		build_seek_index(nomad);
 		xing_parse(nomad);
 		calc_frames_fast(nomad);
 		break;
@@ -491,8 +561,12 @@ start:
 	rc = fill_buffer(nomad);
 	if (rc == -1)
 		return -1;
-	if (rc == 0)
+	if (rc == 0) {
+		/* after a seek the count may be off by a frame */
+		if (!nomad->seeked && nomad->info.filesize != -1 && !nomad->has_xing)
+			nomad->seek_idx.nr_frames = timer_to_frames(nomad, nomad->timer);
 		return 1;
+	}
 
 	if (mad_frame_decode(&nomad->frame, &nomad->stream)) {
 		if (nomad->stream.error == MAD_ERROR_BUFLEN)
@@ -729,17 +803,35 @@ next_frame:
 	return j;
 }
 
-static int nomad_time_seek_accurate(struct nomad *nomad, double pos)
+/* returns index of the last entry before @pos or -1 */
+static int seek_idx_find(struct nomad *nomad, double pos)
 {
-	int rc;
+	int idx = (int)(pos / SEEK_IDX_INTERVAL) - 1;
 
-	/* seek to beginning of file and search frame-by-frame */
-	if (nomad->cbs.lseek(nomad->datasource, 0, SEEK_SET) == -1)
-		return -1;
+	if (idx > nomad->seek_idx.size - 1)
+		idx = nomad->seek_idx.size - 1;
+	return idx;
+}
+
+static int nomad_time_seek_accurate(struct nomad *nomad, double pos)
+{
+	off_t offset = 0;
+	int idx, rc;
 
 	/* XING header should NOT be counted - if we're here, we know it's present */
 	nomad->cur_frame = -1;
 
+	/* search frame-by-frame from the closest indexed frame */
+	idx = seek_idx_find(nomad, pos);
+	if (idx >= 0) {
+		offset = nomad->seek_idx.table[idx].offset;
+		nomad->timer = nomad->seek_idx.table[idx].timer;
+		nomad->cur_frame = nomad->seek_idx.table[idx].frame - 1;
+	}
+	if (nomad->cbs.lseek(nomad->datasource, offset, SEEK_SET) == -1)
+		return -1;
+	nomad->input_offset = offset;
+
 	while (timer_to_seconds(nomad->timer) < pos) {
 		rc = fill_buffer(nomad);
 		if (rc == -1)
@@ -759,7 +851,7 @@ static int nomad_time_seek_accurate(struct nomad *nomad, double pos)
 			continue;
 		}
 		nomad->cur_frame++;
-		mad_timer_add(&nomad->timer, nomad->frame.header.duration);
+		build_seek_index(nomad);
 	}
 #if defined(DEBUG_LAME)
 		d_print("seeked to %g = %g\n", pos, timer_to_seconds(nomad->timer));
@@ -781,6 +873,7 @@ int nomad_time_seek(struct nomad *nomad, double pos)
 	}
 	free_mad(nomad);
 	init_mad(nomad);
+	nomad->seeked = 1;
 
 	/* if file has a LAME header, perform frame-accurate seek for gapless playback */
 	if (nomad->has_lame) {
@@ -804,10 +897,7 @@ int nomad_time_seek(struct nomad *nomad, double pos)
 #endif
 		offset = ((unsigned long long)nomad->xing.toc[ki] * nomad->xing.bytes) / 256;
 	} else if (nomad->seek_idx.size > 0) {
-		int idx = (int)(pos / SEEK_IDX_INTERVAL) - 1;
-
-		if (idx > nomad->seek_idx.size - 1)
-			idx = nomad->seek_idx.size - 1;
+		int idx = seek_idx_find(nomad, pos);
 
 		if (idx >= 0) {
 			offset = nomad->seek_idx.table[idx].offset;
@@ -845,6 +935,242 @@ int nomad_time_seek(struct nomad *nomad, double pos)
 	return 0;
 }
 
+size_t nomad_get_index(struct nomad *nomad, void **datap)
+{
+	struct index_header *h;
+	struct index_entry *e;
+	size_t size;
+	int i;
+
+	if (!has_seek_index(nomad) || nomad->info.filesize == -1)
+		return 0;
+	if (nomad->seek_idx.size <= nomad->seek_idx.loaded &&
+			(!nomad->seek_idx.nr_frames || nomad->seek_idx.nr_frames_loaded))
+		return 0;
+
+	size = sizeof(*h) + nomad->seek_idx.size * sizeof(*e);
+	h = xmalloc(size);
+	h->version = INDEX_VERSION;
+	h->sample_rate = nomad->info.sample_rate;
+	h->frame_samples = nomad->frame_samples;
+	h->nr_entries = nomad->seek_idx.size;
+	h->nr_frames = nomad->seek_idx.nr_frames;
+	e = (struct index_entry *)(h + 1);
+	for (i = 0; i < nomad->seek_idx.size; i++) {
+		e[i].offset = nomad->seek_idx.table[i].offset;
+		e[i].frame = nomad->seek_idx.table[i].frame;
+	}
+	*datap = h;
+	return size;
+}
+
+int nomad_set_index(struct nomad *nomad, const void *data, size_t size)
+{
+	const struct index_header *h = data;
+	const struct index_entry *e = (const struct index_entry *)(h + 1);
+	uint64_t prev_offset = 0, prev_frame = 0;
+	int i;
+
+	if (!has_seek_index(nomad) || nomad->info.filesize == -1)
+		return -1;
+	if (size < sizeof(*h) || h->version != INDEX_VERSION ||
+			h->sample_rate != nomad->info.sample_rate ||
+			h->frame_samples != nomad->frame_samples ||
+			size != sizeof(*h) + (size_t)h->nr_entries * sizeof(*e))
+		return -1;
+	for (i = 0; i < h->nr_entries; i++) {
+		if (e[i].offset <= prev_offset || e[i].offset >= nomad->info.filesize ||
+				e[i].frame <= prev_frame)
+			return -1;
+		prev_offset = e[i].offset;
+		prev_frame = e[i].frame;
+	}
+	if (h->nr_frames && h->nr_frames < prev_frame)
+		return -1;
+
+	free(nomad->seek_idx.table);
+	nomad->seek_idx.table = xnew(struct seek_idx_entry, h->nr_entries);
+	for (i = 0; i < h->nr_entries; i++) {
+		nomad->seek_idx.table[i].offset = e[i].offset;
+		nomad->seek_idx.table[i].frame = e[i].frame;
+		nomad->seek_idx.table[i].timer = frames_to_timer(nomad, e[i].frame);
+	}
+	nomad->seek_idx.size = h->nr_entries;
+	nomad->seek_idx.loaded = h->nr_entries;
+
+	if (h->nr_frames) {
+		nomad->seek_idx.nr_frames = h->nr_frames;
+		nomad->seek_idx.nr_frames_loaded = 1;
+		/* better than the estimate from the first frame */
+		if (!nomad->has_xing) {
+			nomad->info.nr_frames = h->nr_frames;
+			nomad->info.duration_estimated = 0;
+			nomad->info.duration = timer_to_seconds(frames_to_timer(nomad, h->nr_frames));
+			if (nomad->info.duration > 0)
+				nomad->info.avg_bitrate = nomad->info.filesize * 8.0 / nomad->info.duration;
+		}
+	}
+	d_print("%d entries, %lu frames\n", nomad->seek_idx.size, nomad->seek_idx.nr_frames);
+	return 0;
+}
+
+/*
+ * Average frame size from runs of frame headers at a few offsets.  Leaves
+ * the estimate from the first frame if none are found.
+ */
+static int estimate_frames(struct nomad *nomad)
+{
+	struct mad_header *header = &nomad->frame.header;
+	off_t size = nomad->info.filesize - nomad->data_start;
+	unsigned long long bytes = 0;
+	unsigned long min_bitrate = ~0UL, max_bitrate = 0;
+	unsigned long frames = 0, nr_frames;
+	int i;
+
+	for (i = 0; i < ESTIMATE_POINTS; i++) {
+		off_t offset = nomad->data_start + size / ESTIMATE_POINTS * i;
+		int n = 0;
+
+		free_mad(nomad);
+		init_mad(nomad);
+		if (nomad->cbs.lseek(nomad->datasource, offset, SEEK_SET) == -1)
+			return -NOMAD_ERROR_ERRNO;
+		nomad->input_offset = offset;
+
+		while (n < ESTIMATE_FRAMES) {
+			int rc = fill_buffer(nomad);
+
+			if (rc == -1)
+				return -NOMAD_ERROR_ERRNO;
+			if (rc == 0)
+				break;
+
+			if (mad_header_decode(header, &nomad->stream)) {
+				if (nomad->stream.error == MAD_ERROR_BUFLEN)
+					continue;
+				if (!MAD_RECOVERABLE(nomad->stream.error))
+					break;
+				continue;
+			}
+			/* false sync inside frame data */
+			if (header->samplerate != nomad->info.sample_rate ||
+					header->layer != nomad->info.layer)
+				continue;
+
+			bytes += nomad->stream.next_frame - nomad->stream.this_frame;
+			if (header->bitrate < min_bitrate)
+				min_bitrate = header->bitrate;
+			if (header->bitrate > max_bitrate)
+				max_bitrate = header->bitrate;
+			n++;
+		}
+		frames += n;
+	}
+	if (frames == 0 || bytes == 0)
+		return 0;
+
+	nr_frames = (unsigned long long)size * frames / bytes;
+	nomad->info.nr_frames = nr_frames;
+	nomad->info.duration = timer_to_seconds(frames_to_timer(nomad, nr_frames));
+	if (nomad->info.duration > 0)
+		nomad->info.avg_bitrate = size * 8.0 / nomad->info.duration;
+	nomad->info.vbr = min_bitrate != max_bitrate;
+	d_print("%lu frames sampled, %lu estimated\n", frames, nr_frames);
+	return 0;
+}
+
+/* like decode() would count them, without decoding */
+static int count_frames(struct nomad *nomad)
+{
+	struct mad_header *header = &nomad->frame.header;
+	unsigned long min_bitrate = ~0UL, max_bitrate = 0;
+	unsigned long nr_frames;
+
+	free_mad(nomad);
+	init_mad(nomad);
+	if (nomad->cbs.lseek(nomad->datasource, 0, SEEK_SET) == -1)
+		return -NOMAD_ERROR_ERRNO;
+
+	/* the walk rebuilds the whole index, drop any partial one */
+	free(nomad->seek_idx.table);
+	nomad->seek_idx.table = NULL;
+	nomad->seek_idx.size = 0;
+	nomad->seek_idx.loaded = 0;
+
+	while (1) {
+		int rc = fill_buffer(nomad);
+
+		if (rc == -1)
+			return -NOMAD_ERROR_ERRNO;
+		if (rc == 0)
+			break;
+
+		if (mad_header_decode(header, &nomad->stream)) {
+			if (nomad->stream.error == MAD_ERROR_BUFLEN)
+				continue;
+			if (!MAD_RECOVERABLE(nomad->stream.error)) {
+				d_print("unrecoverable frame level error.\n");
+				break;
+			}
+			if (nomad->stream.error == MAD_ERROR_LOSTSYNC)
+				handle_lost_sync(nomad);
+			continue;
+		}
+		nomad->cur_frame++;
+		if (header->bitrate < min_bitrate)
+			min_bitrate = header->bitrate;
+		if (header->bitrate > max_bitrate)
+			max_bitrate = header->bitrate;
+		build_seek_index(nomad);
+	}
+
+	nr_frames = timer_to_frames(nomad, nomad->timer);
+	if (nr_frames == 0)
+		return 0;
+	if (!nomad->has_xing)
+		nomad->seek_idx.nr_frames = nr_frames;
+	nomad->info.nr_frames = nr_frames;
+	nomad->info.duration = timer_to_seconds(nomad->timer);
+	if (nomad->info.duration > 0)
+		nomad->info.avg_bitrate = (nomad->info.filesize - nomad->data_start) * 8.0 /
+			nomad->info.duration;
+	nomad->info.vbr = min_bitrate != max_bitrate;
+	nomad->info.duration_estimated = 0;
+	d_print("%lu frames, %d seek index entries\n", nr_frames, nomad->seek_idx.size);
+	return 0;
+}
+
+int nomad_scan_duration(struct nomad *nomad, enum nomad_duration mode)
+{
+	int rc;
+
+	if (!nomad->info.duration_estimated || nomad->info.filesize == -1)
+		return 0;
+
+	switch (mode) {
+	case NOMAD_DURATION_ESTIMATE:
+		rc = estimate_frames(nomad);
+		break;
+	case NOMAD_DURATION_EXACT:
+		rc = count_frames(nomad);
+		break;
+	default:
+		return 0;
+	}
+
+	/* back to where do_open() left the stream */
+	free_mad(nomad);
+	init_mad(nomad);
+	if (nomad->cbs.lseek(nomad->datasource, 0, SEEK_SET) == -1)
+		return -NOMAD_ERROR_ERRNO;
+	return rc;
+}
+
+void nomad_keep_estimate(struct nomad *nomad)
+{
+	nomad->info.duration_estimated = 0;
+}
+
 const struct nomad_xing *nomad_xing(struct nomad *nomad)
 {
 	return nomad->has_xing ? &nomad->xing : NULL;
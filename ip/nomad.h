@@ -73,6 +73,17 @@ struct nomad_info {
 	off_t filesize;
 	unsigned int joint_stereo : 1;
 	unsigned int dual_channel : 1;
+	/* no frame count in the file, duration and avg_bitrate are guessed */
+	unsigned int duration_estimated : 1;
+};
+
+enum nomad_duration {
+	/* from the size of the first frame */
+	NOMAD_DURATION_FAST,
+	/* from frame headers sampled across the file */
+	NOMAD_DURATION_ESTIMATE,
+	/* by reading every frame header */
+	NOMAD_DURATION_EXACT
 };
 
 enum {
@@ -95,6 +106,27 @@ int nomad_read(struct nomad *nomad, char *buffer, int count);
 /* -NOMAD_ERROR_ERRNO */
 int nomad_time_seek(struct nomad *nomad, double pos);
 
+/*
+ * The seek index built while playing, so that the next open of the same
+ * file can seek without scanning.  nomad_get_index() returns the size of
+ * a malloced blob or 0 if nothing new was learned since nomad_set_index().
+ * nomad_set_index() returns -1 if @data doesn't match the file.
+ */
+size_t nomad_get_index(struct nomad *nomad, void **datap);
+int nomad_set_index(struct nomad *nomad, const void *data, size_t size);
+
+/*
+ * Replaces the duration from the first frame of a file without a frame
+ * count, see enum nomad_duration.  NOMAD_DURATION_EXACT also fills the
+ * seek index.  Call right after opening or nomad_set_index().
+ *
+ * -NOMAD_ERROR_ERRNO
+ */
+int nomad_scan_duration(struct nomad *nomad, enum nomad_duration mode);
+
+/* treats the estimated duration as final, e.g. when it can't be counted */
+void nomad_keep_estimate(struct nomad *nomad);
+
 const struct nomad_xing *nomad_xing(struct nomad *nomad);
 const struct nomad_lame *nomad_lame(struct nomad *nomad);
 const struct nomad_info *nomad_info(struct nomad *nomad);
@@ -101,9 +101,7 @@ static int opus_open(struct input_plugin_data *ip_data)
 
 	ip_data->sf = sf_rate(SAMPLING_RATE)
 		| sf_channels(CHANNELS)
-		| sf_bits(16)
-		| sf_signed(1);
-	ip_data->sf |= sf_host_endian();
+		| sf_host_float();
 	return 0;
 }
 
@@ -134,8 +132,8 @@ static int opus_read(struct input_plugin_data *ip_data, char *buffer, int count)
 	priv = ip_data->private;
 
 	/* samples = number of samples read per channel */
-	samples = op_read_stereo(priv->of, (void*)buffer,
-							 count / sizeof(opus_int16));
+	samples = op_read_float_stereo(priv->of, (void*)buffer,
+							 count / sizeof(float));
 	if (samples < 0) {
 		switch (samples) {
 		case OP_HOLE:
@@ -196,7 +194,7 @@ static int opus_read(struct input_plugin_data *ip_data, char *buffer, int count)
 			}
 
 			/* bytes = samples * channels * sample_size */
-			rc = samples * CHANNELS * sizeof(opus_int16);
+			rc = samples * CHANNELS * sizeof(float);
 		}
 	}
 
@@ -19,6 +19,7 @@
 #include "../ip.h"
 #include "../xmalloc.h"
 #include "../read_wrapper.h"
+#include "../pcm.h"
 #include "../debug.h"
 #ifdef HAVE_CONFIG
 #include "../config/tremor.h"
@@ -171,8 +172,13 @@ static int vorbis_open(struct input_plugin_data *ip_data)
 	ip_data->private = priv;
 
 	vi = ov_info(&priv->vf, -1);
+#ifdef CONFIG_TREMOR
 	ip_data->sf = sf_rate(vi->rate) | sf_channels(vi->channels) | sf_bits(16) | sf_signed(1);
 	ip_data->sf |= sf_host_endian();
+#else
+	/* libvorbis decodes to float */
+	ip_data->sf = sf_rate(vi->rate) | sf_channels(vi->channels) | sf_host_float();
+#endif
 	channel_map_init_vorbis(vi->channels, ip_data->channel_map);
 	return 0;
 }
@@ -193,14 +199,27 @@ static int vorbis_close(struct input_plugin_data *ip_data)
 	return 0;
 }
 
-static inline int vorbis_endian(void)
+#ifndef CONFIG_TREMOR
+/*
+ * ov_read_float() returns planar samples, interleave them to @buffer.
+ * Returns bytes or same errors as ov_read().
+ */
+static int vorbis_read_float(struct input_plugin_data *ip_data, char *buffer,
+		int count, int *current_section)
 {
-#ifdef WORDS_BIGENDIAN
-	return 1;
-#else
-	return 0;
-#endif
+	struct vorbis_private *priv = ip_data->private;
+	float **pcm;
+	long rc;
+
+	rc = ov_read_float(&priv->vf, &pcm, count / sf_get_frame_size(ip_data->sf),
+			current_section);
+	if (rc <= 0)
+		return rc;
+	pcm_interleave_32(buffer, (const void * const *)pcm,
+			sf_get_channels(ip_data->sf), rc);
+	return rc * sf_get_frame_size(ip_data->sf);
 }
+#endif
 
 /*
  * OV_HOLE
@@ -228,7 +247,7 @@ static int vorbis_read(struct input_plugin_data *ip_data, char *buffer, int coun
 	/* Tremor can only handle signed 16 bit data */
 	rc = ov_read(&priv->vf, buffer, count, &current_section);
 #else
-	rc = ov_read(&priv->vf, buffer, count, vorbis_endian(), 2, 1, &current_section);
+	rc = vorbis_read_float(ip_data, buffer, count, &current_section);
 #endif
 
 	if (ip_data->remote && current_section != priv->current_section) {
@@ -29,9 +29,11 @@
 #include <errno.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define WAVE_FORMAT_PCM        0x0001U
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003U
 #define WAVE_FORMAT_EXTENSIBLE 0xfffeU
 
 #define WAVE_WRONG_HEADER 1
@@ -179,17 +181,30 @@ static int wav_open(struct input_plugin_data *ip_data)
 		}
 		free(fmt);
 
-		if (format_tag != WAVE_FORMAT_PCM) {
-			d_print("unsupported format tag %u, should be 1\n", format_tag);
-			rc = -IP_ERROR_UNSUPPORTED_FILE_TYPE;
-			goto error_exit;
-		}
-		if ((bits != 8 && bits != 16 && bits != 24 && bits != 32) || channels < 1) {
+		if (format_tag == WAVE_FORMAT_IEEE_FLOAT) {
+#ifdef WORDS_BIGENDIAN
+			/* float samples are passed on in host byte order */
 			rc = -IP_ERROR_SAMPLE_FORMAT;
 			goto error_exit;
+#endif
+			if (bits != 32 || channels < 1) {
+				rc = -IP_ERROR_SAMPLE_FORMAT;
+				goto error_exit;
+			}
+			ip_data->sf = sf_channels(channels) | sf_rate(rate) |
+				sf_host_float();
+		} else if (format_tag == WAVE_FORMAT_PCM) {
+			if ((bits != 8 && bits != 16 && bits != 24 && bits != 32) || channels < 1) {
+				rc = -IP_ERROR_SAMPLE_FORMAT;
+				goto error_exit;
+			}
+			ip_data->sf = sf_channels(channels) | sf_rate(rate) | sf_bits(bits) |
+				sf_signed(bits > 8);
+		} else {
+			d_print("unsupported format tag %u\n", format_tag);
+			rc = -IP_ERROR_UNSUPPORTED_FILE_TYPE;
+			goto error_exit;
 		}
-		ip_data->sf = sf_channels(channels) | sf_rate(rate) | sf_bits(bits) |
-			sf_signed(bits > 8);
 		channel_map_init_waveex(channels, channel_mask, ip_data->channel_map);
 	}
 
@@ -205,6 +220,7 @@ static int wav_open(struct input_plugin_data *ip_data)
 	priv->sec_size = sf_get_second_size(ip_data->sf);
 	priv->frame_size = sf_get_frame_size(ip_data->sf);
 	priv->pos = 0;
+	ip_data->read_offset = priv->pcm_start;
 
 	d_print("pcm start: %u\n", (unsigned int)priv->pcm_start);
 	d_print("pcm size: %u\n", priv->pcm_size);
@@ -245,16 +261,22 @@ static int wav_read(struct input_plugin_data *ip_data, char *buffer, int _count)
 	}
 	if (count > priv->pcm_size - priv->pos)
 		count = priv->pcm_size - priv->pos;
-	rc = read(ip_data->fd, buffer, count);
+	count -= count % priv->frame_size;
+
+	/* positioned read, seeking only moves priv->pos */
+	rc = pread(ip_data->fd, buffer, count, priv->pcm_start + priv->pos);
 	if (rc == -1) {
 		d_print("read error\n");
 		return -IP_ERROR_ERRNO;
 	}
+	/* a truncated file may end in the middle of a frame */
+	rc -= rc % priv->frame_size;
 	if (rc == 0) {
 		d_print("eof\n");
 		return 0;
 	}
 	priv->pos += rc;
+	ip_data->read_offset = priv->pcm_start + priv->pos;
 	return rc;
 }
 
@@ -266,9 +288,10 @@ static int wav_seek(struct input_plugin_data *ip_data, double _offset)
 	offset = (unsigned int)(_offset * (double)priv->sec_size + 0.5);
 	/* align to frame size */
 	offset -= offset % priv->frame_size;
+	if (offset > priv->pcm_size)
+		offset = priv->pcm_size;
 	priv->pos = offset;
-	if (lseek(ip_data->fd, priv->pcm_start + offset, SEEK_SET) == -1)
-		return -1;
+	ip_data->read_offset = priv->pcm_start + offset;
 	return 0;
 }
 
@@ -384,8 +407,13 @@ static long wav_bitrate(struct input_plugin_data *ip_data)
 static char *wav_codec(struct input_plugin_data *ip_data)
 {
 	char buf[16];
-	snprintf(buf, 16, "pcm_%c%u%s",
-			sf_get_signed(ip_data->sf) ? 's' : 'u',
+	char type = 'u';
+
+	if (sf_get_float(ip_data->sf))
+		type = 'f';
+	else if (sf_get_signed(ip_data->sf))
+		type = 's';
+	snprintf(buf, 16, "pcm_%c%u%s", type,
 			sf_get_bits(ip_data->sf),
 			sf_get_bigendian(ip_data->sf) ? "be" : "le");
 
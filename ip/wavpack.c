@@ -38,6 +38,8 @@
 #define WV_CHANNEL_MAX 2
 
 struct wavpack_file {
+	/* set for the main stream, which may be remote */
+	struct input_plugin_data *ip_data;
 	int fd;
 	off_t len;
 	int push_back_byte;
@@ -67,7 +69,10 @@ static int32_t read_bytes(void *data, void *ptr, int32_t count)
 		n++;
 	}
 
-	rc = read(file->fd, ptr, count);
+	if (file->ip_data)
+		rc = read_wrapper(file->ip_data, ptr, count);
+	else
+		rc = read(file->fd, ptr, count);
 	if (rc == -1) {
 		d_print("error: %s\n", strerror(errno));
 		return 0;
@@ -167,6 +172,7 @@ static int wavpack_open(struct input_plugin_data *ip_data)
 
 	const struct wavpack_private priv_init = {
 		.wv_file = {
+			.ip_data = ip_data,
 			.fd = ip_data->fd,
 			.push_back_byte = EOF
 		}
@@ -623,15 +623,11 @@ struct track_info *lib_set_track(struct tree_track *track)
 	return ti;
 }
 
-struct track_info *lib_goto_next(void)
+/* track after lib_cur_track, library must not be empty */
+static struct tree_track *lib_get_next(void)
 {
 	struct tree_track *track;
 
-	if (rb_root_empty(&lib_artist_root))
-	{
-		BUG_ON(lib_cur_track != NULL);
-		return NULL;
-	}
 	if (shuffle == SHUFFLE_TRACKS)
 	{
 		track = (struct tree_track *)shuffle_list_get_next(&lib_shuffle_root,
@@ -660,7 +656,50 @@ struct track_info *lib_goto_next(void)
 	{
 		track = normal_get_next(aaa_mode, true, false);
 	}
-	return lib_set_track(track);
+	return track;
+}
+
+struct track_info *lib_goto_next(void)
+{
+	if (rb_root_empty(&lib_artist_root))
+	{
+		BUG_ON(lib_cur_track != NULL);
+		return NULL;
+	}
+	return lib_set_track(lib_get_next());
+}
+
+int lib_peek_next(struct track_info **tis, int max)
+{
+	struct tree_track *saved = lib_cur_track, *first = NULL;
+	int saved_auto_reshuffle = auto_reshuffle;
+	int saved_repeat = repeat;
+	int n = 0;
+
+	if (rb_root_empty(&lib_artist_root))
+		return 0;
+
+	/* the order after a reshuffle can't be known yet, stop at the wrap */
+	if (shuffle && auto_reshuffle)
+		repeat = 0;
+	auto_reshuffle = 0;
+	while (n < max)
+	{
+		struct tree_track *track = lib_get_next();
+
+		if (track == NULL || track == saved || track == first)
+			break;
+		if (first == NULL)
+			first = track;
+		tis[n] = tree_track_info(track);
+		track_info_ref(tis[n]);
+		n++;
+		lib_cur_track = track;
+	}
+	lib_cur_track = saved;
+	auto_reshuffle = saved_auto_reshuffle;
+	repeat = saved_repeat;
+	return n;
 }
 
 struct track_info *lib_goto_prev(void)
@@ -118,6 +118,11 @@ struct track_info *lib_goto_next(void);
 struct track_info *lib_goto_prev(void);
 struct track_info *lib_goto_next_album(void);
 struct track_info *lib_goto_prev_album(void);
+/*
+ * fills @tis with up to @max referenced tracks lib_goto_next() would
+ * return, without changing the current track
+ */
+int lib_peek_next(struct track_info **tis, int max);
 void lib_add_track(struct track_info *track_info, void *opaque);
 void lib_set_filter(struct expr *expr);
 void lib_set_live_filter(const char *str);
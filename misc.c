@@ -34,6 +34,9 @@
 #include <dirent.h>
 #include <stdarg.h>
 #include <pwd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 const char *cmus_config_dir = NULL;
 const char *cmus_playlist_dir = NULL;
@@ -417,3 +420,13 @@ void shuffle_array(void *array, size_t n, size_t size)
 		memcpy(arr + i * size, tmp, size);
 	}
 }
+
+int set_idle_io_priority(void)
+{
+#if defined(__linux__) && defined(SYS_ioprio_set)
+	/* IOPRIO_WHO_PROCESS, calling thread, IOPRIO_CLASS_IDLE */
+	return syscall(SYS_ioprio_set, 1, 0, 3 << 13) ? -1 : 0;
+#else
+	return 0;
+#endif
+}
@@ -51,4 +51,10 @@ int replaygain_decode(unsigned int field, int *gain);
 char *expand_filename(const char *name);
 void shuffle_array(void *array, size_t n, size_t size);
 
+/*
+ * Lowest I/O priority for the calling thread where the OS has one.
+ * Returns -1 and sets errno on failure.
+ */
+int set_idle_io_priority(void);
+
 #endif
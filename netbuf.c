@@ -0,0 +1,384 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "netbuf.h"
+#include "locking.h"
+#include "xmalloc.h"
+#include "utils.h"
+#include "debug.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the connection is considered dropped after this long without data */
+#define READ_TIMEOUT_MS		5000
+/* poll() interval, also how long netbuf_free() may wait for the thread */
+#define POLL_MS			200
+/*
+ * netbuf_read() runs under the producer lock and returns EAGAIN after
+ * this long, the first read waits up to READ_TIMEOUT_MS because decoders
+ * can't retry while parsing the headers in open
+ */
+#define READ_WAIT_MS		200
+/* reconnect attempts after 0.5, 1, 2, 4 and 8 s */
+#define RECONNECT_TRIES		5
+
+/* metadata blocks received but not reached by the reader yet */
+#define MAX_META 4
+
+struct netbuf_meta {
+	/* audio byte offset where the metadata applies */
+	long long pos;
+	char *text;
+};
+
+struct netbuf {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	/* data was added, space was freed or state changed */
+	pthread_cond_t cond;
+
+	char *data;
+	size_t size;
+	size_t rpos;
+	size_t len;
+
+	/* audio bytes put into and taken out of the buffer */
+	long long write_pos;
+	long long read_pos;
+
+	struct netbuf_meta meta[MAX_META];
+	int nr_meta;
+
+	unsigned int eof : 1;
+	unsigned int stop : 1;
+
+	/* only used by the thread */
+	int fd;
+	int metaint;
+	int counter;
+	/* audio bytes received, metadata excluded */
+	long long received;
+	long long content_length;
+	char *uri;
+	netbuf_connect_func connect;
+};
+
+#define nb_lock(nb) cmus_mutex_lock(&(nb)->mutex)
+#define nb_unlock(nb) cmus_mutex_unlock(&(nb)->mutex)
+
+static int stopped(struct netbuf *nb)
+{
+	int rc;
+
+	nb_lock(nb);
+	rc = nb->stop;
+	nb_unlock(nb);
+	return rc;
+}
+
+/*
+ * Reads at most @count bytes from the socket.  Returns 0 if the
+ * connection dropped or timed out and -1 if stopped.
+ */
+static ssize_t read_socket(struct netbuf *nb, void *buf, size_t count)
+{
+	int waited = 0;
+
+	while (1) {
+		struct pollfd pfd = { .fd = nb->fd, .events = POLLIN };
+		ssize_t rc;
+
+		if (stopped(nb))
+			return -1;
+		rc = poll(&pfd, 1, POLL_MS);
+		if (rc == -1 && errno != EINTR)
+			return 0;
+		if (rc <= 0) {
+			waited += POLL_MS;
+			if (waited >= READ_TIMEOUT_MS) {
+				d_print("no data for %d ms\n", waited);
+				return 0;
+			}
+			continue;
+		}
+		rc = read(nb->fd, buf, count);
+		if (rc == -1 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (rc <= 0)
+			return 0;
+		return rc;
+	}
+}
+
+static ssize_t read_socket_all(struct netbuf *nb, void *buf, size_t count)
+{
+	size_t pos = 0;
+
+	while (pos < count) {
+		ssize_t rc = read_socket(nb, (char *)buf + pos, count - pos);
+
+		if (rc <= 0)
+			return rc;
+		pos += rc;
+	}
+	return pos;
+}
+
+static void add_meta(struct netbuf *nb, const char *text)
+{
+	struct netbuf_meta *m;
+
+	nb_lock(nb);
+	if (nb->nr_meta == MAX_META) {
+		/* drop the oldest, the newest are still to come */
+		free(nb->meta[0].text);
+		memmove(&nb->meta[0], &nb->meta[1], --nb->nr_meta * sizeof(nb->meta[0]));
+	}
+	m = &nb->meta[nb->nr_meta++];
+	m->pos = nb->write_pos;
+	m->text = xstrdup(text);
+	nb_unlock(nb);
+}
+
+/*
+ * Reads one metadata block at a metaint boundary.  Returns 1 on success,
+ * otherwise like read_socket().
+ */
+static int read_meta(struct netbuf *nb)
+{
+	char text[255 * 16 + 1];
+	unsigned char byte;
+	ssize_t rc;
+
+	rc = read_socket_all(nb, &byte, 1);
+	if (rc <= 0)
+		return rc;
+	if (byte) {
+		int len = byte * 16;
+
+		rc = read_socket_all(nb, text, len);
+		if (rc <= 0)
+			return rc;
+		text[len] = 0;
+		add_meta(nb, text);
+	}
+	nb->counter = 0;
+	return 1;
+}
+
+static int reconnect(struct netbuf *nb)
+{
+	int i, delay = 500;
+
+	close(nb->fd);
+	nb->fd = -1;
+	for (i = 0; i < RECONNECT_TRIES; i++) {
+		long long offset = nb->content_length < 0 ? 0 : nb->received;
+		int t, metaint = 0;
+
+		for (t = 0; t < delay; t += POLL_MS) {
+			if (stopped(nb))
+				return -1;
+			ms_sleep(POLL_MS);
+		}
+		delay *= 2;
+
+		d_print("reconnecting to %s at %lld\n", nb->uri, offset);
+		nb->fd = nb->connect(nb->uri, offset, &metaint);
+		if (nb->fd >= 0) {
+			nb->metaint = metaint;
+			nb->counter = 0;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void *netbuf_loop(void *arg)
+{
+	struct netbuf *nb = arg;
+
+	nb_lock(nb);
+	while (!nb->stop) {
+		size_t wpos, count;
+		ssize_t rc;
+
+		if (nb->len == nb->size) {
+			pthread_cond_wait(&nb->cond, &nb->mutex);
+			continue;
+		}
+
+		/* the reader only ever frees space, so the range stays ours */
+		wpos = (nb->rpos + nb->len) % nb->size;
+		count = nb->rpos + nb->len < nb->size ? nb->size - wpos : nb->rpos - wpos;
+		nb_unlock(nb);
+
+		rc = 1;
+		if (nb->metaint) {
+			if (nb->counter == nb->metaint)
+				rc = read_meta(nb);
+			if (count > nb->metaint - nb->counter)
+				count = nb->metaint - nb->counter;
+		}
+		if (rc > 0)
+			rc = read_socket(nb, nb->data + wpos, count);
+
+		if (rc == 0) {
+			if (nb->content_length >= 0 && nb->received >= nb->content_length)
+				rc = -1;
+			else
+				rc = reconnect(nb);
+			nb_lock(nb);
+			if (rc)
+				nb->eof = 1;
+			pthread_cond_broadcast(&nb->cond);
+			if (rc)
+				break;
+			continue;
+		}
+		if (rc < 0) {
+			nb_lock(nb);
+			break;
+		}
+
+		nb->counter += rc;
+		nb->received += rc;
+		nb_lock(nb);
+		nb->len += rc;
+		nb->write_pos += rc;
+		pthread_cond_broadcast(&nb->cond);
+	}
+	nb_unlock(nb);
+	return NULL;
+}
+
+struct netbuf *netbuf_new(int fd, int metaint, long long content_length,
+		size_t size, const char *uri, netbuf_connect_func connect)
+{
+	struct netbuf *nb = xnew0(struct netbuf, 1);
+	int rc;
+
+	pthread_mutex_init(&nb->mutex, NULL);
+	pthread_cond_init(&nb->cond, NULL);
+	nb->data = xnew(char, size);
+	nb->size = size;
+	nb->fd = fd;
+	nb->metaint = metaint;
+	nb->content_length = content_length;
+	nb->uri = xstrdup(uri);
+	nb->connect = connect;
+
+	d_print("%zu bytes, metaint %d\n", size, metaint);
+	rc = pthread_create(&nb->thread, NULL, netbuf_loop, nb);
+	BUG_ON(rc);
+	return nb;
+}
+
+void netbuf_free(struct netbuf *nb)
+{
+	int i;
+
+	nb_lock(nb);
+	nb->stop = 1;
+	pthread_cond_broadcast(&nb->cond);
+	nb_unlock(nb);
+	pthread_join(nb->thread, NULL);
+
+	if (nb->fd != -1)
+		close(nb->fd);
+	for (i = 0; i < nb->nr_meta; i++)
+		free(nb->meta[i].text);
+	free(nb->uri);
+	free(nb->data);
+	pthread_cond_destroy(&nb->cond);
+	pthread_mutex_destroy(&nb->mutex);
+	free(nb);
+}
+
+/* called with the lock held, returns 1 if there is data or EOF */
+static int wait_data(struct netbuf *nb, int ms)
+{
+	struct timespec ts;
+	int rc = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (long)ms * 1000000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+	while (nb->len == 0 && !nb->eof && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&nb->cond, &nb->mutex, &ts);
+	return nb->len > 0 || nb->eof;
+}
+
+int netbuf_wait(struct netbuf *nb, int ms)
+{
+	int rc;
+
+	nb_lock(nb);
+	rc = wait_data(nb, ms);
+	nb_unlock(nb);
+	return rc;
+}
+
+/* called with the lock held */
+static void apply_meta(struct netbuf *nb, struct input_plugin_data *ip_data)
+{
+	while (nb->nr_meta && nb->meta[0].pos <= nb->read_pos) {
+		struct netbuf_meta *m = &nb->meta[0];
+
+		strscpy(ip_data->metadata, m->text, 255 * 16 + 1);
+		ip_data->metadata_changed = 1;
+		free(m->text);
+		memmove(m, m + 1, --nb->nr_meta * sizeof(*m));
+	}
+}
+
+ssize_t netbuf_read(struct netbuf *nb, struct input_plugin_data *ip_data,
+		void *buffer, size_t count)
+{
+	size_t n;
+
+	nb_lock(nb);
+	if (!wait_data(nb, nb->read_pos ? READ_WAIT_MS : READ_TIMEOUT_MS)) {
+		nb_unlock(nb);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	apply_meta(nb, ip_data);
+	n = nb->len;
+	if (n > nb->size - nb->rpos)
+		n = nb->size - nb->rpos;
+	if (n > count)
+		n = count;
+	/* stop at the next metadata so it is applied at the right time */
+	if (nb->nr_meta && nb->meta[0].pos - nb->read_pos < n)
+		n = nb->meta[0].pos - nb->read_pos;
+
+	memcpy(buffer, nb->data + nb->rpos, n);
+	nb->rpos = (nb->rpos + n) % nb->size;
+	nb->len -= n;
+	nb->read_pos += n;
+	pthread_cond_broadcast(&nb->cond);
+	nb_unlock(nb);
+	return n;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_NETBUF_H
+#define CMUS_NETBUF_H
+
+#include "ip.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Jitter buffer for HTTP streams.  A thread reads the socket into a ring
+ * buffer, strips shoutcast metadata and reconnects when the connection
+ * drops.  Decoders read from the buffer through read_wrapper().
+ */
+
+struct netbuf;
+
+/*
+ * Opens @uri again for the thread, from byte @offset of the body if it is
+ * not 0.  Returns a socket with the response headers read or -1, and sets
+ * @metaint from the new headers.
+ */
+typedef int (*netbuf_connect_func)(const char *uri, long long offset, int *metaint);
+
+/*
+ * @fd: connected socket, owned by the netbuf from now on
+ * @content_length: -1 for live streams
+ */
+struct netbuf *netbuf_new(int fd, int metaint, long long content_length,
+		size_t size, const char *uri, netbuf_connect_func connect);
+void netbuf_free(struct netbuf *nb);
+
+/* waits at most @ms for data, returns 1 if netbuf_read() won't block */
+int netbuf_wait(struct netbuf *nb, int ms);
+
+/*
+ * Waits a bounded time for data, returns -1 with errno EAGAIN if there is
+ * none yet.  Updates metadata of @ip_data when the stream position of a
+ * metadata block is reached.  Returns 0 at EOF.
+ */
+ssize_t netbuf_read(struct netbuf *nb, struct input_plugin_data *ip_data,
+		void *buffer, size_t count);
+
+#endif
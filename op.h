@@ -26,7 +26,7 @@
 #include <fcntl.h>
 #endif
 
-#define OP_ABI_VERSION 3
+#define OP_ABI_VERSION 4
 
 enum {
 	/* no error */
@@ -62,6 +62,38 @@ struct output_plugin_ops {
 	int (*pause)(void);
 	int (*unpause)(void);
 
+	/*
+	 * ABI 4, optional zero-copy output
+	 *
+	 * mmap_begin() returns a pointer to where at most *count bytes can be
+	 * written directly into the device buffer and lowers *count to what
+	 * is contiguous there.  mmap_commit() queues count bytes of that for
+	 * playback and returns the bytes queued.  mmap_begin() returns
+	 * -OP_ERROR_NOT_SUPPORTED if the device isn't in mmap mode; write()
+	 * is used then.
+	 */
+	int (*mmap_begin)(char **buffer, int *count);
+	int (*mmap_commit)(int count);
+
+	/*
+	 * ABI 4, optional
+	 *
+	 * Blocks until buffer_space() would return non-zero, or for at most
+	 * ms milliseconds.  Returns 1 if there is space, 0 on timeout.
+	 *
+	 * Called without the player lock, so close, drop, pause and unpause
+	 * may run meanwhile.  These must end the wait early and wait must
+	 * return 0 without touching the device once it is closed.
+	 */
+	int (*wait)(int ms);
+
+	/*
+	 * ABI 4, optional
+	 *
+	 * Returns bytes written but not audible yet, i.e. still in the
+	 * device buffer or sound server.
+	 */
+	int (*latency)(void);
 };
 
 #define OPT(prefix, name) { #name, prefix ## _set_ ## name, \
@@ -73,10 +105,19 @@ struct output_plugin_opt {
 	int (*get)(char **val);
 };
 
+/*
+ * op_priority of plugins that are only used when chosen with
+ * output_plugin, never by op_select_any()
+ */
+#define OP_PRIORITY_MANUAL 100
+
 /* symbols exported by plugin */
 extern const struct output_plugin_ops op_pcm_ops;
 extern const struct output_plugin_opt op_pcm_options[];
 extern const int op_priority;
 extern const unsigned op_abi_version;
 
+/* optional, non-zero if open() accepts float samples (see sf.h) */
+extern const int op_float_samples;
+
 #endif
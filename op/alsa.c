@@ -52,12 +52,17 @@
 #include "../utils.h"
 #include "../xmalloc.h"
 #include "../sf.h"
+#include "../pcm.h"
 #include "../debug.h"
 
 #define ALSA_PCM_NEW_HW_PARAMS_API
 #define ALSA_PCM_NEW_SW_PARAMS_API
 
 #include <alsa/asoundlib.h>
+#include <stdint.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 static sample_format_t alsa_sf;
 static snd_pcm_t *alsa_handle;
@@ -68,8 +73,31 @@ static snd_pcm_status_t *status;
 /* bytes (bits * channels / 8) */
 static int alsa_frame_size;
 
+/*
+ * op_alsa_wait() polls without the player lock.  close, drop, pause and
+ * unpause bump alsa_wait_gen and write to the wakeup pipe, the waiter only
+ * touches alsa_handle under alsa_wait_mutex while alsa_opened is set.
+ */
+static pthread_mutex_t alsa_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int alsa_wait_gen;
+static int alsa_opened;
+static int alsa_wake_out = -1;
+static int alsa_wake_in = -1;
+
+/* device doesn't take float, write s32 converted to this buffer */
+static int alsa_float_to_s32;
+static int32_t alsa_s32_buf[4096];
+
+/* the device buffer is written directly, see op_alsa_mmap_begin() */
+static int alsa_mmap_active;
+static snd_pcm_uframes_t alsa_mmap_offset;
+static char *alsa_mmap_area;
+/* started once this many frames are queued */
+static snd_pcm_uframes_t alsa_start_frames;
+
 /* configuration */
 static char *alsa_dsp_device = NULL;
+static int alsa_mmap = 0;
 
 #if 0
 #define debug_ret(func, ret) \
@@ -110,11 +138,18 @@ static int op_alsa_init(void)
 		errno = ENOMEM;
 		return -OP_ERROR_ERRNO;
 	}
+
+	init_pipes(&alsa_wake_out, &alsa_wake_in);
+	/* a full pipe already wakes the waiter */
+	fcntl(alsa_wake_in, F_SETFL, fcntl(alsa_wake_in, F_GETFL) | O_NONBLOCK);
 	return OP_ERROR_SUCCESS;
 }
 
 static int op_alsa_exit(void)
 {
+	close(alsa_wake_out);
+	close(alsa_wake_in);
+	alsa_wake_out = alsa_wake_in = -1;
 	snd_pcm_status_free(status);
 	free(alsa_dsp_device);
 	alsa_dsp_device = NULL;
@@ -147,16 +182,37 @@ static int alsa_set_hw_params(void)
 	d_print("can pause = %d\n", alsa_can_pause);
 
 	cmd = "snd_pcm_hw_params_set_access";
-	rc = snd_pcm_hw_params_set_access(alsa_handle, hwparams,
-			SND_PCM_ACCESS_RW_INTERLEAVED);
+	alsa_mmap_active = 0;
+	if (alsa_mmap) {
+		rc = snd_pcm_hw_params_set_access(alsa_handle, hwparams,
+				SND_PCM_ACCESS_MMAP_INTERLEAVED);
+		alsa_mmap_active = rc >= 0;
+		if (!alsa_mmap_active)
+			d_print("mmap not supported: %s\n", snd_strerror(rc));
+	}
+	if (!alsa_mmap_active)
+		rc = snd_pcm_hw_params_set_access(alsa_handle, hwparams,
+				SND_PCM_ACCESS_RW_INTERLEAVED);
 	if (rc < 0)
 		goto error;
 
-	alsa_fmt = snd_pcm_build_linear_format(sf_get_bits(alsa_sf), sf_get_bits(alsa_sf),
-			sf_get_signed(alsa_sf) ? 0 : 1,
-			sf_get_bigendian(alsa_sf));
+	alsa_float_to_s32 = 0;
+	if (sf_get_float(alsa_sf)) {
+		alsa_fmt = SND_PCM_FORMAT_FLOAT;
+	} else {
+		alsa_fmt = snd_pcm_build_linear_format(sf_get_bits(alsa_sf), sf_get_bits(alsa_sf),
+				sf_get_signed(alsa_sf) ? 0 : 1,
+				sf_get_bigendian(alsa_sf));
+	}
 	cmd = "snd_pcm_hw_params_set_format";
 	rc = snd_pcm_hw_params_set_format(alsa_handle, hwparams, alsa_fmt);
+	if (rc < 0 && sf_get_float(alsa_sf)) {
+		/* e.g. hw devices, same frame size so convert while writing */
+		d_print("float not supported, using s32\n");
+		alsa_fmt = SND_PCM_FORMAT_S32;
+		rc = snd_pcm_hw_params_set_format(alsa_handle, hwparams, alsa_fmt);
+		alsa_float_to_s32 = rc >= 0;
+	}
 	if (rc < 0)
 		goto error;
 
@@ -177,6 +233,18 @@ static int alsa_set_hw_params(void)
 	rc = snd_pcm_hw_params(alsa_handle, hwparams);
 	if (rc < 0)
 		goto error;
+
+	if (alsa_mmap_active) {
+		snd_pcm_uframes_t size;
+
+		cmd = "snd_pcm_hw_params_get_buffer_size";
+		rc = snd_pcm_hw_params_get_buffer_size(hwparams, &size);
+		if (rc < 0)
+			goto error;
+		/* the consumer fills the buffer in one go, no need to wait longer */
+		alsa_start_frames = size / 2;
+		d_print("mmap, buffer size=%lu\n", (unsigned long)size);
+	}
 	goto out;
 error:
 	d_print("%s: error: %s\n", cmd, snd_strerror(rc));
@@ -185,6 +253,19 @@ out:
 	return rc;
 }
 
+/* ends a concurrent op_alsa_wait() before alsa_handle changes under it */
+static void alsa_wake_waiter(int opened)
+{
+	char c = 0;
+
+	pthread_mutex_lock(&alsa_wait_mutex);
+	alsa_opened = opened;
+	alsa_wait_gen++;
+	if (write(alsa_wake_in, &c, 1) != 1 && errno != EAGAIN)
+		d_print("write to wakeup pipe failed: %s\n", strerror(errno));
+	pthread_mutex_unlock(&alsa_wait_mutex);
+}
+
 static int op_alsa_open(sample_format_t sf, const channel_position_t *channel_map)
 {
 	int rc;
@@ -203,6 +284,10 @@ static int op_alsa_open(sample_format_t sf, const channel_position_t *channel_ma
 	rc = snd_pcm_prepare(alsa_handle);
 	if (rc < 0)
 		goto close_error;
+
+	pthread_mutex_lock(&alsa_wait_mutex);
+	alsa_opened = 1;
+	pthread_mutex_unlock(&alsa_wait_mutex);
 	return OP_ERROR_SUCCESS;
 close_error:
 	snd_pcm_close(alsa_handle);
@@ -216,6 +301,8 @@ static int op_alsa_close(void)
 {
 	int rc;
 
+	alsa_wake_waiter(0);
+
 	rc = snd_pcm_drain(alsa_handle);
 	debug_ret("snd_pcm_drain", rc);
 
@@ -228,6 +315,8 @@ static int op_alsa_drop(void)
 {
 	int rc;
 
+	alsa_wake_waiter(1);
+
 	rc = snd_pcm_drop(alsa_handle);
 	debug_ret("snd_pcm_drop", rc);
 
@@ -242,12 +331,22 @@ static int op_alsa_drop(void)
 	return alsa_error_to_op_error(rc);
 }
 
+static const char *alsa_convert_float(const char *buffer, int *len)
+{
+	if (*len * alsa_frame_size > sizeof(alsa_s32_buf))
+		*len = sizeof(alsa_s32_buf) / alsa_frame_size;
+	pcm_float_to_s32(alsa_s32_buf, buffer, *len * sf_get_channels(alsa_sf));
+	return (const char *)alsa_s32_buf;
+}
+
 static int op_alsa_write(const char *buffer, int count)
 {
 	int rc, len;
 	int recovered = 0;
 
 	len = count / alsa_frame_size;
+	if (alsa_float_to_s32)
+		buffer = alsa_convert_float(buffer, &len);
 again:
 	rc = snd_pcm_writei(alsa_handle, buffer, len);
 	if (rc < 0) {
@@ -291,9 +390,113 @@ static int op_alsa_buffer_space(void)
 	return f * alsa_frame_size;
 }
 
+static int op_alsa_mmap_begin(char **buffer, int *count)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t frames = *count / alsa_frame_size;
+	int rc;
+
+	if (!alsa_mmap_active)
+		return -OP_ERROR_NOT_SUPPORTED;
+
+	/* must precede snd_pcm_mmap_begin() */
+	rc = op_alsa_buffer_space();
+	if (rc < 0)
+		return rc;
+
+	rc = snd_pcm_mmap_begin(alsa_handle, &areas, &alsa_mmap_offset, &frames);
+	if (rc < 0) {
+		d_print("snd_pcm_mmap_begin failed: %s\n", snd_strerror(rc));
+		return alsa_error_to_op_error(rc);
+	}
+
+	/* interleaved, so all channels share one area */
+	alsa_mmap_area = (char *)areas[0].addr +
+		(areas[0].first + alsa_mmap_offset * areas[0].step) / 8;
+	*buffer = alsa_mmap_area;
+	*count = frames * alsa_frame_size;
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_alsa_mmap_commit(int count)
+{
+	snd_pcm_sframes_t rc;
+	int frames = count / alsa_frame_size;
+
+	if (alsa_float_to_s32)
+		pcm_float_to_s32(alsa_mmap_area, alsa_mmap_area,
+				frames * sf_get_channels(alsa_sf));
+
+	rc = snd_pcm_mmap_commit(alsa_handle, alsa_mmap_offset, frames);
+	if (rc < 0) {
+		d_print("snd_pcm_mmap_commit failed: %s, trying to recover\n",
+				snd_strerror(rc));
+		return alsa_error_to_op_error(snd_pcm_recover(alsa_handle, rc, 1));
+	}
+
+	/* unlike snd_pcm_writei(), committing never starts the stream */
+	if (snd_pcm_state(alsa_handle) == SND_PCM_STATE_PREPARED) {
+		snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa_handle);
+
+		if (avail >= 0 && avail <= alsa_start_frames &&
+				snd_pcm_start(alsa_handle) < 0)
+			d_print("snd_pcm_start failed\n");
+	}
+	return rc * alsa_frame_size;
+}
+
+static int op_alsa_wait(int ms)
+{
+	struct pollfd fds[16];
+	unsigned short revents = 0;
+	unsigned int gen;
+	char buf[64];
+	int n, rc;
+
+	pthread_mutex_lock(&alsa_wait_mutex);
+	while (read(alsa_wake_out, buf, sizeof(buf)) > 0)
+		;
+	gen = alsa_wait_gen;
+	n = alsa_opened ? snd_pcm_poll_descriptors(alsa_handle, fds, N_ELEMENTS(fds) - 1) : 0;
+	pthread_mutex_unlock(&alsa_wait_mutex);
+	if (n <= 0)
+		return 0;
+
+	fds[n].fd = alsa_wake_out;
+	fds[n].events = POLLIN;
+	fds[n].revents = 0;
+	rc = poll(fds, n + 1, ms);
+	if (rc <= 0)
+		return 0;
+
+	/* the device may have been closed or dropped meanwhile */
+	pthread_mutex_lock(&alsa_wait_mutex);
+	if (alsa_opened && gen == alsa_wait_gen) {
+		rc = snd_pcm_poll_descriptors_revents(alsa_handle, fds, n, &revents);
+		if (rc < 0)
+			debug_ret("snd_pcm_poll_descriptors_revents", rc);
+	}
+	pthread_mutex_unlock(&alsa_wait_mutex);
+
+	/* errors like underruns are recovered in op_alsa_buffer_space() */
+	return (revents & POLLOUT) && !(revents & POLLERR);
+}
+
+static int op_alsa_latency(void)
+{
+	snd_pcm_sframes_t delay;
+
+	if (snd_pcm_delay(alsa_handle, &delay) < 0 || delay < 0)
+		return 0;
+	return delay * alsa_frame_size;
+}
+
 static int op_alsa_pause(void)
 {
 	int rc = 0;
+
+	alsa_wake_waiter(1);
+
 	if (alsa_can_pause) {
 		snd_pcm_state_t state = snd_pcm_state(alsa_handle);
 		if (state == SND_PCM_STATE_PREPARED) {
@@ -321,6 +524,9 @@ static int op_alsa_pause(void)
 static int op_alsa_unpause(void)
 {
 	int rc = 0;
+
+	alsa_wake_waiter(1);
+
 	if (alsa_can_pause) {
 		snd_pcm_state_t state = snd_pcm_state(alsa_handle);
 		if (state == SND_PCM_STATE_PREPARED) {
@@ -359,6 +565,18 @@ static int op_alsa_get_device(char **val)
 	return OP_ERROR_SUCCESS;
 }
 
+static int op_alsa_set_mmap(const char *val)
+{
+	alsa_mmap = is_freeform_true(val);
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_alsa_get_mmap(char **val)
+{
+	*val = xstrdup(alsa_mmap ? "1" : "0");
+	return OP_ERROR_SUCCESS;
+}
+
 const struct output_plugin_ops op_pcm_ops = {
 	.init = op_alsa_init,
 	.exit = op_alsa_exit,
@@ -369,12 +587,18 @@ const struct output_plugin_ops op_pcm_ops = {
 	.buffer_space = op_alsa_buffer_space,
 	.pause = op_alsa_pause,
 	.unpause = op_alsa_unpause,
+	.mmap_begin = op_alsa_mmap_begin,
+	.mmap_commit = op_alsa_mmap_commit,
+	.wait = op_alsa_wait,
+	.latency = op_alsa_latency,
 };
 
 const struct output_plugin_opt op_pcm_options[] = {
 	OPT(op_alsa, device),
+	OPT(op_alsa, mmap),
 	{ NULL },
 };
 
 const int op_priority = 0;
 const unsigned op_abi_version = OP_ABI_VERSION;
+const int op_float_samples = 1;
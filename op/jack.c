@@ -105,6 +105,15 @@ static jack_default_audio_sample_t read_sample_le32(const char *buffer)
 	return (jack_default_audio_sample_t)s / (jack_default_audio_sample_t)upper_bound;
 }
 
+/* host endian float, passed through unchanged */
+static jack_default_audio_sample_t read_sample_float(const char *buffer)
+{
+	float f;
+
+	memcpy(&f, buffer, sizeof(f));
+	return f;
+}
+
 static jack_default_audio_sample_t read_sample_le16u(const char *buffer)
 {
 	uint32_t u = read_le16(buffer);
@@ -420,6 +429,9 @@ static int op_jack_open(sample_format_t sf, const channel_position_t *cm)
 	} else if (bits == 24) {
 		sample_bytes = 3;
 		read_sample = sf_get_signed(sf) ? &read_sample_le24 : &read_sample_le24u;
+	} else if (bits == 32 && sf_get_float(sf)) {
+		sample_bytes = 4;
+		read_sample = &read_sample_float;
 	} else if (bits == 32) {
 		sample_bytes = 4;
 		read_sample = sf_get_signed(sf) ? &read_sample_le32 : &read_sample_le32u;
@@ -559,6 +571,27 @@ static int op_jack_buffer_space(void)
 #endif
 }
 
+static int op_jack_latency(void)
+{
+	jack_latency_range_t range;
+	size_t frames;
+
+	if (fail)
+		return 0;
+
+	/* queued for the process callback plus the port's own latency */
+	frames = jack_ringbuffer_read_space(ringbuffer[0]) /
+		sizeof(jack_default_audio_sample_t);
+	jack_port_get_latency_range(output_ports[0], JackPlaybackLatency, &range);
+	frames += range.max;
+
+#ifdef HAVE_SAMPLERATE
+	return (int) ((float) (frames) / resample_ratio) * sf_get_frame_size(sample_format);
+#else
+	return frames * sf_get_frame_size(sample_format);
+#endif
+}
+
 static int op_jack_pause(void)
 {
 	paused = true;
@@ -635,6 +668,7 @@ const struct output_plugin_ops op_pcm_ops = {
 	.buffer_space = op_jack_buffer_space,
 	.pause        = op_jack_pause,
 	.unpause      = op_jack_unpause,
+	.latency      = op_jack_latency,
 };
 
 const struct output_plugin_opt op_pcm_options[] = {
@@ -647,3 +681,4 @@ const struct output_plugin_opt op_pcm_options[] = {
 
 const int op_priority = 2;
 const unsigned op_abi_version = OP_ABI_VERSION;
+const int op_float_samples = 1;
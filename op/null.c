@@ -0,0 +1,482 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Output without a sound card, for benchmarking and testing the player.
+ * Samples are discarded at the rate a device would play them ("realtime"),
+ * discarded as fast as the player delivers them ("fast") or written to a
+ * raw or WAV file or FIFO ("file").
+ */
+
+#include "../op.h"
+#include "../sf.h"
+#include "../utils.h"
+#include "../xmalloc.h"
+#include "../debug.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+enum null_mode {
+	NULL_REALTIME,
+	NULL_FAST,
+	NULL_FILE
+};
+
+static const char * const null_mode_names[] = {
+	"realtime", "fast", "file", NULL
+};
+
+/* how much a device would buffer in realtime mode */
+#define NULL_BUFFER_MS 100
+/* buffer space reported in the other modes */
+#define NULL_FAST_SPACE (64 * 1024)
+
+#define WAV_HEADER_SIZE 44
+
+static sample_format_t null_sf;
+static int null_frame_size;
+static int null_second_size;
+
+static int null_fd = -1;
+static int null_wav;
+/* data bytes written to the current file */
+static uint64_t null_file_bytes;
+
+/* realtime mode: bytes written since null_clock_start */
+static uint64_t null_clock_start;
+static uint64_t null_clock_bytes;
+static uint64_t null_paused_bytes;
+
+/*
+ * op_null_wait() runs without the player lock.  The clock is guarded by
+ * null_mutex and every op that changes it bumps null_gen to end the wait.
+ */
+static pthread_mutex_t null_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t null_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int null_gen;
+static int null_opened;
+
+/* totals since dsp.null.stats was last set */
+static uint64_t stats_bytes;
+static double stats_audio;
+static uint64_t stats_first_write;
+static uint64_t stats_last_write;
+
+/* configuration */
+static enum null_mode null_mode = NULL_REALTIME;
+static char *null_file;
+
+static void null_lock(void)
+{
+	pthread_mutex_lock(&null_mutex);
+}
+
+static void null_unlock(void)
+{
+	pthread_mutex_unlock(&null_mutex);
+}
+
+static void null_wake(void)
+{
+	null_gen++;
+	pthread_cond_broadcast(&null_cond);
+}
+
+static void null_clock_reset(uint64_t queued)
+{
+	null_clock_start = us_now();
+	null_clock_bytes = queued;
+}
+
+/* bytes written but not "played" yet in realtime mode */
+static uint64_t null_queued(void)
+{
+	uint64_t played;
+
+	if (null_mode != NULL_REALTIME)
+		return 0;
+	played = (us_now() - null_clock_start) * null_second_size / 1000000;
+	return played < null_clock_bytes ? null_clock_bytes - played : 0;
+}
+
+static void put_le16(char *buf, uint16_t val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+}
+
+static void put_le32(char *buf, uint32_t val)
+{
+	put_le16(buf, val);
+	put_le16(buf + 2, val >> 16);
+}
+
+static void null_wav_header(char *buf, uint64_t data_size)
+{
+	uint32_t size = data_size > UINT32_MAX - 36 ? UINT32_MAX - 36 : data_size;
+
+	memcpy(buf, "RIFF", 4);
+	put_le32(buf + 4, size + 36);
+	memcpy(buf + 8, "WAVEfmt ", 8);
+	put_le32(buf + 16, 16);
+	/* WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT */
+	put_le16(buf + 20, sf_get_float(null_sf) ? 3 : 1);
+	put_le16(buf + 22, sf_get_channels(null_sf));
+	put_le32(buf + 24, sf_get_rate(null_sf));
+	put_le32(buf + 28, null_second_size);
+	put_le16(buf + 32, null_frame_size);
+	put_le16(buf + 34, sf_get_bits(null_sf));
+	memcpy(buf + 36, "data", 4);
+	put_le32(buf + 40, size);
+}
+
+static int null_write_all(const char *buf, int count)
+{
+	int done = 0;
+
+	while (done < count) {
+		ssize_t rc = write(null_fd, buf + done, count - done);
+
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			return -OP_ERROR_ERRNO;
+		}
+		done += rc;
+	}
+	return done;
+}
+
+static int null_open_file(void)
+{
+	const char *ext;
+
+	if (null_file == NULL || null_file[0] == 0) {
+		d_print("dsp.null.file not set\n");
+		errno = EINVAL;
+		return -OP_ERROR_ERRNO;
+	}
+
+	ext = strrchr(null_file, '.');
+	null_wav = ext && strcasecmp(ext, ".wav") == 0;
+	if (null_wav) {
+		/* WAV is little-endian, 16 bits and more are signed */
+		if (sf_get_bigendian(null_sf) ||
+				(sf_get_bits(null_sf) > 8 && !sf_get_signed(null_sf)) ||
+				(sf_get_bits(null_sf) == 8 && sf_get_signed(null_sf)))
+			return -OP_ERROR_SAMPLE_FORMAT;
+	}
+
+	/* a FIFO blocks here until there is a reader */
+	null_fd = open(null_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (null_fd == -1)
+		return -OP_ERROR_ERRNO;
+	null_file_bytes = 0;
+
+	if (null_wav) {
+		char header[WAV_HEADER_SIZE];
+		int rc;
+
+		/* fixed up on close if the file is seekable */
+		null_wav_header(header, UINT32_MAX);
+		rc = null_write_all(header, sizeof(header));
+		if (rc < 0) {
+			close(null_fd);
+			null_fd = -1;
+			return rc;
+		}
+	}
+	return OP_ERROR_SUCCESS;
+}
+
+static void null_close_file(void)
+{
+	if (null_wav && lseek(null_fd, 0, SEEK_SET) == 0) {
+		char header[WAV_HEADER_SIZE];
+
+		null_wav_header(header, null_file_bytes);
+		null_write_all(header, sizeof(header));
+	}
+	close(null_fd);
+	null_fd = -1;
+}
+
+static void null_print_stats(void)
+{
+	d_print("%llu bytes, %.3f s of audio in %.3f s\n",
+			(unsigned long long)stats_bytes, stats_audio,
+			(stats_last_write - stats_first_write) / 1e6);
+}
+
+static int op_null_init(void)
+{
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_exit(void)
+{
+	free(null_file);
+	null_file = NULL;
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_open(sample_format_t sf, const channel_position_t *channel_map)
+{
+	null_lock();
+	null_sf = sf;
+	null_frame_size = sf_get_frame_size(sf);
+	null_second_size = sf_get_second_size(sf);
+	null_clock_reset(0);
+	null_unlock();
+
+	if (null_mode == NULL_FILE) {
+		int rc = null_open_file();
+
+		if (rc)
+			return rc;
+	}
+
+	null_lock();
+	null_opened = 1;
+	null_wake();
+	null_unlock();
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_close(void)
+{
+	null_lock();
+	null_opened = 0;
+	null_wake();
+	null_unlock();
+
+	if (null_fd != -1)
+		null_close_file();
+	null_print_stats();
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_drop(void)
+{
+	null_lock();
+	null_clock_reset(0);
+	null_wake();
+	null_unlock();
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_write(const char *buffer, int count)
+{
+	uint64_t now;
+
+	count -= count % null_frame_size;
+
+	if (null_fd != -1) {
+		count = null_write_all(buffer, count);
+		if (count < 0)
+			return count;
+		null_file_bytes += count;
+	} else if (null_mode == NULL_REALTIME) {
+		null_lock();
+		/* an underrun, the device would restart from here */
+		if (null_queued() == 0)
+			null_clock_reset(0);
+		null_clock_bytes += count;
+		null_unlock();
+	}
+
+	now = us_now();
+	if (stats_bytes == 0)
+		stats_first_write = now;
+	stats_last_write = now;
+	stats_bytes += count;
+	stats_audio += (double)count / null_second_size;
+	return count;
+}
+
+/* null_mutex held */
+static int null_space(void)
+{
+	int space;
+
+	if (null_mode != NULL_REALTIME)
+		return NULL_FAST_SPACE;
+
+	space = NULL_BUFFER_MS * null_second_size / 1000 - null_queued();
+	if (space < 0)
+		space = 0;
+	return space - space % null_frame_size;
+}
+
+static int op_null_buffer_space(void)
+{
+	int space;
+
+	null_lock();
+	space = null_space();
+	null_unlock();
+	return space;
+}
+
+static int op_null_wait(int ms)
+{
+	unsigned int gen;
+	int space;
+
+	null_lock();
+	gen = null_gen;
+	space = null_space();
+	if (space == 0 && null_opened) {
+		/* until one frame has been "played" */
+		int64_t need = NULL_BUFFER_MS * null_second_size / 1000 - null_frame_size;
+		int wait_ms = ((int64_t)null_queued() - need) * 1000 / null_second_size + 1;
+		struct timespec ts;
+		int rc = 0;
+
+		if (wait_ms > ms)
+			wait_ms = ms;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += (long)wait_ms * 1000000;
+		ts.tv_sec += ts.tv_nsec / 1000000000;
+		ts.tv_nsec %= 1000000000;
+
+		/* close, drop, pause and unpause end the wait */
+		while (gen == null_gen && rc != ETIMEDOUT)
+			rc = pthread_cond_timedwait(&null_cond, &null_mutex, &ts);
+		space = null_opened ? null_space() : 0;
+	}
+	null_unlock();
+	return space > 0;
+}
+
+static int op_null_latency(void)
+{
+	int queued;
+
+	null_lock();
+	queued = null_queued();
+	null_unlock();
+	return queued;
+}
+
+static int op_null_pause(void)
+{
+	null_lock();
+	null_paused_bytes = null_queued();
+	null_wake();
+	null_unlock();
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_unpause(void)
+{
+	null_lock();
+	null_clock_reset(null_paused_bytes);
+	null_wake();
+	null_unlock();
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_set_mode(const char *val)
+{
+	int i;
+
+	for (i = 0; null_mode_names[i]; i++) {
+		if (strcasecmp(val, null_mode_names[i]) == 0) {
+			null_mode = i;
+			return OP_ERROR_SUCCESS;
+		}
+	}
+	errno = EINVAL;
+	return -OP_ERROR_ERRNO;
+}
+
+static int op_null_get_mode(char **val)
+{
+	*val = xstrdup(null_mode_names[null_mode]);
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_set_file(const char *val)
+{
+	free(null_file);
+	null_file = xstrdup(val);
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_get_file(char **val)
+{
+	*val = xstrdup(null_file ? null_file : "");
+	return OP_ERROR_SUCCESS;
+}
+
+/* setting it to anything resets the counters */
+static int op_null_set_stats(const char *val)
+{
+	null_print_stats();
+	stats_bytes = 0;
+	stats_audio = 0;
+	stats_first_write = 0;
+	stats_last_write = 0;
+	return OP_ERROR_SUCCESS;
+}
+
+static int op_null_get_stats(char **val)
+{
+	char buf[128];
+	double wall = (stats_last_write - stats_first_write) / 1e6;
+
+	snprintf(buf, sizeof(buf), "%llu bytes, %.3f s audio, %.3f s wall, %.2fx",
+			(unsigned long long)stats_bytes, stats_audio, wall,
+			wall > 0 ? stats_audio / wall : 0.0);
+	*val = xstrdup(buf);
+	return OP_ERROR_SUCCESS;
+}
+
+const struct output_plugin_ops op_pcm_ops = {
+	.init = op_null_init,
+	.exit = op_null_exit,
+	.open = op_null_open,
+	.close = op_null_close,
+	.drop = op_null_drop,
+	.write = op_null_write,
+	.buffer_space = op_null_buffer_space,
+	.pause = op_null_pause,
+	.unpause = op_null_unpause,
+	.wait = op_null_wait,
+	.latency = op_null_latency,
+};
+
+const struct output_plugin_opt op_pcm_options[] = {
+	OPT(op_null, file),
+	OPT(op_null, mode),
+	OPT(op_null, stats),
+	{ NULL },
+};
+
+/* would always open, so only used if set explicitly */
+const int op_priority = OP_PRIORITY_MANUAL;
+const unsigned op_abi_version = OP_ABI_VERSION;
+const int op_float_samples = 1;
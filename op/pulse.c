@@ -17,6 +17,11 @@
  */
 
 #include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
 
 #include <pulse/pulseaudio.h>
 
@@ -40,8 +45,31 @@ static int			 mixer_notify_output_in;
 static int			 mixer_notify_output_out;
 static long 			 pa_last_output_idx;
 
+/*
+ * Pull mode: the consumer only copies into pa_ring, the stream's write
+ * callback moves the data on to the server from the mainloop thread.
+ * The ring holds whole frames, pa_ring_written is only advanced by the
+ * consumer and pa_ring_read only by the mainloop thread.
+ */
+static int			 pa_pull;
+static char			*pa_ring;
+static size_t			 pa_ring_size;
+static atomic_size_t		 pa_ring_written;
+static atomic_size_t		 pa_ring_read;
+/* the server asked for more than the ring had */
+static atomic_bool		 pa_starved;
+/* signalled when the mainloop thread has emptied some of the ring */
+static pthread_mutex_t		 pa_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		 pa_ring_cond = PTHREAD_COND_INITIALIZER;
+/* bumped by close, drop and pause to end a concurrent op_pulse_wait() */
+static unsigned int		 pa_ring_gen;
+
+/* server side buffer requested in pull mode, the ring is as large */
+#define PA_PULL_LATENCY_MS 100
+
 /* configuration */
 static int pa_restore_volume = 1;
+static int pa_pull_mode = 0;
 
 #define ret_pa_error(err)						\
 	do {								\
@@ -180,12 +208,93 @@ static void _pa_stream_success_cb(pa_stream *s, int success, void *data)
 	pa_threaded_mainloop_signal(pa_ml, 0);
 }
 
+static size_t _pa_ring_fill(void)
+{
+	return atomic_load_explicit(&pa_ring_written, memory_order_acquire) -
+		atomic_load_explicit(&pa_ring_read, memory_order_acquire);
+}
+
+/* called with the mainloop lock held */
+static void _pa_pull(size_t nbytes)
+{
+	size_t rpos = atomic_load_explicit(&pa_ring_read, memory_order_relaxed);
+	size_t n = _pa_ring_fill();
+
+	if (n > nbytes)
+		n = nbytes;
+	atomic_store_explicit(&pa_starved, n < nbytes, memory_order_relaxed);
+
+	while (n) {
+		size_t pos = rpos % pa_ring_size;
+		size_t len = n < pa_ring_size - pos ? n : pa_ring_size - pos;
+		int rc;
+
+		rc = pa_stream_write(pa_s, pa_ring + pos, len, NULL, 0, PA_SEEK_RELATIVE);
+		if (rc) {
+			d_print("PulseAudio error: %s\n", pa_strerror(rc));
+			break;
+		}
+		rpos += len;
+		n -= len;
+	}
+	atomic_store_explicit(&pa_ring_read, rpos, memory_order_release);
+
+	pthread_mutex_lock(&pa_ring_mutex);
+	pthread_cond_signal(&pa_ring_cond);
+	pthread_mutex_unlock(&pa_ring_mutex);
+}
+
+static void _pa_stream_write_cb(pa_stream *s, size_t nbytes, void *data)
+{
+	_pa_pull(nbytes);
+}
+
+/*
+ * The server doesn't ask again until it has got what it asked for, so
+ * if the ring ran dry the consumer has to hand over new data itself.
+ */
+static void _pa_pull_kick(void)
+{
+	size_t writable;
+
+	if (!_pa_ring_fill() || !atomic_exchange(&pa_starved, false))
+		return;
+
+	pa_threaded_mainloop_lock(pa_ml);
+	writable = pa_stream_writable_size(pa_s);
+	if (writable != (size_t)-1)
+		_pa_pull(writable);
+	pa_threaded_mainloop_unlock(pa_ml);
+}
+
+/* op_pulse_wait() runs without the player lock, wake it when the ring changes under it */
+static void _pa_ring_wake(void)
+{
+	pthread_mutex_lock(&pa_ring_mutex);
+	pa_ring_gen++;
+	pthread_cond_broadcast(&pa_ring_cond);
+	pthread_mutex_unlock(&pa_ring_mutex);
+}
+
+static void _pa_ring_free(void)
+{
+	free(pa_ring);
+	pa_ring = NULL;
+	pa_ring_size = 0;
+	atomic_store(&pa_ring_written, 0);
+	atomic_store(&pa_ring_read, 0);
+	atomic_store(&pa_starved, false);
+}
+
 static pa_sample_format_t _pa_sample_format(sample_format_t sf)
 {
 	const int signed_	= sf_get_signed(sf);
 	const int big_endian	= sf_get_bigendian(sf);
 	const int sample_size	= sf_get_sample_size(sf) * 8;
 
+	if (sf_get_float(sf))
+		return big_endian ? PA_SAMPLE_FLOAT32BE : PA_SAMPLE_FLOAT32LE;
+
 	if (!signed_ && sample_size == 8)
 		return PA_SAMPLE_U8;
 
@@ -361,6 +470,15 @@ static int op_pulse_open(sample_format_t sf, const channel_position_t *channel_m
 {
 	pa_proplist	*pl;
 	int		 rc, i;
+	pa_stream_flags_t flags = PA_STREAM_INTERPOLATE_TIMING |
+				  PA_STREAM_AUTO_TIMING_UPDATE;
+	pa_buffer_attr	 attr = {
+		.maxlength	= (uint32_t)-1,
+		.tlength	= (uint32_t)-1,
+		.prebuf		= (uint32_t)-1,
+		.minreq		= (uint32_t)-1,
+		.fragsize	= (uint32_t)-1
+	};
 
 	const pa_sample_spec ss = {
 		.format		= _pa_sample_format(sf),
@@ -398,10 +516,21 @@ static int op_pulse_open(sample_format_t sf, const channel_position_t *channel_m
 	pa_last_output_idx = -1;
 	pa_stream_set_state_callback(pa_s, _pa_stream_running_cb, NULL);
 
+	pa_pull = pa_pull_mode;
+	if (pa_pull) {
+		attr.tlength = pa_usec_to_bytes(PA_PULL_LATENCY_MS * 1000, &ss);
+		flags |= PA_STREAM_ADJUST_LATENCY;
+
+		/* resized to what the server picked once the stream is ready */
+		pa_ring_size = attr.tlength;
+		pa_ring = xnew(char, pa_ring_size);
+		pa_stream_set_write_callback(pa_s, _pa_stream_write_cb, NULL);
+	}
+
 	rc = pa_stream_connect_playback(pa_s,
 					NULL,
-					NULL,
-					PA_STREAM_NOFLAGS,
+					pa_pull ? &attr : NULL,
+					flags,
 					pa_restore_volume ? NULL : &pa_vol,
 					NULL);
 	if (rc)
@@ -412,6 +541,17 @@ static int op_pulse_open(sample_format_t sf, const channel_position_t *channel_m
 	if (pa_stream_get_state(pa_s) != PA_STREAM_READY)
 		goto out_fail;
 
+	if (pa_pull) {
+		const pa_buffer_attr *a = pa_stream_get_buffer_attr(pa_s);
+
+		/* nothing written yet, the callback can't run while we hold the lock */
+		if (a && a->tlength > pa_ring_size) {
+			pa_ring_size = a->tlength - a->tlength % pa_frame_size(&ss);
+			pa_ring = xrenew(char, pa_ring, pa_ring_size);
+		}
+		d_print("pull mode, tlength=%zu\n", pa_ring_size);
+	}
+
 	pa_context_get_sink_input_info(pa_ctx, pa_stream_get_index(pa_s),
 			_pa_sink_input_info_cb, NULL);
 
@@ -421,6 +561,9 @@ static int op_pulse_open(sample_format_t sf, const channel_position_t *channel_m
 
 out_fail:
 	pa_stream_unref(pa_s);
+	pa_s = NULL;
+	_pa_ring_free();
+	pa_pull = 0;
 
 	pa_threaded_mainloop_unlock(pa_ml);
 
@@ -436,6 +579,11 @@ static int op_pulse_close(void)
 		pa_stream_unref(pa_s);
 		pa_s = NULL;
 	}
+	pthread_mutex_lock(&pa_ring_mutex);
+	_pa_ring_free();
+	pa_pull = 0;
+	pthread_mutex_unlock(&pa_ring_mutex);
+	_pa_ring_wake();
 
 	if (pa_ctx) {
 		pa_context_disconnect(pa_ctx);
@@ -452,13 +600,45 @@ static int op_pulse_drop(void)
 {
 	pa_threaded_mainloop_lock(pa_ml);
 
+	if (pa_pull) {
+		atomic_store(&pa_ring_read, atomic_load(&pa_ring_written));
+		atomic_store(&pa_starved, false);
+		_pa_ring_wake();
+	}
+
 	return _pa_wait_unlock(pa_stream_flush(pa_s, _pa_stream_success_cb, NULL));
 }
 
+static int _pa_ring_write(const char *buf, int count)
+{
+	size_t wpos = atomic_load_explicit(&pa_ring_written, memory_order_relaxed);
+	size_t n = pa_ring_size - _pa_ring_fill();
+	size_t done = 0;
+
+	if (n > count)
+		n = count;
+	n -= n % pa_frame_size(&pa_ss);
+
+	while (done < n) {
+		size_t pos = (wpos + done) % pa_ring_size;
+		size_t len = n - done < pa_ring_size - pos ? n - done : pa_ring_size - pos;
+
+		memcpy(pa_ring + pos, buf + done, len);
+		done += len;
+	}
+	atomic_store_explicit(&pa_ring_written, wpos + n, memory_order_release);
+
+	_pa_pull_kick();
+	return n;
+}
+
 static int op_pulse_write(const char *buf, int count)
 {
 	int rc;
 
+	if (pa_pull)
+		return _pa_ring_write(buf, count);
+
 	pa_threaded_mainloop_lock(pa_ml);
 	rc = pa_stream_write(pa_s, buf, count, NULL, 0, PA_SEEK_RELATIVE);
 	pa_threaded_mainloop_unlock(pa_ml);
@@ -473,6 +653,12 @@ static int op_pulse_buffer_space(void)
 {
 	int s;
 
+	if (pa_pull) {
+		_pa_pull_kick();
+		s = pa_ring_size - _pa_ring_fill();
+		return s - s % pa_frame_size(&pa_ss);
+	}
+
 	pa_threaded_mainloop_lock(pa_ml);
 	s = (int)pa_stream_writable_size(pa_s);
 	pa_threaded_mainloop_unlock(pa_ml);
@@ -480,8 +666,56 @@ static int op_pulse_buffer_space(void)
 	return s;
 }
 
+static int op_pulse_latency(void)
+{
+	pa_usec_t usec;
+	int negative, rc;
+	size_t bytes = 0;
+
+	pa_threaded_mainloop_lock(pa_ml);
+	/* fails until the first timing update has arrived */
+	rc = pa_stream_get_latency(pa_s, &usec, &negative);
+	if (rc == 0 && !negative)
+		bytes = pa_usec_to_bytes(usec, pa_stream_get_sample_spec(pa_s));
+	pa_threaded_mainloop_unlock(pa_ml);
+
+	if (pa_pull)
+		bytes += _pa_ring_fill();
+	return bytes;
+}
+
+static int op_pulse_wait(int ms)
+{
+	struct timespec ts;
+	size_t frame_size;
+	unsigned int gen;
+	int rc = 0, space;
+
+	/* the player sleeps without holding its lock */
+	if (!pa_pull)
+		return -OP_ERROR_NOT_SUPPORTED;
+
+	frame_size = pa_frame_size(&pa_ss);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (long)ms * 1000000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+
+	/* close, drop or pause end the wait, the player rechecks its state */
+	pthread_mutex_lock(&pa_ring_mutex);
+	gen = pa_ring_gen;
+	while (pa_pull && gen == pa_ring_gen &&
+			pa_ring_size - _pa_ring_fill() < frame_size && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&pa_ring_cond, &pa_ring_mutex, &ts);
+	space = pa_pull && pa_ring_size - _pa_ring_fill() >= frame_size;
+	pthread_mutex_unlock(&pa_ring_mutex);
+
+	return space;
+}
+
 static int op_pulse_pause(void)
 {
+	_pa_ring_wake();
 	return _pa_stream_cork(1);
 }
 
@@ -594,6 +828,18 @@ static int op_pulse_get_restore_volume(char **val)
 	return 0;
 }
 
+static int op_pulse_set_pull(const char *val)
+{
+	pa_pull_mode = is_freeform_true(val);
+	return 0;
+}
+
+static int op_pulse_get_pull(char **val)
+{
+	*val = xstrdup(pa_pull_mode ? "1" : "0");
+	return 0;
+}
+
 const struct output_plugin_ops op_pcm_ops = {
 	.init		= op_pulse_init,
 	.exit		= op_pulse_exit,
@@ -604,6 +850,8 @@ const struct output_plugin_ops op_pcm_ops = {
 	.buffer_space	= op_pulse_buffer_space,
 	.pause		= op_pulse_pause,
 	.unpause	= op_pulse_unpause,
+	.wait		= op_pulse_wait,
+	.latency	= op_pulse_latency,
 };
 
 const struct mixer_plugin_ops op_mixer_ops = {
@@ -617,6 +865,7 @@ const struct mixer_plugin_ops op_mixer_ops = {
 };
 
 const struct output_plugin_opt op_pcm_options[] = {
+	OPT(op_pulse, pull),
 	{ NULL },
 };
 
@@ -627,3 +876,4 @@ const struct mixer_plugin_opt op_mixer_options[] = {
 
 const int op_priority = -2;
 const unsigned op_abi_version = OP_ABI_VERSION;
+const int op_float_samples = 1;
@@ -41,6 +41,9 @@
 #include "debug.h"
 #include "discid.h"
 #include "mpris.h"
+#include "resample.h"
+#include "prefetch.h"
+#include "rt.h"
 #ifdef HAVE_CONFIG
 #include "config/curses.h"
 #endif
@@ -314,6 +317,25 @@ static void set_device(void *data, const char *buf)
 	cdda_device = expand_filename(buf);
 }
 
+static void get_buffer_adaptive(void *data, char *buf, size_t size)
+{
+	strscpy(buf, bool_names[buffer_adaptive], size);
+}
+
+static void set_buffer_adaptive(void *data, const char *buf)
+{
+	int tmp;
+
+	if (!parse_bool(buf, &tmp))
+		return;
+	player_set_buffer_adaptive(tmp);
+}
+
+static void toggle_buffer_adaptive(void *data)
+{
+	player_set_buffer_adaptive(buffer_adaptive ^ 1);
+}
+
 #define SECOND_SIZE (44100 * 16 / 8 * 2)
 static void get_buffer_seconds(void *data, char *buf, size_t size)
 {
@@ -330,6 +352,20 @@ static void set_buffer_seconds(void *data, const char *buf)
 		player_set_buffer_chunks((sec * SECOND_SIZE + CHUNK_SIZE / 2) / CHUNK_SIZE);
 }
 
+static void get_stream_buffer_seconds(void *data, char *buf, size_t size)
+{
+	buf_int(buf, stream_buffer_seconds, size);
+}
+
+static void set_stream_buffer_seconds(void *data, const char *buf)
+{
+	int sec;
+
+	/* takes effect with the next stream */
+	if (parse_int(buf, 0, 60, &sec))
+		stream_buffer_seconds = sec;
+}
+
 static void get_scroll_offset(void *data, char *buf, size_t size)
 {
 	buf_int(buf, scroll_offset, size);
@@ -405,6 +441,35 @@ static void set_pl_sort(void *data, const char *buf)
 	pl_set_sort_str(buf);
 }
 
+static void get_prefetch_size(void *data, char *buf, size_t size)
+{
+	buf_int(buf, prefetch_size, size);
+}
+
+static void set_prefetch_size(void *data, const char *buf)
+{
+	int val;
+
+	if (parse_int(buf, 1, 4096, &val))
+		prefetch_size = val;
+}
+
+static void get_prefetch_tracks(void *data, char *buf, size_t size)
+{
+	buf_int(buf, prefetch_tracks, size);
+}
+
+static void set_prefetch_tracks(void *data, const char *buf)
+{
+	int val;
+
+	if (parse_int(buf, 0, PREFETCH_TRACKS_MAX, &val)) {
+		prefetch_tracks = val;
+		if (ui_initialized)
+			prefetch_update();
+	}
+}
+
 static void get_output_plugin(void *data, char *buf, size_t size)
 {
 	const char *value = op_get_current();
@@ -466,6 +531,38 @@ static void set_replaygain_preamp(void *data, const char *buf)
 	player_set_rg_preamp(val);
 }
 
+static void get_resample_rate(void *data, char *buf, size_t size)
+{
+	buf_int(buf, resample_rate, size);
+}
+
+static void set_resample_rate(void *data, const char *buf)
+{
+	int rate;
+
+	if (!parse_int(buf, 0, 384000, &rate))
+		return;
+	if (rate && rate < 8000) {
+		error_msg("0 or sample rate in range 8000..384000 expected");
+		return;
+	}
+	player_set_resample_rate(rate);
+}
+
+static void get_resample_quality(void *data, char *buf, size_t size)
+{
+	strscpy(buf, resample_quality_names[resample_quality], size);
+}
+
+static void set_resample_quality(void *data, const char *buf)
+{
+	int tmp;
+
+	if (!parse_enum(buf, 0, NR_RESAMPLE_QUALITIES - 1, resample_quality_names, &tmp))
+		return;
+	player_set_resample_quality(tmp);
+}
+
 static void get_softvol_state(void *data, char *buf, size_t size)
 {
 	snprintf(buf, size, "%d %d", soft_vol_l, soft_vol_r);
@@ -911,6 +1008,105 @@ static void toggle_replaygain_limit(void *data)
 	player_set_rg_limit(replaygain_limit ^ 1);
 }
 
+static void get_rt_consumer_cpus(void *data, char *buf, size_t size)
+{
+	strscpy(buf, rt_consumer_cpus, size);
+}
+
+static void set_rt_consumer_cpus(void *data, const char *buf)
+{
+	int rc = player_set_rt_cpus(1, buf);
+
+	if (rc)
+		error_msg("could not set consumer CPU affinity to '%s': %s", buf, strerror(rc));
+}
+
+static void get_rt_lock_memory(void *data, char *buf, size_t size)
+{
+	strscpy(buf, bool_names[rt_lock_memory], size);
+}
+
+static void set_rt_lock_memory_value(int lock)
+{
+	int rc = player_set_rt_lock_memory(lock);
+
+	if (rc == ENOMEM || rc == EPERM)
+		error_msg("could not lock player buffer into memory: %s (check ulimit -l)",
+				strerror(rc));
+	else if (rc)
+		error_msg("could not lock player buffer into memory: %s", strerror(rc));
+}
+
+static void set_rt_lock_memory(void *data, const char *buf)
+{
+	int tmp;
+
+	if (!parse_bool(buf, &tmp))
+		return;
+	set_rt_lock_memory_value(tmp);
+}
+
+static void toggle_rt_lock_memory(void *data)
+{
+	set_rt_lock_memory_value(rt_lock_memory ^ 1);
+}
+
+static void set_rt_scheduling(int policy, int priority)
+{
+	int rc = player_set_rt_scheduling(policy, priority);
+
+	if (rc == EPERM)
+		error_msg("could not set %s scheduling: %s (check ulimit -r)",
+				rt_policy_names[policy], strerror(rc));
+	else if (rc)
+		error_msg("could not set %s scheduling: %s",
+				rt_policy_names[policy], strerror(rc));
+}
+
+static void get_rt_policy(void *data, char *buf, size_t size)
+{
+	strscpy(buf, rt_policy_names[rt_policy], size);
+}
+
+static void set_rt_policy(void *data, const char *buf)
+{
+	int tmp;
+
+	if (!parse_enum(buf, 0, NR_RT_POLICIES - 1, rt_policy_names, &tmp))
+		return;
+	set_rt_scheduling(tmp, rt_priority);
+}
+
+static void get_rt_priority(void *data, char *buf, size_t size)
+{
+	buf_int(buf, rt_priority, size);
+}
+
+static void set_rt_priority(void *data, const char *buf)
+{
+	int tmp;
+
+	if (!parse_int(buf, 1, 99, &tmp))
+		return;
+	if (rt_policy == RT_POLICY_OTHER)
+		rt_priority = tmp;
+	else
+		set_rt_scheduling(rt_policy, tmp);
+}
+
+static void get_rt_producer_cpus(void *data, char *buf, size_t size)
+{
+	strscpy(buf, rt_producer_cpus, size);
+}
+
+static void set_rt_producer_cpus(void *data, const char *buf)
+{
+	int rc = player_set_rt_cpus(0, buf);
+
+	if (rc)
+		error_msg("could not set producer CPU affinity to '%s': %s", buf, strerror(rc));
+}
+
 static void get_resume(void *data, char *buf, size_t size)
 {
 	strscpy(buf, bool_names[resume_cmus], size);
@@ -1633,6 +1829,7 @@ static const struct {
 	DT(aaa_mode)
 	DT(auto_reshuffle)
 	DN_FLAGS(device, OPT_PROGRAM_PATH)
+	DT(buffer_adaptive)
 	DN(buffer_seconds)
 	DN(scroll_offset)
 	DN(rewind_offset)
@@ -1649,13 +1846,22 @@ static const struct {
 	DN(pl_sort)
 	DT(play_library)
 	DT(play_sorted)
+	DN(prefetch_size)
+	DN(prefetch_tracks)
 	DT(display_artist_sort_name)
 	DT(repeat)
 	DT(repeat_current)
 	DT(replaygain)
 	DT(replaygain_limit)
 	DN(replaygain_preamp)
+	DN(resample_quality)
+	DN(resample_rate)
 	DT(resume)
+	DN(rt_consumer_cpus)
+	DT(rt_lock_memory)
+	DN(rt_policy)
+	DN(rt_priority)
+	DN(rt_producer_cpus)
 	DT(show_hidden)
 	DT(auto_expand_albums_follow)
 	DT(auto_expand_albums_search)
@@ -1680,6 +1886,7 @@ static const struct {
 	DN(lib_add_filter)
 	DN(start_view)
 	DT(stop_after_queue)
+	DN(stream_buffer_seconds)
 	DN(tree_width_percent)
 	DN(tree_width_max)
 	DT(pause_on_output_change)
@@ -50,6 +50,7 @@ struct output_plugin {
 	const struct mixer_plugin_opt *mixer_options;
 	int priority;
 
+	unsigned int float_samples : 1;
 	unsigned int pcm_initialized : 1;
 	unsigned int mixer_initialized : 1;
 	unsigned int mixer_open : 1;
@@ -124,7 +125,8 @@ void op_load_plugins(void)
 			error_msg("%s: missing symbol", filename);
 			err = true;
 		}
-		if (!plug->abi_version_ptr || *plug->abi_version_ptr != OP_ABI_VERSION) {
+		if (!plug->abi_version_ptr || *plug->abi_version_ptr < 3 ||
+				*plug->abi_version_ptr > OP_ABI_VERSION) {
 			error_msg("%s: incompatible plugin version", filename);
 			err = true;
 		}
@@ -142,6 +144,10 @@ void op_load_plugins(void)
 			plug->mixer_options = NULL;
 		}
 
+		/* optional, plugins without it only get integer samples */
+		symptr = dlsym(so, "op_float_samples");
+		plug->float_samples = symptr && *(int *)symptr;
+
 		plug->name = xstrndup(d->d_name, ext - d->d_name);
 		plug->handle = so;
 		plug->pcm_initialized = 0;
@@ -243,6 +249,8 @@ int op_select_any(void)
 	sample_format_t sf = sf_channels(2) | sf_rate(44100) | sf_bits(16) | sf_signed(1);
 
 	list_for_each_entry(o, &op_head, node) {
+		if (o->priority >= OP_PRIORITY_MANUAL)
+			continue;
 		rc = select_plugin(o);
 		if (rc != 0)
 			continue;
@@ -259,9 +267,16 @@ int op_open(sample_format_t sf, const channel_position_t *channel_map)
 {
 	if (op == NULL)
 		return -OP_ERROR_NOT_INITIALIZED;
+	if (sf_get_float(sf) && !op->float_samples)
+		return -OP_ERROR_SAMPLE_FORMAT;
 	return op->pcm_ops->open(sf, channel_map);
 }
 
+int op_supports_float(void)
+{
+	return op && op->float_samples;
+}
+
 int op_drop(void)
 {
 	if (op->pcm_ops->drop == NULL)
@@ -279,6 +294,35 @@ int op_write(const char *buffer, int count)
 	return op->pcm_ops->write(buffer, count);
 }
 
+int op_mmap_begin(char **buffer, int *count)
+{
+	if (*op->abi_version_ptr < 4 || op->pcm_ops->mmap_begin == NULL)
+		return -OP_ERROR_NOT_SUPPORTED;
+	return op->pcm_ops->mmap_begin(buffer, count);
+}
+
+int op_mmap_commit(int count)
+{
+	return op->pcm_ops->mmap_commit(count);
+}
+
+/* called without the player lock, op may be switched meanwhile */
+int op_wait(int ms)
+{
+	struct output_plugin *o = op;
+
+	if (*o->abi_version_ptr < 4 || o->pcm_ops->wait == NULL)
+		return -OP_ERROR_NOT_SUPPORTED;
+	return o->pcm_ops->wait(ms);
+}
+
+int op_latency(void)
+{
+	if (*op->abi_version_ptr < 4 || op->pcm_ops->latency == NULL)
+		return -OP_ERROR_NOT_SUPPORTED;
+	return op->pcm_ops->latency();
+}
+
 int op_pause(void)
 {
 	if (op->pcm_ops->pause == NULL)
@@ -44,6 +44,11 @@ int op_select_any(void);
  */
 int op_open(sample_format_t sf, const channel_position_t *channel_map);
 
+/*
+ * returns non-zero if the selected plugin accepts float samples
+ */
+int op_supports_float(void);
+
 /*
  * drop pcm data
  *
@@ -65,6 +70,14 @@ int op_close(void);
  */
 int op_write(const char *buffer, int count);
 
+/*
+ * zero-copy alternative to op_write(), see struct output_plugin_ops
+ *
+ * errors: OP_ERROR_{NOT_SUPPORTED}
+ */
+int op_mmap_begin(char **buffer, int *count);
+int op_mmap_commit(int count);
+
 /*
  * errors: OP_ERROR_{}
  */
@@ -76,6 +89,22 @@ int op_unpause(void);
  */
 int op_buffer_space(void);
 
+/*
+ * waits at most @ms for space in the output buffer
+ *
+ * returns 1 if there is space, 0 on timeout or error
+ *
+ * errors: OP_ERROR_{NOT_SUPPORTED}
+ */
+int op_wait(int ms);
+
+/*
+ * returns bytes written but not played yet
+ *
+ * errors: OP_ERROR_{NOT_SUPPORTED}
+ */
+int op_latency(void);
+
 /*
  * errors: OP_ERROR_{}
  */
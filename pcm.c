@@ -21,6 +21,12 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <math.h>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define PCM_X86
+#include <immintrin.h>
+#endif
 
 /*
  * Functions to convert PCM to 16-bit signed little-endian stereo
@@ -146,6 +152,509 @@ static void convert_16_1ch_to_16_2ch(void *dst, const void *src, int count)
 	}
 }
 
+static void convert_float_1ch_to_float_2ch(void *dst, const void *src, int count)
+{
+	float *d = dst;
+	const float *s = src;
+	int i, j = 0;
+
+	for (i = 0; i < count; i++) {
+		d[j++] = s[i];
+		d[j++] = s[i];
+	}
+}
+
+/* output is half the size of the input so this can be done in place */
+static void convert_float_to_s16(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const float *s = src;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		float f = s[i] * 32768.0f;
+
+		if (f >= 32767.0f)
+			d[i] = 32767;
+		else if (f <= -32768.0f)
+			d[i] = -32768;
+		else
+			d[i] = lrintf(f);
+	}
+}
+
+static void convert_float_to_s32(void *dst, const void *src, int count)
+{
+	int32_t *d = dst;
+	const float *s = src;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		float f = s[i] * 2147483648.0f;
+
+		/* 2147483647 is not representable, it rounds up to 2^31 */
+		if (f >= 2147483648.0f)
+			d[i] = INT32_MAX;
+		else if (f <= -2147483648.0f)
+			d[i] = INT32_MIN;
+		else
+			d[i] = lrintf(f);
+	}
+}
+
+static void convert_s32_to_float(void *dst, const void *src, int count)
+{
+	float *d = dst;
+	const int32_t *s = src;
+	int i;
+
+	for (i = 0; i < count; i++)
+		d[i] = s[i] * (1.0f / 2147483648.0f);
+}
+
+/* 24 valid bits in the low bytes of a 32-bit sample */
+static void convert_s24_32_to_s32(void *buf, int count)
+{
+	uint32_t *b = buf;
+	int i;
+
+	for (i = 0; i < count; i++)
+		b[i] <<= 8;
+}
+
+static void interleave_16(void *dst, const void * const *src, int channels, int frames)
+{
+	int16_t *d = dst;
+	int i, c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++)
+			*d++ = ((const int16_t *)src[c])[i];
+	}
+}
+
+static void interleave_32(void *dst, const void * const *src, int channels, int frames)
+{
+	int32_t *d = dst;
+	int i, c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++)
+			*d++ = ((const int32_t *)src[c])[i];
+	}
+}
+
+static void deinterleave_32(void * const *dst, const void *src, int channels, int frames)
+{
+	const int32_t *s = src;
+	int i, c;
+
+	for (i = 0; i < frames; i++) {
+		for (c = 0; c < channels; c++)
+			((int32_t *)dst[c])[i] = *s++;
+	}
+}
+
+#ifdef PCM_X86
+/*
+ * SSE2 is always available on x86_64, AVX2 versions are selected at run
+ * time.  Each function converts whole vectors and leaves the tail to the
+ * generic version.
+ */
+
+static void convert_u8_1ch_to_s16_2ch_sse2(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const uint8_t *s = src;
+	const __m128i bias = _mm_set1_epi8(-128);
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(s + i)), bias);
+		__m128i lo = _mm_unpacklo_epi8(zero, v);
+		__m128i hi = _mm_unpackhi_epi8(zero, v);
+
+		_mm_storeu_si128((__m128i *)(d + i * 2), _mm_unpacklo_epi16(lo, lo));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 8), _mm_unpackhi_epi16(lo, lo));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 16), _mm_unpacklo_epi16(hi, hi));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 24), _mm_unpackhi_epi16(hi, hi));
+	}
+	convert_u8_1ch_to_s16_2ch(d + i * 2, s + i, count - i);
+}
+
+static void convert_s8_1ch_to_s16_2ch_sse2(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const int8_t *s = src;
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i lo = _mm_unpacklo_epi8(zero, v);
+		__m128i hi = _mm_unpackhi_epi8(zero, v);
+
+		_mm_storeu_si128((__m128i *)(d + i * 2), _mm_unpacklo_epi16(lo, lo));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 8), _mm_unpackhi_epi16(lo, lo));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 16), _mm_unpacklo_epi16(hi, hi));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 24), _mm_unpackhi_epi16(hi, hi));
+	}
+	convert_s8_1ch_to_s16_2ch(d + i * 2, s + i, count - i);
+}
+
+static void convert_u8_2ch_to_s16_2ch_sse2(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const int8_t *s = src;
+	const __m128i bias = _mm_set1_epi8(-128);
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(s + i)), bias);
+
+		_mm_storeu_si128((__m128i *)(d + i), _mm_unpacklo_epi8(zero, v));
+		_mm_storeu_si128((__m128i *)(d + i + 8), _mm_unpackhi_epi8(zero, v));
+	}
+	convert_u8_2ch_to_s16_2ch(d + i, s + i, count - i);
+}
+
+static void convert_s8_2ch_to_s16_2ch_sse2(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const int8_t *s = src;
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+		_mm_storeu_si128((__m128i *)(d + i), _mm_unpacklo_epi8(zero, v));
+		_mm_storeu_si128((__m128i *)(d + i + 8), _mm_unpackhi_epi8(zero, v));
+	}
+	convert_s8_2ch_to_s16_2ch(d + i, s + i, count - i);
+}
+
+static void convert_u16_le_to_s16_le_sse2(void *buf, int count)
+{
+	int16_t *b = buf;
+	const __m128i bias = _mm_set1_epi16(-32768);
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(b + i));
+
+		_mm_storeu_si128((__m128i *)(b + i), _mm_xor_si128(v, bias));
+	}
+	convert_u16_le_to_s16_le(b + i, count - i);
+}
+
+static inline __m128i swap16_sse2(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static void convert_u16_be_to_s16_le_sse2(void *buf, int count)
+{
+	int16_t *b = buf;
+	const __m128i bias = _mm_set1_epi16(-32768);
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(b + i));
+
+		_mm_storeu_si128((__m128i *)(b + i), _mm_xor_si128(swap16_sse2(v), bias));
+	}
+	convert_u16_be_to_s16_le(b + i, count - i);
+}
+
+static void swap_s16_byte_order_sse2(void *buf, int count)
+{
+	int16_t *b = buf;
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(b + i));
+
+		_mm_storeu_si128((__m128i *)(b + i), swap16_sse2(v));
+	}
+	swap_s16_byte_order(b + i, count - i);
+}
+
+static void convert_16_1ch_to_16_2ch_sse2(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const int16_t *s = src;
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+		_mm_storeu_si128((__m128i *)(d + i * 2), _mm_unpacklo_epi16(v, v));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 8), _mm_unpackhi_epi16(v, v));
+	}
+	convert_16_1ch_to_16_2ch(d + i * 2, s + i, count - i);
+}
+
+static void convert_float_1ch_to_float_2ch_sse2(void *dst, const void *src, int count)
+{
+	float *d = dst;
+	const float *s = src;
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 v = _mm_loadu_ps(s + i);
+
+		_mm_storeu_ps(d + i * 2, _mm_unpacklo_ps(v, v));
+		_mm_storeu_ps(d + i * 2 + 4, _mm_unpackhi_ps(v, v));
+	}
+	convert_float_1ch_to_float_2ch(d + i * 2, s + i, count - i);
+}
+
+static void convert_float_to_s16_sse2(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const float *s = src;
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 max = _mm_set1_ps(32767.0f);
+	const __m128 min = _mm_set1_ps(-32768.0f);
+	int i;
+
+	/* both loads before the store, dst may be src */
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(s + i), scale);
+		__m128 b = _mm_mul_ps(_mm_loadu_ps(s + i + 4), scale);
+		__m128i ia, ib;
+
+		a = _mm_max_ps(_mm_min_ps(a, max), min);
+		b = _mm_max_ps(_mm_min_ps(b, max), min);
+		ia = _mm_cvtps_epi32(a);
+		ib = _mm_cvtps_epi32(b);
+		_mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(ia, ib));
+	}
+	convert_float_to_s16(d + i, s + i, count - i);
+}
+
+static void convert_float_to_s32_sse2(void *dst, const void *src, int count)
+{
+	int32_t *d = dst;
+	const float *s = src;
+	const __m128 scale = _mm_set1_ps(2147483648.0f);
+	/* largest float below 2^31 */
+	const __m128 max = _mm_set1_ps(2147483520.0f);
+	const __m128 min = _mm_set1_ps(-2147483648.0f);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(s + i), scale);
+
+		v = _mm_max_ps(_mm_min_ps(v, max), min);
+		_mm_storeu_si128((__m128i *)(d + i), _mm_cvtps_epi32(v));
+	}
+	convert_float_to_s32(d + i, s + i, count - i);
+}
+
+static void convert_s32_to_float_sse2(void *dst, const void *src, int count)
+{
+	float *d = dst;
+	const int32_t *s = src;
+	const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+	convert_s32_to_float(d + i, s + i, count - i);
+}
+
+static void convert_s24_32_to_s32_sse2(void *buf, int count)
+{
+	int32_t *b = buf;
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(b + i));
+
+		_mm_storeu_si128((__m128i *)(b + i), _mm_slli_epi32(v, 8));
+	}
+	convert_s24_32_to_s32(b + i, count - i);
+}
+
+static void interleave_16_sse2(void *dst, const void * const *src, int channels, int frames)
+{
+	const int16_t *l = src[0], *r = src[1];
+	int16_t *d = dst;
+	int i;
+
+	if (channels != 2) {
+		interleave_16(dst, src, channels, frames);
+		return;
+	}
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(l + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(r + i));
+
+		_mm_storeu_si128((__m128i *)(d + i * 2), _mm_unpacklo_epi16(a, b));
+		_mm_storeu_si128((__m128i *)(d + i * 2 + 8), _mm_unpackhi_epi16(a, b));
+	}
+	for (; i < frames; i++) {
+		d[i * 2] = l[i];
+		d[i * 2 + 1] = r[i];
+	}
+}
+
+static void interleave_32_sse2(void *dst, const void * const *src, int channels, int frames)
+{
+	const float *l = src[0], *r = src[1];
+	float *d = dst;
+	int i;
+
+	if (channels != 2) {
+		interleave_32(dst, src, channels, frames);
+		return;
+	}
+	for (i = 0; i + 4 <= frames; i += 4) {
+		__m128 a = _mm_loadu_ps(l + i);
+		__m128 b = _mm_loadu_ps(r + i);
+
+		_mm_storeu_ps(d + i * 2, _mm_unpacklo_ps(a, b));
+		_mm_storeu_ps(d + i * 2 + 4, _mm_unpackhi_ps(a, b));
+	}
+	for (; i < frames; i++) {
+		d[i * 2] = l[i];
+		d[i * 2 + 1] = r[i];
+	}
+}
+
+static void deinterleave_32_sse2(void * const *dst, const void *src, int channels, int frames)
+{
+	float *l = dst[0], *r = dst[1];
+	const float *s = src;
+	int i;
+
+	if (channels != 2) {
+		deinterleave_32(dst, src, channels, frames);
+		return;
+	}
+	for (i = 0; i + 4 <= frames; i += 4) {
+		__m128 a = _mm_loadu_ps(s + i * 2);
+		__m128 b = _mm_loadu_ps(s + i * 2 + 4);
+
+		_mm_storeu_ps(l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	for (; i < frames; i++) {
+		l[i] = s[i * 2];
+		r[i] = s[i * 2 + 1];
+	}
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 void convert_u16_le_to_s16_le_avx2(void *buf, int count)
+{
+	int16_t *b = buf;
+	const __m256i bias = _mm256_set1_epi16(-32768);
+	int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		_mm256_storeu_si256((__m256i *)(b + i), _mm256_xor_si256(v, bias));
+	}
+	convert_u16_le_to_s16_le(b + i, count - i);
+}
+
+static AVX2 void swap_s16_byte_order_avx2(void *buf, int count)
+{
+	int16_t *b = buf;
+	const __m256i mask = _mm256_setr_epi8(
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		_mm256_storeu_si256((__m256i *)(b + i), _mm256_shuffle_epi8(v, mask));
+	}
+	swap_s16_byte_order(b + i, count - i);
+}
+
+static AVX2 void convert_float_to_s16_avx2(void *dst, const void *src, int count)
+{
+	int16_t *d = dst;
+	const float *s = src;
+	const __m256 scale = _mm256_set1_ps(32768.0f);
+	const __m256 max = _mm256_set1_ps(32767.0f);
+	const __m256 min = _mm256_set1_ps(-32768.0f);
+	int i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m256 a = _mm256_mul_ps(_mm256_loadu_ps(s + i), scale);
+		__m256 b = _mm256_mul_ps(_mm256_loadu_ps(s + i + 8), scale);
+		__m256i p;
+
+		a = _mm256_max_ps(_mm256_min_ps(a, max), min);
+		b = _mm256_max_ps(_mm256_min_ps(b, max), min);
+		/* packs works per 128-bit lane, restore the order */
+		p = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		p = _mm256_permute4x64_epi64(p, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *)(d + i), p);
+	}
+	convert_float_to_s16_sse2(d + i, s + i, count - i);
+}
+
+static AVX2 void convert_float_to_s32_avx2(void *dst, const void *src, int count)
+{
+	int32_t *d = dst;
+	const float *s = src;
+	const __m256 scale = _mm256_set1_ps(2147483648.0f);
+	const __m256 max = _mm256_set1_ps(2147483520.0f);
+	const __m256 min = _mm256_set1_ps(-2147483648.0f);
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256 v = _mm256_mul_ps(_mm256_loadu_ps(s + i), scale);
+
+		v = _mm256_max_ps(_mm256_min_ps(v, max), min);
+		_mm256_storeu_si256((__m256i *)(d + i), _mm256_cvtps_epi32(v));
+	}
+	convert_float_to_s32(d + i, s + i, count - i);
+}
+
+static AVX2 void convert_s32_to_float_avx2(void *dst, const void *src, int count)
+{
+	float *d = dst;
+	const int32_t *s = src;
+	const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+
+		_mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	convert_s32_to_float(d + i, s + i, count - i);
+}
+
+static AVX2 void convert_s24_32_to_s32_avx2(void *buf, int count)
+{
+	int32_t *b = buf;
+	int i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		_mm256_storeu_si256((__m256i *)(b + i), _mm256_slli_epi32(v, 8));
+	}
+	convert_s24_32_to_s32(b + i, count - i);
+}
+#endif
+
 /* index is ((bits >> 2) & 4) | (is_signed << 1) | (channels - 1) */
 pcm_conv_func pcm_conv[8] = {
 	convert_u8_1ch_to_s16_2ch,
@@ -177,3 +686,69 @@ pcm_conv_in_place_func pcm_conv_in_place[8] = {
 	swap_s16_byte_order,
 #endif
 };
+
+pcm_conv_func pcm_float_1ch_to_2ch = convert_float_1ch_to_float_2ch;
+pcm_conv_func pcm_float_to_s16 = convert_float_to_s16;
+pcm_conv_func pcm_float_to_s32 = convert_float_to_s32;
+pcm_conv_func pcm_s32_to_float = convert_s32_to_float;
+pcm_conv_in_place_func pcm_s24_32_to_s32 = convert_s24_32_to_s32;
+pcm_interleave_func pcm_interleave_16 = interleave_16;
+pcm_interleave_func pcm_interleave_32 = interleave_32;
+pcm_deinterleave_func pcm_deinterleave_32 = deinterleave_32;
+
+const char *pcm_impl = "generic";
+
+/* replace @old with @new in the tables */
+static void replace_conv(pcm_conv_func old, pcm_conv_func new)
+{
+	int i;
+
+	for (i = 0; i < N_ELEMENTS(pcm_conv); i++) {
+		if (pcm_conv[i] == old)
+			pcm_conv[i] = new;
+	}
+}
+
+static void replace_conv_in_place(pcm_conv_in_place_func old, pcm_conv_in_place_func new)
+{
+	int i;
+
+	for (i = 0; i < N_ELEMENTS(pcm_conv_in_place); i++) {
+		if (pcm_conv_in_place[i] == old)
+			pcm_conv_in_place[i] = new;
+	}
+}
+
+void pcm_init(void)
+{
+#ifdef PCM_X86
+	replace_conv(convert_u8_1ch_to_s16_2ch, convert_u8_1ch_to_s16_2ch_sse2);
+	replace_conv(convert_u8_2ch_to_s16_2ch, convert_u8_2ch_to_s16_2ch_sse2);
+	replace_conv(convert_s8_1ch_to_s16_2ch, convert_s8_1ch_to_s16_2ch_sse2);
+	replace_conv(convert_s8_2ch_to_s16_2ch, convert_s8_2ch_to_s16_2ch_sse2);
+	replace_conv(convert_16_1ch_to_16_2ch, convert_16_1ch_to_16_2ch_sse2);
+	replace_conv_in_place(convert_u16_le_to_s16_le, convert_u16_le_to_s16_le_sse2);
+	replace_conv_in_place(convert_u16_be_to_s16_le, convert_u16_be_to_s16_le_sse2);
+	replace_conv_in_place(swap_s16_byte_order, swap_s16_byte_order_sse2);
+	pcm_float_1ch_to_2ch = convert_float_1ch_to_float_2ch_sse2;
+	pcm_float_to_s16 = convert_float_to_s16_sse2;
+	pcm_float_to_s32 = convert_float_to_s32_sse2;
+	pcm_s32_to_float = convert_s32_to_float_sse2;
+	pcm_s24_32_to_s32 = convert_s24_32_to_s32_sse2;
+	pcm_interleave_16 = interleave_16_sse2;
+	pcm_interleave_32 = interleave_32_sse2;
+	pcm_deinterleave_32 = deinterleave_32_sse2;
+	pcm_impl = "sse2";
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		replace_conv_in_place(convert_u16_le_to_s16_le_sse2, convert_u16_le_to_s16_le_avx2);
+		replace_conv_in_place(swap_s16_byte_order_sse2, swap_s16_byte_order_avx2);
+		pcm_float_to_s16 = convert_float_to_s16_avx2;
+		pcm_float_to_s32 = convert_float_to_s32_avx2;
+		pcm_s32_to_float = convert_s32_to_float_avx2;
+		pcm_s24_32_to_s32 = convert_s24_32_to_s32_avx2;
+		pcm_impl = "avx2";
+	}
+#endif
+}
@@ -21,8 +21,47 @@
 
 typedef void (*pcm_conv_func)(void *dst, const void *src, int count);
 typedef void (*pcm_conv_in_place_func)(void *buf, int count);
+typedef void (*pcm_interleave_func)(void *dst, const void * const *src, int channels, int frames);
+typedef void (*pcm_deinterleave_func)(void * const *dst, const void *src, int channels, int frames);
 
+/*
+ * pcm_conv functions expand the samples.  ip_read() passes @src in the
+ * tail of @dst (src = dst + count * (scale - 1) bytes, scale being
+ * output/input size), so an implementation must load a block of input
+ * before storing the output for it.
+ */
 extern pcm_conv_func pcm_conv[8];
 extern pcm_conv_in_place_func pcm_conv_in_place[8];
 
+/*
+ * All functions below work on host endian samples, count is number of
+ * samples.  Conversions which don't grow the data can be done in place
+ * (@dst == @src).
+ */
+
+/* float mono to float stereo */
+extern pcm_conv_func pcm_float_1ch_to_2ch;
+
+/* float to s16 or s32 with clipping, and back */
+extern pcm_conv_func pcm_float_to_s16;
+extern pcm_conv_func pcm_float_to_s32;
+extern pcm_conv_func pcm_s32_to_float;
+
+/* 24-bit samples in the low bytes of 32-bit words to s32 */
+extern pcm_conv_in_place_func pcm_s24_32_to_s32;
+
+/* planar <-> interleaved, 16 or 32-bit (s32 and float) samples */
+extern pcm_interleave_func pcm_interleave_16;
+extern pcm_interleave_func pcm_interleave_32;
+extern pcm_deinterleave_func pcm_deinterleave_32;
+
+/* name of the selected implementation, e.g. "sse2" */
+extern const char *pcm_impl;
+
+/*
+ * Selects the fastest implementations for this CPU.  The generic versions
+ * are used until this is called.
+ */
+void pcm_init(void);
+
 #endif
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reports throughput of the pcm.c converters, generic versions against
+ * the ones pcm_init() selects for this CPU, and checks that both produce
+ * the same output.
+ *
+ * usage: pcm-bench [SECONDS_PER_TEST]
+ */
+
+#include "pcm.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/* samples per call, about what ip_read() converts at once */
+#define NR_SAMPLES 4096
+
+enum kind {
+	CONV,
+	IN_PLACE,
+	INTERLEAVE,
+	DEINTERLEAVE
+};
+
+struct kernel {
+	const char *name;
+	enum kind kind;
+	/* bytes per input and output sample */
+	int in_size;
+	int out_size;
+	/* inputs are floats in [-1, 1] */
+	int is_float;
+	void *generic;
+	void *best;
+};
+
+static struct kernel kernels[32];
+static int nr_kernels;
+
+static unsigned char in_buf[NR_SAMPLES * 4] __attribute__((aligned(64)));
+static unsigned char out_buf[2][NR_SAMPLES * 8] __attribute__((aligned(64)));
+static unsigned char planar[2][2][NR_SAMPLES * 2] __attribute__((aligned(64)));
+
+static void add(const char *name, enum kind kind, int in_size, int out_size,
+		int is_float, void *generic)
+{
+	struct kernel *k = &kernels[nr_kernels++];
+
+	k->name = name;
+	k->kind = kind;
+	k->in_size = in_size;
+	k->out_size = out_size;
+	k->is_float = is_float;
+	k->generic = generic;
+}
+
+static void fill_input(const struct kernel *k)
+{
+	int i;
+
+	if (k->is_float) {
+		float *f = (float *)in_buf;
+
+		/* slightly out of range to exercise clipping */
+		for (i = 0; i < NR_SAMPLES; i++)
+			f[i] = (rand() / (float)RAND_MAX) * 2.2f - 1.1f;
+	} else {
+		for (i = 0; i < sizeof(in_buf); i++)
+			in_buf[i] = rand();
+	}
+}
+
+/* runs @fn once, output goes to out_buf[@which] */
+static void run(const struct kernel *k, void *fn, int which)
+{
+	unsigned char *out = out_buf[which];
+
+	switch (k->kind) {
+	case CONV:
+		((pcm_conv_func)fn)(out, in_buf, NR_SAMPLES);
+		break;
+	case IN_PLACE:
+		memcpy(out, in_buf, NR_SAMPLES * k->in_size);
+		((pcm_conv_in_place_func)fn)(out, NR_SAMPLES);
+		break;
+	case INTERLEAVE:
+	{
+		const void *src[2] = { in_buf, in_buf + NR_SAMPLES / 2 * k->in_size };
+
+		((pcm_interleave_func)fn)(out, src, 2, NR_SAMPLES / 2);
+		break;
+	}
+	case DEINTERLEAVE:
+	{
+		void * const dst[2] = { planar[which][0], planar[which][1] };
+
+		((pcm_deinterleave_func)fn)(dst, in_buf, 2, NR_SAMPLES / 2);
+		memcpy(out, planar[which][0], NR_SAMPLES / 2 * k->out_size);
+		memcpy(out + NR_SAMPLES / 2 * k->out_size, planar[which][1],
+				NR_SAMPLES / 2 * k->out_size);
+		break;
+	}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns input megabytes per second */
+static double measure(const struct kernel *k, void *fn, double seconds)
+{
+	double start = now(), elapsed;
+	long calls = 0;
+
+	do {
+		int i;
+
+		for (i = 0; i < 64; i++)
+			run(k, fn, 0);
+		calls += 64;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+	return calls * (double)NR_SAMPLES * k->in_size / elapsed / 1e6;
+}
+
+static const char *check(const struct kernel *k)
+{
+	int size = NR_SAMPLES * k->out_size;
+
+	if (k->best == k->generic)
+		return "";
+	run(k, k->generic, 0);
+	run(k, k->best, 1);
+	if (memcmp(out_buf[0], out_buf[1], size) == 0)
+		return "";
+	if (k->is_float && k->out_size == 4) {
+		const int32_t *a = (const int32_t *)out_buf[0];
+		const int32_t *b = (const int32_t *)out_buf[1];
+		int i;
+
+		/* rounding of float -> s32 may differ by one step of 2^7 */
+		for (i = 0; i < NR_SAMPLES; i++) {
+			if (a[i] - (int64_t)b[i] > 128 || b[i] - (int64_t)a[i] > 128)
+				return "  MISMATCH";
+		}
+		return "";
+	}
+	return "  MISMATCH";
+}
+
+int main(int argc, char *argv[])
+{
+	double seconds = 0.2;
+	int i, rc = 0;
+
+	if (argc > 1)
+		seconds = atof(argv[1]);
+
+	add("u8 mono -> s16 stereo", CONV, 1, 4, 0, pcm_conv[0]);
+	add("u8 stereo -> s16 stereo", CONV, 1, 2, 0, pcm_conv[1]);
+	add("s8 mono -> s16 stereo", CONV, 1, 4, 0, pcm_conv[2]);
+	add("s8 stereo -> s16 stereo", CONV, 1, 2, 0, pcm_conv[3]);
+	add("16 mono -> 16 stereo", CONV, 2, 4, 0, pcm_conv[4]);
+	add("u16 le -> s16 le", IN_PLACE, 2, 2, 0, pcm_conv_in_place[4]);
+	add("u16 be -> s16 le", IN_PLACE, 2, 2, 0, pcm_conv_in_place[5]);
+#ifdef WORDS_BIGENDIAN
+	add("s16 byte swap", IN_PLACE, 2, 2, 0, pcm_conv_in_place[6]);
+#else
+	add("s16 byte swap", IN_PLACE, 2, 2, 0, pcm_conv_in_place[7]);
+#endif
+	add("float mono -> float stereo", CONV, 4, 8, 1, pcm_float_1ch_to_2ch);
+	add("float -> s16", CONV, 4, 2, 1, pcm_float_to_s16);
+	add("float -> s32", CONV, 4, 4, 1, pcm_float_to_s32);
+	add("s32 -> float", CONV, 4, 4, 0, pcm_s32_to_float);
+	add("s24 in 32 -> s32", IN_PLACE, 4, 4, 0, pcm_s24_32_to_s32);
+	add("interleave 16", INTERLEAVE, 2, 2, 0, pcm_interleave_16);
+	add("interleave 32", INTERLEAVE, 4, 4, 0, pcm_interleave_32);
+	add("deinterleave 32", DEINTERLEAVE, 4, 4, 0, pcm_deinterleave_32);
+
+	pcm_init();
+
+	kernels[0].best = pcm_conv[0];
+	kernels[1].best = pcm_conv[1];
+	kernels[2].best = pcm_conv[2];
+	kernels[3].best = pcm_conv[3];
+	kernels[4].best = pcm_conv[4];
+	kernels[5].best = pcm_conv_in_place[4];
+	kernels[6].best = pcm_conv_in_place[5];
+#ifdef WORDS_BIGENDIAN
+	kernels[7].best = pcm_conv_in_place[6];
+#else
+	kernels[7].best = pcm_conv_in_place[7];
+#endif
+	kernels[8].best = pcm_float_1ch_to_2ch;
+	kernels[9].best = pcm_float_to_s16;
+	kernels[10].best = pcm_float_to_s32;
+	kernels[11].best = pcm_s32_to_float;
+	kernels[12].best = pcm_s24_32_to_s32;
+	kernels[13].best = pcm_interleave_16;
+	kernels[14].best = pcm_interleave_32;
+	kernels[15].best = pcm_deinterleave_32;
+
+	printf("%d samples per call, input MB/s, implementation: %s\n\n",
+			NR_SAMPLES, pcm_impl);
+	printf("%-28s %10s %10s %8s\n", "converter", "generic", pcm_impl, "speedup");
+	for (i = 0; i < nr_kernels; i++) {
+		const struct kernel *k = &kernels[i];
+		const char *err;
+		double g, b;
+
+		fill_input(k);
+		err = check(k);
+		if (*err)
+			rc = 1;
+		g = measure(k, k->generic, seconds);
+		b = k->best == k->generic ? g : measure(k, k->best, seconds);
+		printf("%-28s %10.0f %10.0f %7.2fx%s\n", k->name, g, b, b / g, err);
+	}
+	return rc;
+}
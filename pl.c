@@ -697,6 +697,36 @@ struct track_info *pl_goto_next(void)
 	return pl_goto_generic(pl_get_next_shuffled, pl_get_next);
 }
 
+int pl_peek_next(struct track_info **tis, int max)
+{
+	struct simple_track *cur = pl_playing_track;
+	int saved_auto_reshuffle = auto_reshuffle;
+	int saved_repeat = repeat;
+	int n = 0;
+
+	if (!cur)
+		return 0;
+
+	/* the order after a reshuffle can't be known yet, stop at the wrap */
+	if (shuffle && auto_reshuffle)
+		repeat = 0;
+	auto_reshuffle = 0;
+	while (n < max) {
+		if (shuffle)
+			cur = pl_get_next_shuffled(pl_playing, cur);
+		else
+			cur = pl_get_next(pl_playing, cur);
+		if (!cur || cur == pl_playing_track)
+			break;
+		tis[n] = cur->info;
+		track_info_ref(tis[n]);
+		n++;
+	}
+	auto_reshuffle = saved_auto_reshuffle;
+	repeat = saved_repeat;
+	return n;
+}
+
 struct track_info *pl_goto_prev(void)
 {
 	return pl_goto_generic(pl_get_prev_shuffled, pl_get_prev);
@@ -53,6 +53,8 @@ void pl_get_sort_str(char *buf, size_t size);
 void pl_set_sort_str(const char *buf);
 void pl_clear(void);
 struct track_info *pl_goto_next(void);
+/* like lib_peek_next() */
+int pl_peek_next(struct track_info **tis, int max);
 struct track_info *pl_goto_prev(void);
 struct track_info *pl_play_selected_row(void);
 void pl_select_playing_track(void);
@@ -31,6 +31,10 @@
 #include "cmus.h"
 #include "lib.h"
 #include "pl_env.h"
+#include "resample.h"
+#include "pcm.h"
+#include "stats.h"
+#include "rt.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +42,7 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <stdarg.h>
 #include <math.h>
 
@@ -77,6 +82,19 @@ static struct player_info player_info_priv = {
 	.buffer_fill_changed = 0,
 };
 
+char *rt_consumer_cpus;
+char *rt_producer_cpus;
+int rt_lock_memory;
+int rt_policy = RT_POLICY_OTHER;
+int rt_priority = 50;
+
+/*
+ * The consumer runs on a stack of its own so that the whole stack can be
+ * locked into RAM.  Output plugins run in this thread, be generous.  A
+ * PROT_NONE page below it turns an overflow into SIGSEGV.
+ */
+#define CONSUMER_STACK_SIZE (1024 * 1024)
+
 /* continue playing after track is finished? */
 int player_cont = 1;
 
@@ -94,9 +112,27 @@ int soft_vol;
 int soft_vol_l;
 int soft_vol_r;
 
+/* 0 = use the sample rate of the track */
+int resample_rate;
+int resample_quality = RESAMPLE_QUALITY_MEDIUM;
+
 static sample_format_t buffer_sf;
 static CHANNEL_MAP(buffer_channel_map);
 
+/* converts ip_read output to the rate of buffer_sf, NULL if not needed
+ * protected by producer_mutex
+ */
+static struct resampler *resampler;
+/* resampler tail was returned, report EOF on the next read */
+static int resample_drained;
+static char *resample_in;
+#define RESAMPLE_IN_SIZE CHUNK_SIZE
+
+/* float samples are converted to s16 for outputs which don't accept float
+ * protected by producer_mutex
+ */
+static int float_to_s16;
+
 static pthread_t producer_thread;
 static pthread_mutex_t producer_mutex = CMUS_MUTEX_INITIALIZER;
 static pthread_cond_t producer_playing = CMUS_COND_INITIALIZER;
@@ -105,12 +141,23 @@ static enum producer_status producer_status = PS_UNLOADED;
 static struct input_plugin *ip = NULL;
 
 static pthread_t consumer_thread;
+static void *consumer_stack;
+static char *consumer_stack_map;
+static size_t consumer_guard_size;
 static pthread_mutex_t consumer_mutex = CMUS_MUTEX_INITIALIZER;
 static pthread_cond_t consumer_playing = CMUS_COND_INITIALIZER;
 static int consumer_running = 1;
 static enum consumer_status consumer_status = CS_STOPPED;
 static unsigned long consumer_pos = 0;
 
+/* consumer found the buffer empty, counted once until data arrives */
+static int consumer_underrun;
+
+/* us_now() of the last seek until its first sample is written, or 0
+ * protected by consumer_mutex
+ */
+static uint64_t seek_time;
+
 /* for replay gain and soft vol
  * usually same as consumer_pos, sometimes more than consumer_pos
  */
@@ -145,23 +192,107 @@ static double replaygain_scale = 1.0;
 static void reset_buffer(void)
 {
 	buffer_reset();
+	if (resampler)
+		resample_reset(resampler);
+	resample_drained = 0;
 	consumer_pos = 0;
 	scale_pos = 0;
 	pthread_cond_broadcast(&producer_playing);
 }
 
+static void set_resampler(sample_format_t sf)
+{
+	if (!resample_rate || sf_get_rate(sf) == resample_rate || !resample_supported(sf)) {
+		if (resampler) {
+			resample_free(resampler);
+			resampler = NULL;
+		}
+		return;
+	}
+
+	if (resampler && resample_matches(resampler, sf, resample_rate, resample_quality))
+		return;
+	if (resampler)
+		resample_free(resampler);
+	resampler = resample_new(sf, resample_rate, resample_quality);
+}
+
 static void set_buffer_sf(void)
 {
 	buffer_sf = ip_get_sf(ip);
 	ip_get_channel_map(ip, buffer_channel_map);
 
 	/* ip_read converts samples to this format */
-	if (sf_get_channels(buffer_sf) <= 2 && sf_get_bits(buffer_sf) <= 16) {
+	if (sf_get_float(buffer_sf)) {
+		if (sf_get_channels(buffer_sf) == 1) {
+			buffer_sf &= ~SF_CHANNELS_MASK;
+			buffer_sf |= sf_channels(2);
+			channel_map_init_stereo(buffer_channel_map);
+		}
+	} else if (sf_get_channels(buffer_sf) <= 2 && sf_get_bits(buffer_sf) <= 16) {
 		buffer_sf &= SF_RATE_MASK;
 		buffer_sf |= sf_channels(2) | sf_bits(16) | sf_signed(1);
 		buffer_sf |= sf_host_endian();
 		channel_map_init_stereo(buffer_channel_map);
 	}
+
+	/* keep the output device at resample_rate */
+	set_resampler(buffer_sf);
+	if (resampler) {
+		buffer_sf &= ~SF_RATE_MASK;
+		buffer_sf |= sf_rate(resample_rate);
+	}
+
+	float_to_s16 = sf_get_float(buffer_sf) && !op_supports_float();
+	if (float_to_s16) {
+		buffer_sf &= SF_RATE_MASK | SF_CHANNELS_MASK;
+		buffer_sf |= sf_bits(16) | sf_signed(1) | sf_host_endian();
+	}
+}
+
+static int convert_float(char *buffer, int size)
+{
+	if (float_to_s16) {
+		pcm_float_to_s16(buffer, buffer, size / sizeof(float));
+		size /= 2;
+	}
+	return size;
+}
+
+/*
+ * ip_read() followed by sample rate and float conversion if needed
+ */
+static int producer_read(char *buffer, int count)
+{
+	int in_size, nr_read, size;
+
+	if (!resampler) {
+		size = ip_read(ip, buffer, count);
+		if (size > 0)
+			size = convert_float(buffer, size);
+		return size;
+	}
+
+	if (resample_drained)
+		return 0;
+
+	do {
+		in_size = resample_in_size(resampler, count, RESAMPLE_IN_SIZE);
+		nr_read = 0;
+		if (in_size > 0) {
+			nr_read = ip_read(ip, resample_in, in_size);
+			if (nr_read < 0)
+				return nr_read;
+			if (nr_read == 0) {
+				/* EOF, return the tail now and 0 on the next call */
+				size = resample_drain(resampler, buffer, count);
+				resample_drained = 1;
+				return convert_float(buffer, size);
+			}
+		}
+		size = resample_process(resampler, resample_in, nr_read, buffer, count);
+	} while (size == 0);
+	return convert_float(buffer, size);
 }
 
 #define SOFT_VOL_SCALE 65536
@@ -185,9 +316,10 @@ static const unsigned short soft_vol_db[100] = {
 	0xcdf1, 0xd71a, 0xe59c, 0xefd3
 };
 
-static inline void scale_sample_int16_t(int16_t *buf, int i, int vol, int swap)
+static inline void scale_sample_int16_t(int16_t *dst, const int16_t *src, int i,
+		int vol, int swap)
 {
-	int32_t sample = swap ? (int16_t)swap_uint16(buf[i]) : buf[i];
+	int32_t sample = swap ? (int16_t)swap_uint16(src[i]) : src[i];
 
 	if (sample < 0) {
 		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
@@ -198,7 +330,7 @@ static inline void scale_sample_int16_t(int16_t *buf, int i, int vol, int swap)
 		if (sample > INT16_MAX)
 			sample = INT16_MAX;
 	}
-	buf[i] = swap ? swap_uint16(sample) : sample;
+	dst[i] = swap ? swap_uint16(sample) : sample;
 }
 
 static inline int32_t scale_sample_s24le(int32_t s, int vol)
@@ -216,9 +348,10 @@ static inline int32_t scale_sample_s24le(int32_t s, int vol)
 	return sample;
 }
 
-static inline void scale_sample_int32_t(int32_t *buf, int i, int vol, int swap)
+static inline void scale_sample_int32_t(int32_t *dst, const int32_t *src, int i,
+		int vol, int swap)
 {
-	int64_t sample = swap ? (int32_t)swap_uint32(buf[i]) : buf[i];
+	int64_t sample = swap ? (int32_t)swap_uint32(src[i]) : src[i];
 
 	if (sample < 0) {
 		sample = (sample * vol - SOFT_VOL_SCALE / 2) / SOFT_VOL_SCALE;
@@ -229,7 +362,7 @@ static inline void scale_sample_int32_t(int32_t *buf, int i, int vol, int swap)
 		if (sample > INT32_MAX)
 			sample = INT32_MAX;
 	}
-	buf[i] = swap ? swap_uint32(sample) : sample;
+	dst[i] = swap ? swap_uint32(sample) : sample;
 }
 
 static inline int sf_need_swap(sample_format_t sf)
@@ -241,23 +374,31 @@ static inline int sf_need_swap(sample_format_t sf)
 #endif
 }
 
-#define SCALE_SAMPLES(TYPE, buffer, count, l, r, swap)				\
+/* dst may be src, the unscaled channel is copied as is */
+#define SCALE_SAMPLES(TYPE, dst, src, count, l, r, swap)			\
 {										\
 	const int frames = count / sizeof(TYPE) / 2;				\
-	TYPE *buf = (void *) buffer;						\
+	TYPE *d = (void *) dst;							\
+	const TYPE *s = (const void *) src;					\
 	int i;									\
 	/* avoid underflowing -32768 to 32767 when scale is 65536 */		\
 	if (l != SOFT_VOL_SCALE && r != SOFT_VOL_SCALE) {			\
 		for (i = 0; i < frames; i++) {					\
-			scale_sample_##TYPE(buf, i * 2, l, swap);		\
-			scale_sample_##TYPE(buf, i * 2 + 1, r, swap);		\
+			scale_sample_##TYPE(d, s, i * 2, l, swap);		\
+			scale_sample_##TYPE(d, s, i * 2 + 1, r, swap);		\
 		}								\
 	} else if (l != SOFT_VOL_SCALE) {					\
-		for (i = 0; i < frames; i++)					\
-			scale_sample_##TYPE(buf, i * 2, l, swap);		\
+		for (i = 0; i < frames; i++) {					\
+			scale_sample_##TYPE(d, s, i * 2, l, swap);		\
+			d[i * 2 + 1] = s[i * 2 + 1];				\
+		}								\
 	} else if (r != SOFT_VOL_SCALE) {					\
-		for (i = 0; i < frames; i++)					\
-			scale_sample_##TYPE(buf, i * 2 + 1, r, swap);		\
+		for (i = 0; i < frames; i++) {					\
+			d[i * 2] = s[i * 2];					\
+			scale_sample_##TYPE(d, s, i * 2 + 1, r, swap);		\
+		}								\
+	} else if (d != s) {							\
+		memcpy(d, s, frames * 2 * sizeof(TYPE));			\
 	}									\
 }
 
@@ -275,54 +416,48 @@ static inline void write_s24le(char *buf, int32_t x)
 	b[2] = x >> 16;
 }
 
-static void scale_samples_s24le(char *buf, unsigned int count, int l, int r)
+static void scale_samples_s24le(char *dst, const char *src, unsigned int count,
+		int l, int r)
 {
 	int frames = count / 3 / 2;
-	if (l != SOFT_VOL_SCALE && r != SOFT_VOL_SCALE) {
-		while (frames--) {
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), l));
-			buf += 3;
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), r));
-			buf += 3;
-		}
-	} else if (l != SOFT_VOL_SCALE) {
-		while (frames--) {
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), l));
-			buf += 3 * 2;
-		}
-	} else if (r != SOFT_VOL_SCALE) {
-		buf += 3;
-		while (frames--) {
-			write_s24le(buf, scale_sample_s24le(read_s24le(buf), r));
-			buf += 3 * 2;
-		}
+
+	while (frames--) {
+		write_s24le(dst, scale_sample_s24le(read_s24le(src), l));
+		write_s24le(dst + 3, scale_sample_s24le(read_s24le(src + 3), r));
+		dst += 3 * 2;
+		src += 3 * 2;
 	}
 }
 
-static void scale_samples(char *buffer, unsigned int *countp)
+/* float has enough headroom, no clipping needed */
+static void scale_samples_float(char *dst, const char *src, unsigned int count,
+		int l, int r)
 {
-	unsigned int count = *countp;
-	int ch, bits, l, r;
-
-	BUG_ON(scale_pos < consumer_pos);
-
-	if (consumer_pos != scale_pos) {
-		unsigned int offs = scale_pos - consumer_pos;
-
-		if (offs >= count)
-			return;
-		buffer += offs;
-		count -= offs;
+	const int frames = count / sizeof(float) / 2;
+	const float fl = (float)l / SOFT_VOL_SCALE;
+	const float fr = (float)r / SOFT_VOL_SCALE;
+	const float *s = (const void *) src;
+	float *d = (void *) dst;
+	int i;
+
+	for (i = 0; i < frames; i++) {
+		d[i * 2] = s[i * 2] * fl;
+		d[i * 2 + 1] = s[i * 2 + 1] * fr;
 	}
-	scale_pos += count;
+}
+
+/* returns 0 if the samples must be copied as they are */
+static int scale_copy(char *dst, const char *src, unsigned int count)
+{
+	int ch, bits, l, r;
 
 	if (replaygain_scale == 1.0 && soft_vol_l == 100 && soft_vol_r == 100)
-		return;
+		return 0;
 
 	ch = sf_get_channels(buffer_sf);
 	bits = sf_get_bits(buffer_sf);
 	if (ch != 2 || (bits != 16 && bits != 24 && bits != 32))
-		return;
+		return 0;
 
 	l = SOFT_VOL_SCALE;
 	r = SOFT_VOL_SCALE;
@@ -336,16 +471,60 @@ static void scale_samples(char *buffer, unsigned int *countp)
 
 	switch (bits) {
 	case 16:
-		SCALE_SAMPLES(int16_t, buffer, count, l, r, sf_need_swap(buffer_sf));
+		SCALE_SAMPLES(int16_t, dst, src, count, l, r, sf_need_swap(buffer_sf));
 		break;
 	case 24:
-		if (likely(!sf_get_bigendian(buffer_sf)))
-			scale_samples_s24le(buffer, count, l, r);
+		if (unlikely(sf_get_bigendian(buffer_sf)))
+			return 0;
+		scale_samples_s24le(dst, src, count, l, r);
 		break;
 	case 32:
-		SCALE_SAMPLES(int32_t, buffer, count, l, r, sf_need_swap(buffer_sf));
+		if (sf_get_float(buffer_sf))
+			scale_samples_float(dst, src, count, l, r);
+		else
+			SCALE_SAMPLES(int32_t, dst, src, count, l, r, sf_need_swap(buffer_sf));
 		break;
 	}
+	return 1;
+}
+
+/*
+ * Scales the player buffer in place for op_write().  scale_pos remembers
+ * what was scaled already in case the plugin took only part of it.
+ */
+static void scale_samples(char *buffer, unsigned int *countp)
+{
+	unsigned int count = *countp;
+
+	/* the mmap path leaves the buffer alone, see scale_samples_copy() */
+	if (scale_pos < consumer_pos)
+		scale_pos = consumer_pos;
+
+	if (consumer_pos != scale_pos) {
+		unsigned int offs = scale_pos - consumer_pos;
+
+		if (offs >= count)
+			return;
+		buffer += offs;
+		count -= offs;
+	}
+	scale_pos += count;
+
+	scale_copy(buffer, buffer, count);
+}
+
+/* scales while copying into the device buffer, one pass over the samples */
+static void scale_samples_copy(char *dst, const char *src, unsigned int count)
+{
+	unsigned int done = 0;
+
+	/* scaled in place before the plugin switched to mmap */
+	if (scale_pos > consumer_pos) {
+		done = min_u(scale_pos - consumer_pos, count);
+		memcpy(dst, src, done);
+	}
+	if (!scale_copy(dst + done, src + done, count - done))
+		memcpy(dst + done, src + done, count - done);
 }
 
 static void update_rg_scale(void)
@@ -408,6 +587,149 @@ static inline unsigned int buffer_second_size(void)
 	return sf_get_second_size(buffer_sf);
 }
 
+/* adaptive buffer target {{{ */
+
+enum buffer_source {
+	BUFFER_SOURCE_LOCAL,
+	BUFFER_SOURCE_REMOTE,
+	BUFFER_SOURCE_CDDA,
+	NR_BUFFER_SOURCES
+};
+
+/*
+ * How much of the buffer the producer fills when buffer_adaptive is set,
+ * in milliseconds of audio, per kind of source.  The target starts at
+ * start_ms, grows by half after an underrun or a producer stall and
+ * shrinks by an eighth after a minute without either, but stays between
+ * min_ms and buffer_seconds.  It is remembered across tracks.
+ *
+ * protected by producer_mutex
+ */
+struct buffer_policy {
+	const char *name;
+	int min_ms;
+	int start_ms;
+
+	int ms;
+	unsigned int underruns;
+	unsigned int stalls;
+};
+
+static struct buffer_policy buffer_policies[NR_BUFFER_SOURCES] = {
+	[BUFFER_SOURCE_LOCAL]	= { "local", 500, 2000 },
+	[BUFFER_SOURCE_REMOTE]	= { "remote", 2000, 10000 },
+	/* spin-up and read retries take seconds */
+	[BUFFER_SOURCE_CDDA]	= { "cdda", 1000, 5000 },
+};
+
+#define BUFFER_GROW_INTERVAL_MS		1000
+#define BUFFER_SHRINK_INTERVAL_MS	60000
+
+int buffer_adaptive;
+
+static struct buffer_policy *buffer_policy = &buffer_policies[BUFFER_SOURCE_LOCAL];
+
+/* ms_now() when the target was last changed */
+static uint64_t buffer_policy_time;
+
+static int buffer_capacity_ms(void)
+{
+	return (uint64_t)buffer_nr_chunks * CHUNK_SIZE * 1000 / buffer_second_size();
+}
+
+static int buffer_filled_ms(void)
+{
+	return (uint64_t)buffer_get_filled_chunks() * CHUNK_SIZE * 1000 / buffer_second_size();
+}
+
+static void _buffer_target_apply(void)
+{
+	unsigned int chunks;
+
+	if (!buffer_adaptive || !buffer_second_size()) {
+		buffer_set_target(0);
+		return;
+	}
+
+	chunks = ((uint64_t)buffer_policy->ms * buffer_second_size() / 1000 +
+			CHUNK_SIZE - 1) / CHUNK_SIZE;
+	buffer_set_target(chunks ? chunks : 1);
+}
+
+/* call after set_buffer_sf() */
+static void _buffer_policy_select(void)
+{
+	enum buffer_source source = BUFFER_SOURCE_LOCAL;
+
+	if (is_cdda_url(ip_get_filename(ip))) {
+		source = BUFFER_SOURCE_CDDA;
+	} else if (ip_is_remote(ip)) {
+		source = BUFFER_SOURCE_REMOTE;
+	}
+	buffer_policy = &buffer_policies[source];
+	if (!buffer_policy->ms)
+		buffer_policy->ms = buffer_policy->start_ms;
+	buffer_policy_time = ms_now();
+	_buffer_target_apply();
+}
+
+static void _buffer_policy_set(int ms, const char *reason)
+{
+	int max_ms = buffer_capacity_ms();
+
+	if (ms > max_ms)
+		ms = max_ms;
+	if (ms < buffer_policy->min_ms)
+		ms = buffer_policy->min_ms;
+	buffer_policy_time = ms_now();
+	if (ms == buffer_policy->ms)
+		return;
+
+	buffer_policy->ms = ms;
+	d_print("%s: %s target %d ms (underruns %u, stalls %u)\n", reason,
+			buffer_policy->name, ms, buffer_policy->underruns,
+			buffer_policy->stalls);
+	_buffer_target_apply();
+}
+
+/*
+ * One starved stretch is usually noticed many times in a row, so grow at
+ * most once per BUFFER_GROW_INTERVAL_MS.  This also ignores the first
+ * second of a track.
+ */
+static void _buffer_grow(const char *reason)
+{
+	if (ms_now() - buffer_policy_time < BUFFER_GROW_INTERVAL_MS)
+		return;
+	_buffer_policy_set(buffer_policy->ms + buffer_policy->ms / 2, reason);
+}
+
+/* consumer found the buffer empty before EOF */
+static void _buffer_underrun(void)
+{
+	if (!buffer_adaptive || !buffer_second_size())
+		return;
+	buffer_policy->underruns++;
+	_buffer_grow("underrun");
+}
+
+/* producer_read() took @ms milliseconds */
+static void _buffer_read_time(unsigned int ms)
+{
+	if (!buffer_adaptive || !buffer_second_size())
+		return;
+
+	/* blocked long enough to use up half of what was buffered */
+	if (ms > 100 && ms * 2 > buffer_filled_ms()) {
+		buffer_policy->stalls++;
+		_buffer_grow("producer stall");
+	} else if (ms_now() - buffer_policy_time >= BUFFER_SHRINK_INTERVAL_MS) {
+		_buffer_policy_set(buffer_policy->ms - buffer_policy->ms / 8, "calm");
+	}
+}
+
+/* adaptive buffer target }}} */
+
 /* updating player status {{{ */
 
 static inline void _file_changed(struct track_info *ti)
@@ -462,7 +784,7 @@ static void player_error(const char *msg)
 	player_info_priv.pos = 0;
 	player_info_priv.current_bitrate = -1;
 	player_info_priv.buffer_fill = buffer_get_filled_chunks();
-	player_info_priv.buffer_size = buffer_nr_chunks;
+	player_info_priv.buffer_size = buffer_get_target();
 	player_info_priv.status_changed = 1;
 
 	free(player_info_priv.error_msg);
@@ -523,6 +845,18 @@ static void _producer_buffer_fill_update(void)
 	player_info_priv_unlock();
 }
 
+/* consumer_pos minus what the output plugin hasn't played yet */
+static unsigned long _consumer_audible_pos(void)
+{
+	int latency = op_latency();
+
+	if (latency <= 0)
+		return consumer_pos;
+	if (latency > consumer_pos)
+		return 0;
+	return consumer_pos - latency;
+}
+
 /*
  * playing position changed
  */
@@ -533,7 +867,7 @@ static void _consumer_position_update(void)
 	long bitrate;
 
 	if (consumer_status == CS_PLAYING || consumer_status == CS_PAUSED)
-		pos = consumer_pos / buffer_second_size();
+		pos = _consumer_audible_pos() / buffer_second_size();
 	if (pos != old_pos) {
 		old_pos = pos;
 
@@ -559,14 +893,14 @@ static void _player_status_changed(void)
 
 /* 	d_print("\n"); */
 	if (consumer_status == CS_PLAYING || consumer_status == CS_PAUSED)
-		pos = consumer_pos / buffer_second_size();
+		pos = _consumer_audible_pos() / buffer_second_size();
 
 	player_info_priv_lock();
 	player_info_priv.status = (enum player_status)consumer_status;
 	player_info_priv.pos = pos;
 	player_info_priv.current_bitrate = -1;
 	player_info_priv.buffer_fill = buffer_get_filled_chunks();
-	player_info_priv.buffer_size = buffer_nr_chunks;
+	player_info_priv.buffer_size = buffer_get_target();
 	player_info_priv.status_changed = 1;
 	player_info_priv_unlock();
 }
@@ -579,7 +913,7 @@ static void _prebuffer(void)
 
 	BUG_ON(producer_status != PS_PLAYING);
 	if (ip_is_remote(ip)) {
-		limit_chunks = buffer_nr_chunks;
+		limit_chunks = buffer_get_target();
 	} else {
 		int limit_ms, limit_size;
 
@@ -603,7 +937,7 @@ static void _prebuffer(void)
 			break;
 
 		size = buffer_get_wpos(&wpos);
-		nr_read = ip_read(ip, wpos, size);
+		nr_read = producer_read(wpos, size);
 		if (nr_read < 0) {
 			if (nr_read == -1 && errno == EAGAIN)
 				continue;
@@ -643,6 +977,8 @@ static void _producer_play(void)
 
 			ip = ip_new(ti->filename);
 			rc = ip_open(ip);
+			/* a cue track took the parked decoder or doesn't need it */
+			ip_drop_parked();
 			if (rc) {
 				player_ip_error(rc, "opening file `%s'", ti->filename);
 				ip_delete(ip);
@@ -662,6 +998,7 @@ static void _producer_play(void)
 		int rc;
 
 		rc = ip_open(ip);
+		ip_drop_parked();
 		if (rc) {
 			int var_len;
 			const char *fn = ip_get_filename(ip), *var;
@@ -733,6 +1070,7 @@ static void _consumer_play(void)
 		int rc;
 
 		set_buffer_sf();
+		_buffer_policy_select();
 		rc = op_open(buffer_sf, buffer_channel_map);
 		if (rc) {
 			player_op_error(rc, "opening audio device");
@@ -751,6 +1089,7 @@ static void _consumer_drain_and_stop(void)
 		op_close();
 		_consumer_status_update(CS_STOPPED);
 	}
+	ip_drop_parked();
 }
 
 static void _consumer_stop(void)
@@ -760,6 +1099,7 @@ static void _consumer_stop(void)
 		op_close();
 		_consumer_status_update(CS_STOPPED);
 	}
+	ip_drop_parked();
 }
 
 static void _consumer_pause(void)
@@ -782,12 +1122,14 @@ static int change_sf(int drop)
 	channel_map_copy(old_channel_map, buffer_channel_map);
 
 	set_buffer_sf();
+	_buffer_policy_select();
 	if (buffer_sf != old_sf || !channel_map_equal(buffer_channel_map, old_channel_map, sf_get_channels(buffer_sf))) {
 		/* reopen */
 		int rc;
 
 		if (drop)
 			op_drop();
+		stats_format_change();
 		op_close();
 		rc = op_open(buffer_sf, buffer_channel_map);
 		if (rc) {
@@ -859,6 +1201,35 @@ static void _consumer_handle_eof(void)
 	_player_status_changed();
 }
 
+/*
+ * Scales while copying straight into the device buffer if the output
+ * plugin allows it, otherwise scales in place and the plugin copies
+ * (e.g. snd_pcm_writei()).  *@size is lowered to what fits contiguously
+ * in the device buffer.
+ */
+static int consumer_write(char *rpos, int *size)
+{
+	char *dst;
+	int rc;
+
+	rc = op_mmap_begin(&dst, size);
+	if (rc == -OP_ERROR_NOT_SUPPORTED) {
+		if (soft_vol || replaygain)
+			scale_samples(rpos, (unsigned int *)size);
+		return op_write(rpos, *size);
+	}
+	if (rc < 0)
+		return rc;
+	if (soft_vol || replaygain)
+		scale_samples_copy(dst, rpos, *size);
+	else
+		memcpy(dst, rpos, *size);
+	return op_mmap_commit(*size);
+}
+
+/* how long the consumer sleeps when the output buffer is full */
+#define CONSUMER_WAIT_MS 25
+
 static void *consumer_loop(void *arg)
 {
 	while (1) {
@@ -881,6 +1252,7 @@ static void *consumer_loop(void *arg)
 					space == -1 ? strerror(errno) : "");
 
 			/* try to reopen */
+			stats_output_reopen();
 			op_close();
 			_consumer_status_update(CS_STOPPED);
 			_consumer_play();
@@ -889,12 +1261,21 @@ static void *consumer_loop(void *arg)
 			continue;
 		}
 /* 		d_print("BS: %6d %3d\n", space, space * 1000 / (44100 * 2 * 2)); */
+		stats_buffer_fill(buffer_get_filled_chunks() * 100 / buffer_get_target());
 
 		while (1) {
 			if (space == 0) {
 				_consumer_position_update();
+				/*
+				 * don't block the main thread while the device
+				 * drains, the plugin ends the wait if it is
+				 * closed or dropped meanwhile and the state is
+				 * checked again after relocking
+				 */
 				consumer_unlock();
-				ms_sleep(25);
+				rc = op_wait(CONSUMER_WAIT_MS);
+				if (rc == -OP_ERROR_NOT_SUPPORTED)
+					ms_sleep(CONSUMER_WAIT_MS);
 				break;
 			}
 			size = buffer_get_rpos(&rpos);
@@ -917,10 +1298,14 @@ static void *consumer_loop(void *arg)
 						break;
 					} else {
 						/* possible underrun */
+						if (!consumer_underrun) {
+							consumer_underrun = 1;
+							stats_underrun();
+						}
+						_buffer_underrun();
 						producer_unlock();
 						_consumer_position_update();
 						consumer_unlock();
-/* 						d_print("possible underrun\n"); */
 						ms_sleep(10);
 						break;
 					}
@@ -931,14 +1316,13 @@ static void *consumer_loop(void *arg)
 			}
 			if (size > space)
 				size = space;
-			if (soft_vol || replaygain)
-				scale_samples(rpos, (unsigned int *)&size);
-			rc = op_write(rpos, size);
+			rc = consumer_write(rpos, &size);
 			if (rc < 0) {
 				d_print("op_write returned %d %s\n", rc,
 						rc == -1 ? strerror(errno) : "");
 
 				/* try to reopen */
+				stats_output_reopen();
 				op_close();
 				_consumer_status_update(CS_STOPPED);
 				_consumer_play();
@@ -946,6 +1330,13 @@ static void *consumer_loop(void *arg)
 				consumer_unlock();
 				break;
 			}
+			if (rc < size)
+				stats_short_write();
+			if (seek_time && rc > 0) {
+				stats_seek_latency(us_now() - seek_time);
+				seek_time = 0;
+			}
+			consumer_underrun = 0;
 			buffer_consume(rc);
 			consumer_pos += rc;
 			space -= rc;
@@ -956,6 +1347,9 @@ static void *consumer_loop(void *arg)
 	return NULL;
 }
 
+/* producer_read() taking longer than this is a stall */
+#define PRODUCER_STALL_US 100000
+
 static void *producer_loop(void *arg)
 {
 	while (1) {
@@ -979,6 +1373,8 @@ static void *producer_loop(void *arg)
 			continue;
 		}
 		for (i = 0; ; i++) {
+			uint64_t start, elapsed;
+
 			size = buffer_get_wpos(&wpos);
 			if (size == 0) {
 				/* buffer is full */
@@ -986,7 +1382,12 @@ static void *producer_loop(void *arg)
 				ms_sleep(50);
 				break;
 			}
-			nr_read = ip_read(ip, wpos, size);
+			start = us_now();
+			nr_read = producer_read(wpos, size);
+			elapsed = us_now() - start;
+			if (elapsed >= PRODUCER_STALL_US)
+				stats_producer_stall(elapsed);
+			_buffer_read_time(elapsed / 1000);
 			if (nr_read < 0) {
 				if (nr_read != -1 || errno != EAGAIN) {
 					player_ip_error(nr_read, "reading file %s",
@@ -1019,17 +1420,15 @@ static void *producer_loop(void *arg)
 		_producer_buffer_fill_update();
 	}
 	_producer_unload();
+	ip_drop_parked();
 	producer_unlock();
 	return NULL;
 }
 
 void player_init(void)
 {
-	int rc;
-#ifdef REALTIME_SCHEDULING
 	pthread_attr_t attr;
-#endif
-	pthread_attr_t *attrp = NULL;
+	int rc;
 
 	/*  1 s is 176400 B (0.168 MB)
 	 * 10 s is 1.68 MB
@@ -1037,33 +1436,31 @@ void player_init(void)
 	buffer_nr_chunks = 10 * 44100 * 16 / 8 * 2 / CHUNK_SIZE;
 	buffer_init();
 
-#ifdef REALTIME_SCHEDULING
+	pcm_init();
+	d_print("pcm conversion: %s\n", pcm_impl);
+	resample_in = xnew(char, RESAMPLE_IN_SIZE);
+
+	rt_consumer_cpus = xstrdup("");
+	rt_producer_cpus = xstrdup("");
+
+	consumer_guard_size = sysconf(_SC_PAGESIZE);
+	consumer_stack_map = mmap(NULL, consumer_guard_size + CONSUMER_STACK_SIZE,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	BUG_ON(consumer_stack_map == MAP_FAILED);
+	rc = mprotect(consumer_stack_map, consumer_guard_size, PROT_NONE);
+	BUG_ON(rc);
+	consumer_stack = consumer_stack_map + consumer_guard_size;
 	rc = pthread_attr_init(&attr);
 	BUG_ON(rc);
-	rc = pthread_attr_setschedpolicy(&attr, SCHED_RR);
-	if (rc) {
-		d_print("could not set real-time scheduling priority: %s\n", strerror(rc));
-	} else {
-		struct sched_param param;
-
-		d_print("using real-time scheduling\n");
-		param.sched_priority = sched_get_priority_max(SCHED_RR);
-		d_print("setting priority to %d\n", param.sched_priority);
-		rc = pthread_attr_setschedparam(&attr, &param);
-		BUG_ON(rc);
-		attrp = &attr;
-	}
-#endif
+	rc = pthread_attr_setstack(&attr, consumer_stack, CONSUMER_STACK_SIZE);
+	BUG_ON(rc);
 
 	rc = pthread_create(&producer_thread, NULL, producer_loop, NULL);
 	BUG_ON(rc);
 
-	rc = pthread_create(&consumer_thread, attrp, consumer_loop, NULL);
-	if (rc && attrp) {
-		d_print("could not create thread using real-time scheduling: %s\n", strerror(rc));
-		rc = pthread_create(&consumer_thread, NULL, consumer_loop, NULL);
-	}
+	rc = pthread_create(&consumer_thread, &attr, consumer_loop, NULL);
 	BUG_ON(rc);
+	pthread_attr_destroy(&attr);
 
 	/* update player_info_priv.cont etc. */
 	player_lock();
@@ -1087,6 +1484,12 @@ void player_exit(void)
 	rc = pthread_join(producer_thread, NULL);
 	BUG_ON(rc);
 	buffer_free();
+	if (rt_lock_memory)
+		rt_munlock(consumer_stack, CONSUMER_STACK_SIZE);
+	munmap(consumer_stack_map, consumer_guard_size + CONSUMER_STACK_SIZE);
+	if (resampler)
+		resample_free(resampler);
+	free(resample_in);
 }
 
 void player_stop(void)
@@ -1244,7 +1647,7 @@ void player_seek(double offset, int relative, int start_playing)
 		double pos, duration, new_pos;
 		int rc;
 
-		pos = (double)consumer_pos / (double)buffer_second_size();
+		pos = (double)_consumer_audible_pos() / (double)buffer_second_size();
 		duration = ip_duration(ip);
 		if (duration < 0) {
 			/* can't seek */
@@ -1286,6 +1689,7 @@ void player_seek(double offset, int relative, int start_playing)
 			}
 		}
 /* 		d_print("seeking %g/%g (%g from eof)\n", new_pos, duration, duration - new_pos); */
+		seek_time = us_now();
 		rc = ip_seek(ip, new_pos);
 		if (rc == 0) {
 			d_print("doing op_drop after seek\n");
@@ -1295,11 +1699,13 @@ void player_seek(double offset, int relative, int start_playing)
 			scale_pos = consumer_pos;
 			_consumer_position_update();
 			if (stopped && !start_playing) {
+				seek_time = 0;
 				_producer_pause();
 				_consumer_pause();
 				_player_status_changed();
 			}
 		} else {
+			seek_time = 0;
 			player_ip_error(rc, "seeking in file %s", ip_get_filename(ip));
 			d_print("error: ip_seek returned %d\n", rc);
 		}
@@ -1345,7 +1751,21 @@ void player_set_op(const char *name)
 	}
 
 	if (consumer_status == CS_PLAYING || consumer_status == CS_PAUSED) {
+		sample_format_t old_sf = buffer_sf;
+		unsigned int old_second_size = buffer_second_size();
+
 		set_buffer_sf();
+		_buffer_policy_select();
+		if (buffer_sf != old_sf) {
+			/* buffered samples are in the old format, drop them and
+			 * decode again from the current position if possible */
+			double pos = (double)consumer_pos / old_second_size;
+
+			ip_seek(ip, pos);
+			reset_buffer();
+			consumer_pos = pos * buffer_second_size();
+			scale_pos = consumer_pos;
+		}
 		rc = op_open(buffer_sf, buffer_channel_map);
 		if (rc) {
 			_consumer_status_update(CS_STOPPED);
@@ -1369,6 +1789,7 @@ void player_set_buffer_chunks(unsigned int nr_chunks)
 
 	buffer_nr_chunks = nr_chunks;
 	buffer_init();
+	_buffer_target_apply();
 
 	_player_status_changed();
 	player_unlock();
@@ -1379,6 +1800,66 @@ int player_get_buffer_chunks(void)
 	return buffer_nr_chunks;
 }
 
+void player_set_buffer_adaptive(int adaptive)
+{
+	player_lock();
+	buffer_adaptive = adaptive;
+	if (ip)
+		_buffer_policy_select();
+	else
+		_buffer_target_apply();
+	_player_status_changed();
+	player_unlock();
+}
+
+int player_set_rt_cpus(int consumer, const char *cpus)
+{
+	char **var = consumer ? &rt_consumer_cpus : &rt_producer_cpus;
+	int rc;
+
+	if (!rt_cpus_valid(cpus))
+		return EINVAL;
+	rc = rt_set_affinity(consumer ? consumer_thread : producer_thread, cpus);
+	if (rc == 0) {
+		free(*var);
+		*var = xstrdup(cpus);
+	}
+	return rc;
+}
+
+int player_set_rt_scheduling(int policy, int priority)
+{
+	int rc;
+
+	rc = rt_set_scheduling(consumer_thread, policy, priority);
+	if (rc == 0) {
+		rt_policy = policy;
+		rt_priority = priority;
+	}
+	return rc;
+}
+
+int player_set_rt_lock_memory(int lock)
+{
+	int rc;
+
+	player_lock();
+	rc = buffer_mlock(lock);
+	if (rc == 0) {
+		if (lock) {
+			rc = rt_mlock(consumer_stack, CONSUMER_STACK_SIZE);
+			if (rc)
+				buffer_mlock(0);
+		} else {
+			rt_munlock(consumer_stack, CONSUMER_STACK_SIZE);
+		}
+	}
+	if (rc == 0)
+		rt_lock_memory = lock;
+	player_unlock();
+	return rc;
+}
+
 void player_set_soft_volume(int l, int r)
 {
 	consumer_lock();
@@ -1465,6 +1946,21 @@ void player_set_rg_preamp(double db)
 	player_unlock();
 }
 
+void player_set_resample_rate(int rate)
+{
+	player_lock();
+	/* takes effect with the next track */
+	resample_rate = rate;
+	player_unlock();
+}
+
+void player_set_resample_quality(int quality)
+{
+	player_lock();
+	resample_quality = quality;
+	player_unlock();
+}
+
 void player_info_snapshot(void)
 {
 	player_info_priv_lock();
@@ -83,6 +83,14 @@ extern double replaygain_preamp;
 extern int soft_vol;
 extern int soft_vol_l;
 extern int soft_vol_r;
+extern int resample_rate;
+extern int resample_quality;
+extern int buffer_adaptive;
+extern char *rt_consumer_cpus;
+extern char *rt_producer_cpus;
+extern int rt_lock_memory;
+extern int rt_policy;
+extern int rt_priority;
 
 void player_init(void);
 void player_exit(void);
@@ -104,6 +112,7 @@ void player_seek(double offset, int relative, int start_playing);
 void player_set_op(const char *name);
 void player_set_buffer_chunks(unsigned int nr_chunks);
 int player_get_buffer_chunks(void);
+void player_set_buffer_adaptive(int adaptive);
 void player_info_snapshot(void);
 
 void player_set_soft_volume(int l, int r);
@@ -111,6 +120,13 @@ void player_set_soft_vol(int soft);
 void player_set_rg(enum replaygain rg);
 void player_set_rg_limit(int limit);
 void player_set_rg_preamp(double db);
+void player_set_resample_rate(int rate);
+void player_set_resample_quality(int quality);
+
+/* real-time settings, return 0 or an errno value */
+int player_set_rt_cpus(int consumer, const char *cpus);
+int player_set_rt_scheduling(int policy, int priority);
+int player_set_rt_lock_memory(int lock);
 
 #define VF_RELATIVE	0x01
 #define VF_PERCENTAGE	0x02
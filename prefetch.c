@@ -0,0 +1,230 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "prefetch.h"
+#include "cmus.h"
+#include "track_info.h"
+#include "locking.h"
+#include "xmalloc.h"
+#include "utils.h"
+#include "misc.h"
+#include "debug.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+int prefetch_tracks = 2;
+int prefetch_size = 64;
+
+/*
+ * Files are read ahead one chunk at a time with a pause in between, so
+ * prefetching never takes more than ~50 MiB/s of disk bandwidth even
+ * where the I/O priority can't be lowered.
+ */
+#define PREFETCH_CHUNK		(1024 * 1024)
+#define PREFETCH_PAUSE_MS	20
+
+static pthread_t prefetch_thread;
+static pthread_mutex_t prefetch_mutex = CMUS_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = CMUS_COND_INITIALIZER;
+static int prefetch_running;
+
+/* incremented for every new list, the thread abandons the old one */
+static unsigned int prefetch_generation;
+
+/* files to prefetch, protected by prefetch_mutex */
+static char *pending[PREFETCH_TRACKS_MAX];
+static int nr_pending;
+
+/* files read completely by the last run, only used by the thread */
+static char *done[PREFETCH_TRACKS_MAX];
+static int nr_done;
+
+#define prefetch_lock() cmus_mutex_lock(&prefetch_mutex)
+#define prefetch_unlock() cmus_mutex_unlock(&prefetch_mutex)
+
+static int cancelled(unsigned int generation)
+{
+	int rc;
+
+	prefetch_lock();
+	rc = !prefetch_running || generation != prefetch_generation;
+	prefetch_unlock();
+	return rc;
+}
+
+static int was_done(const char *filename)
+{
+	int i;
+
+	for (i = 0; i < nr_done; i++) {
+		if (strcmp(done[i], filename) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void free_list(char **list, int *nr)
+{
+	int i;
+
+	for (i = 0; i < *nr; i++)
+		free(list[i]);
+	*nr = 0;
+}
+
+/*
+ * Reads at most @budget bytes from the beginning of @filename into the
+ * page cache.  Returns bytes used from the budget or -1 if cancelled.
+ */
+static off_t prefetch_file(const char *filename, off_t budget, int skip_io,
+		unsigned int generation)
+{
+	struct stat st;
+	off_t off, len;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1)
+		return 0;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	len = st.st_size < budget ? st.st_size : budget;
+#ifndef POSIX_FADV_WILLNEED
+	/* no way to warm the page cache */
+	skip_io = 1;
+#endif
+	for (off = 0; off < len && !skip_io; off += PREFETCH_CHUNK) {
+		if (cancelled(generation)) {
+			close(fd);
+			return -1;
+		}
+#ifdef POSIX_FADV_WILLNEED
+		posix_fadvise(fd, off, len - off < PREFETCH_CHUNK ? len - off : PREFETCH_CHUNK,
+				POSIX_FADV_WILLNEED);
+#endif
+		ms_sleep(PREFETCH_PAUSE_MS);
+	}
+	close(fd);
+	return len;
+}
+
+static void *prefetch_loop(void *arg)
+{
+	if (set_idle_io_priority())
+		d_print("ioprio_set: %s\n", strerror(errno));
+
+	prefetch_lock();
+	while (1) {
+		char *files[PREFETCH_TRACKS_MAX];
+		unsigned int generation;
+		off_t budget;
+		int i, nr;
+
+		while (prefetch_running && nr_pending == 0)
+			pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+		if (!prefetch_running)
+			break;
+
+		nr = nr_pending;
+		memcpy(files, pending, nr * sizeof(char *));
+		nr_pending = 0;
+		generation = prefetch_generation;
+		budget = (off_t)prefetch_size * 1024 * 1024;
+		prefetch_unlock();
+
+		for (i = 0; i < nr && budget > 0; i++) {
+			off_t len = prefetch_file(files[i], budget, was_done(files[i]),
+					generation);
+
+			if (len < 0)
+				break;
+			d_print("%s: %lld bytes\n", files[i], (long long)len);
+			budget -= len;
+		}
+
+		/* remember what is in the cache now */
+		free_list(done, &nr_done);
+		memcpy(done, files, i * sizeof(char *));
+		nr_done = i;
+		while (i < nr)
+			free(files[i++]);
+
+		prefetch_lock();
+	}
+	prefetch_unlock();
+	return NULL;
+}
+
+void prefetch_init(void)
+{
+#ifdef POSIX_FADV_WILLNEED
+	int rc;
+
+	prefetch_running = 1;
+	rc = pthread_create(&prefetch_thread, NULL, prefetch_loop, NULL);
+	BUG_ON(rc);
+#endif
+}
+
+void prefetch_exit(void)
+{
+	if (!prefetch_running)
+		return;
+
+	prefetch_lock();
+	prefetch_running = 0;
+	pthread_cond_signal(&prefetch_cond);
+	prefetch_unlock();
+
+	pthread_join(prefetch_thread, NULL);
+	free_list(pending, &nr_pending);
+	free_list(done, &nr_done);
+}
+
+void prefetch_update(void)
+{
+	struct track_info *tis[PREFETCH_TRACKS_MAX];
+	int i, nr = 0;
+
+	if (!prefetch_running)
+		return;
+
+	if (prefetch_tracks > 0)
+		nr = cmus_peek_next_tracks(tis, min_i(prefetch_tracks, PREFETCH_TRACKS_MAX));
+
+	prefetch_lock();
+	free_list(pending, &nr_pending);
+	for (i = 0; i < nr; i++) {
+		/* only local files, not urls */
+		if (tis[i]->filename[0] == '/')
+			pending[nr_pending++] = xstrdup(tis[i]->filename);
+		track_info_unref(tis[i]);
+	}
+	prefetch_generation++;
+	pthread_cond_signal(&prefetch_cond);
+	prefetch_unlock();
+}
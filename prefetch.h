@@ -0,0 +1,37 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_PREFETCH_H
+#define CMUS_PREFETCH_H
+
+#define PREFETCH_TRACKS_MAX 16
+
+/* number of upcoming tracks to read into the page cache, 0 disables */
+extern int prefetch_tracks;
+/* byte budget for all prefetched tracks, in MiB */
+extern int prefetch_size;
+
+void prefetch_init(void);
+void prefetch_exit(void);
+
+/*
+ * Looks up the next prefetch_tracks tracks and starts reading them in the
+ * background.  Call from the main thread when the playing track changes.
+ */
+void prefetch_update(void);
+
+#endif
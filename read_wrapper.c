@@ -19,6 +19,7 @@
 #include "read_wrapper.h"
 #include "ip.h"
 #include "file.h"
+#include "netbuf.h"
 
 #include <unistd.h>
 
@@ -26,6 +27,9 @@ ssize_t read_wrapper(struct input_plugin_data *ip_data, void *buffer, size_t cou
 {
 	int rc;
 
+	if (ip_data->netbuf)
+		return netbuf_read(ip_data->netbuf, ip_data, buffer, count);
+
 	if (ip_data->metaint == 0) {
 		/* no metadata in the stream */
 		return read(ip_data->fd, buffer, count);
@@ -0,0 +1,501 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resample.h"
+#include "channelmap.h"
+#include "xmalloc.h"
+#include "utils.h"
+#include "debug.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Polyphase windowed-sinc resampler
+ *
+ * The ratio in_rate / out_rate is reduced to step / den.  Every output frame
+ * advances the input position by step / den frames, so the fractional part
+ * of the position is always k / den for some integer k.  If den is small
+ * enough (44100 <-> 48000 gives 160 or 147) there is one precomputed filter
+ * phase for every k and the output is exact.  Otherwise INTERP_PHASES phases
+ * are computed and the result is interpolated linearly between two of them.
+ *
+ * Samples are converted to planar float so that the inner loop is a plain
+ * dot product over contiguous memory.
+ */
+
+#define MAX_PHASES	512
+#define INTERP_PHASES	256
+
+const char * const resample_quality_names[] = {
+	"fast", "medium", "best", NULL
+};
+
+static const struct {
+	/* filter length, multiple of 8 */
+	int taps;
+	/* kaiser window parameter */
+	double beta;
+	/* relative to the lower nyquist frequency */
+	double cutoff;
+} quality_params[NR_RESAMPLE_QUALITIES] = {
+	[RESAMPLE_QUALITY_FAST]		= { 16,  6.0, 0.85 },
+	[RESAMPLE_QUALITY_MEDIUM]	= { 32,  8.0, 0.91 },
+	[RESAMPLE_QUALITY_BEST]		= { 64, 10.0, 0.95 },
+};
+
+struct resampler {
+	sample_format_t sf;
+	unsigned int out_rate;
+	enum resample_quality quality;
+	int channels;
+	int sample_size;
+	int frame_size;
+	int is_float;
+
+	/* input position advances by step_int + step_frac / den per output */
+	unsigned int step_int;
+	unsigned int step_frac;
+	unsigned int den;
+	/* fractional input position, 0..den-1 */
+	unsigned int frac;
+
+	int taps;
+	int nr_phases;
+	int interpolate;
+	/* (nr_phases + 1) rows of taps coefficients */
+	float *filter;
+
+	/* per-channel input history */
+	float **x;
+	int x_len;
+	int x_cap;
+	/* index of the first history frame of the next filter window */
+	int pos;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0, half = x / 2.0;
+	int k;
+
+	for (k = 1; k < 64; k++) {
+		term *= (half / k) * (half / k);
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static void build_filter(struct resampler *rs, double fc, double beta)
+{
+	int half = rs->taps / 2;
+	double i0_beta = bessel_i0(beta);
+	int p, k;
+
+	for (p = 0; p <= rs->nr_phases; p++) {
+		float *row = rs->filter + p * rs->taps;
+		double f = (double)p / rs->nr_phases;
+		double sum = 0.0;
+
+		for (k = 0; k < rs->taps; k++) {
+			/* distance of the tap from the output position */
+			double d = k - (half - 1) - f;
+			double u = d / half;
+			double w = 0.0, s = 1.0;
+
+			if (u > -1.0 && u < 1.0)
+				w = bessel_i0(beta * sqrt(1.0 - u * u)) / i0_beta;
+			if (fabs(d) > 1e-9)
+				s = sin(M_PI * fc * d) / (M_PI * fc * d);
+			row[k] = w * s;
+			sum += row[k];
+		}
+		/* unity gain at DC for every phase */
+		for (k = 0; k < rs->taps; k++)
+			row[k] /= sum;
+	}
+}
+
+#if defined(__GNUC__)
+typedef float v4sf __attribute__((vector_size(16)));
+
+/* compiles to SSE on x86 and NEON on ARM, n must be a multiple of 8 */
+static inline float dot(const float *x, const float *h, int n)
+{
+	v4sf acc0 = { 0.0f, 0.0f, 0.0f, 0.0f };
+	v4sf acc1 = acc0;
+	int i;
+
+	for (i = 0; i < n; i += 8) {
+		v4sf a0, a1, b0, b1;
+
+		memcpy(&a0, x + i, sizeof(a0));
+		memcpy(&a1, x + i + 4, sizeof(a1));
+		memcpy(&b0, h + i, sizeof(b0));
+		memcpy(&b1, h + i + 4, sizeof(b1));
+		acc0 += a0 * b0;
+		acc1 += a1 * b1;
+	}
+	acc0 += acc1;
+	return (acc0[0] + acc0[1]) + (acc0[2] + acc0[3]);
+}
+#else
+static inline float dot(const float *x, const float *h, int n)
+{
+	float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+	int i;
+
+	for (i = 0; i < n; i += 4) {
+		s0 += x[i] * h[i];
+		s1 += x[i + 1] * h[i + 1];
+		s2 += x[i + 2] * h[i + 2];
+		s3 += x[i + 3] * h[i + 3];
+	}
+	return (s0 + s1) + (s2 + s3);
+}
+#endif
+
+static void reserve(struct resampler *rs, int frames)
+{
+	int c;
+
+	if (frames <= rs->x_cap)
+		return;
+	rs->x_cap = frames + 1024;
+	for (c = 0; c < rs->channels; c++)
+		rs->x[c] = xrenew(float, rs->x[c], rs->x_cap);
+}
+
+static inline int32_t read_s24le(const unsigned char *b)
+{
+	return b[0] | (b[1] << 8) | ((int32_t)(signed char)b[2] << 16);
+}
+
+static inline void write_s24le(unsigned char *b, int32_t x)
+{
+	b[0] = x;
+	b[1] = x >> 8;
+	b[2] = x >> 16;
+}
+
+static void read_frames(struct resampler *rs, const char *in, int frames)
+{
+	int ch = rs->channels, off = rs->x_len;
+	int i, c;
+
+	if (rs->is_float) {
+		const float *s = (const void *)in;
+
+		for (i = 0; i < frames; i++)
+			for (c = 0; c < ch; c++)
+				rs->x[c][off + i] = s[i * ch + c];
+		return;
+	}
+
+	switch (rs->sample_size) {
+	case 2:
+	{
+		const int16_t *s = (const void *)in;
+
+		for (i = 0; i < frames; i++)
+			for (c = 0; c < ch; c++)
+				rs->x[c][off + i] = s[i * ch + c] * (1.0f / 32768.0f);
+		break;
+	}
+	case 3:
+	{
+		const unsigned char *s = (const unsigned char *)in;
+
+		for (i = 0; i < frames; i++)
+			for (c = 0; c < ch; c++)
+				rs->x[c][off + i] = read_s24le(s + (i * ch + c) * 3) *
+					(1.0f / 8388608.0f);
+		break;
+	}
+	case 4:
+	{
+		const int32_t *s = (const void *)in;
+
+		for (i = 0; i < frames; i++)
+			for (c = 0; c < ch; c++)
+				rs->x[c][off + i] = s[i * ch + c] * (1.0f / 2147483648.0f);
+		break;
+	}
+	}
+}
+
+static inline int32_t float_to_int(float v, double scale, double max)
+{
+	double d = v * scale;
+
+	if (d >= max)
+		return max;
+	if (d < -scale)
+		return -scale;
+	return lrint(d);
+}
+
+static void write_frame(const struct resampler *rs, char *out, const float *y)
+{
+	int ch = rs->channels;
+	int c;
+
+	if (rs->is_float) {
+		memcpy(out, y, ch * sizeof(float));
+		return;
+	}
+
+	switch (rs->sample_size) {
+	case 2:
+	{
+		int16_t *d = (void *)out;
+
+		for (c = 0; c < ch; c++)
+			d[c] = float_to_int(y[c], 32768.0, 32767.0);
+		break;
+	}
+	case 3:
+	{
+		unsigned char *d = (unsigned char *)out;
+
+		for (c = 0; c < ch; c++)
+			write_s24le(d + c * 3, float_to_int(y[c], 8388608.0, 8388607.0));
+		break;
+	}
+	case 4:
+	{
+		int32_t *d = (void *)out;
+
+		for (c = 0; c < ch; c++)
+			d[c] = float_to_int(y[c], 2147483648.0, 2147483647.0);
+		break;
+	}
+	}
+}
+
+/* produce at most @max_frames output frames from the history */
+static int run(struct resampler *rs, char *out, int max_frames)
+{
+	float y[CHANNELS_MAX];
+	int n = 0, c, drop;
+
+	while (n < max_frames && rs->pos + rs->taps <= rs->x_len) {
+		if (!rs->interpolate) {
+			const float *h = rs->filter + rs->frac * rs->taps;
+
+			for (c = 0; c < rs->channels; c++)
+				y[c] = dot(rs->x[c] + rs->pos, h, rs->taps);
+		} else {
+			uint64_t t = (uint64_t)rs->frac * rs->nr_phases;
+			const float *h0 = rs->filter + (t / rs->den) * rs->taps;
+			const float *h1 = h0 + rs->taps;
+			float a = (float)(t % rs->den) / rs->den;
+
+			for (c = 0; c < rs->channels; c++) {
+				float y0 = dot(rs->x[c] + rs->pos, h0, rs->taps);
+				float y1 = dot(rs->x[c] + rs->pos, h1, rs->taps);
+
+				y[c] = y0 + a * (y1 - y0);
+			}
+		}
+		write_frame(rs, out + n * rs->frame_size, y);
+		n++;
+
+		rs->pos += rs->step_int;
+		rs->frac += rs->step_frac;
+		if (rs->frac >= rs->den) {
+			rs->frac -= rs->den;
+			rs->pos++;
+		}
+	}
+
+	/* forget frames which are not needed anymore */
+	drop = min_i(rs->pos, rs->x_len);
+	if (drop > 0) {
+		for (c = 0; c < rs->channels; c++)
+			memmove(rs->x[c], rs->x[c] + drop,
+					(rs->x_len - drop) * sizeof(float));
+		rs->x_len -= drop;
+		rs->pos -= drop;
+	}
+	return n;
+}
+
+int resample_supported(sample_format_t sf)
+{
+	int bits = sf_get_bits(sf);
+	int channels = sf_get_channels(sf);
+
+	if (!sf_get_signed(sf) || sf_get_rate(sf) == 0)
+		return 0;
+	if (channels < 1 || channels > CHANNELS_MAX)
+		return 0;
+	switch (bits) {
+	case 16:
+	case 32:
+		return sf_get_bigendian(sf) == sf_get_bigendian(sf_host_endian());
+	case 24:
+		return !sf_get_bigendian(sf);
+	}
+	return 0;
+}
+
+struct resampler *resample_new(sample_format_t sf, unsigned int out_rate,
+		enum resample_quality quality)
+{
+	struct resampler *rs = xnew0(struct resampler, 1);
+	unsigned int in_rate = sf_get_rate(sf);
+	unsigned int g = gcd(in_rate, out_rate);
+	unsigned int step = in_rate / g;
+	double fc;
+
+	rs->sf = sf;
+	rs->out_rate = out_rate;
+	rs->quality = quality;
+	rs->channels = sf_get_channels(sf);
+	rs->sample_size = sf_get_sample_size(sf);
+	rs->is_float = sf_get_float(sf);
+	rs->frame_size = sf_get_frame_size(sf);
+
+	rs->den = out_rate / g;
+	rs->step_int = step / rs->den;
+	rs->step_frac = step % rs->den;
+
+	rs->taps = quality_params[quality].taps;
+	if (rs->den <= MAX_PHASES) {
+		rs->nr_phases = rs->den;
+		rs->interpolate = 0;
+	} else {
+		rs->nr_phases = INTERP_PHASES;
+		rs->interpolate = 1;
+	}
+
+	/* cut off below the lower of the two nyquist frequencies */
+	fc = quality_params[quality].cutoff;
+	if (out_rate < in_rate)
+		fc *= (double)out_rate / in_rate;
+
+	rs->filter = xnew(float, (rs->nr_phases + 1) * rs->taps);
+	build_filter(rs, fc, quality_params[quality].beta);
+
+	rs->x = xnew0(float *, rs->channels);
+	resample_reset(rs);
+
+	d_print("%u -> %u Hz, %s quality, %d taps, %d phases%s\n",
+			in_rate, out_rate, resample_quality_names[quality],
+			rs->taps, rs->nr_phases,
+			rs->interpolate ? " (interpolated)" : "");
+	return rs;
+}
+
+void resample_free(struct resampler *rs)
+{
+	int c;
+
+	for (c = 0; c < rs->channels; c++)
+		free(rs->x[c]);
+	free(rs->x);
+	free(rs->filter);
+	free(rs);
+}
+
+int resample_matches(const struct resampler *rs, sample_format_t sf,
+		unsigned int out_rate, enum resample_quality quality)
+{
+	return rs->sf == sf && rs->out_rate == out_rate && rs->quality == quality;
+}
+
+void resample_reset(struct resampler *rs)
+{
+	int c, prime = rs->taps / 2 - 1;
+
+	/* center of the first window is the first input frame */
+	reserve(rs, prime);
+	for (c = 0; c < rs->channels; c++)
+		memset(rs->x[c], 0, prime * sizeof(float));
+	rs->x_len = prime;
+	rs->pos = 0;
+	rs->frac = 0;
+}
+
+int resample_in_size(const struct resampler *rs, int out_size, int max_in)
+{
+	int out_frames = out_size / rs->frame_size;
+	uint64_t step = (uint64_t)rs->step_int * rs->den + rs->step_frac;
+	uint64_t last, needed;
+
+	if (out_frames <= 0)
+		return 0;
+
+	/* window end of the last output frame */
+	last = rs->pos + (rs->frac + (out_frames - 1) * step) / rs->den;
+	needed = last + rs->taps;
+	if (needed <= rs->x_len)
+		return 0;
+
+	needed -= rs->x_len;
+	if (needed > max_in / rs->frame_size)
+		needed = max_in / rs->frame_size;
+	return needed * rs->frame_size;
+}
+
+int resample_process(struct resampler *rs, const char *in, int in_size,
+		char *out, int out_size)
+{
+	int in_frames = in_size / rs->frame_size;
+
+	if (in_frames > 0) {
+		reserve(rs, rs->x_len + in_frames);
+		read_frames(rs, in, in_frames);
+		rs->x_len += in_frames;
+	}
+	return run(rs, out, out_size / rs->frame_size) * rs->frame_size;
+}
+
+int resample_drain(struct resampler *rs, char *out, int out_size)
+{
+	int c, half = rs->taps / 2;
+	int n;
+
+	/* enough silence to move the last input frame through the window */
+	reserve(rs, rs->x_len + half);
+	for (c = 0; c < rs->channels; c++)
+		memset(rs->x[c] + rs->x_len, 0, half * sizeof(float));
+	rs->x_len += half;
+
+	n = run(rs, out, out_size / rs->frame_size);
+	resample_reset(rs);
+	return n * rs->frame_size;
+}
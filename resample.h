@@ -0,0 +1,85 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_RESAMPLE_H
+#define CMUS_RESAMPLE_H
+
+#include "sf.h"
+
+enum resample_quality {
+	RESAMPLE_QUALITY_FAST,
+	RESAMPLE_QUALITY_MEDIUM,
+	RESAMPLE_QUALITY_BEST,
+	NR_RESAMPLE_QUALITIES
+};
+
+extern const char * const resample_quality_names[];
+
+struct resampler;
+
+/*
+ * returns non-zero if samples in format @sf can be resampled
+ */
+int resample_supported(sample_format_t sf);
+
+/*
+ * @sf:       input sample format, output format is the same except for rate
+ * @out_rate: output sample rate
+ *
+ * never fails. call resample_supported() first
+ */
+struct resampler *resample_new(sample_format_t sf, unsigned int out_rate,
+		enum resample_quality quality);
+void resample_free(struct resampler *rs);
+
+/*
+ * returns non-zero if @rs converts @sf to @out_rate using @quality
+ */
+int resample_matches(const struct resampler *rs, sample_format_t sf,
+		unsigned int out_rate, enum resample_quality quality);
+
+/*
+ * forget filter history, e.g. after seeking
+ */
+void resample_reset(struct resampler *rs);
+
+/*
+ * Returns number of input bytes (multiple of the input frame size) which
+ * produce at most @out_size bytes of output.  Never returns more than
+ * @max_in bytes.
+ */
+int resample_in_size(const struct resampler *rs, int out_size, int max_in);
+
+/*
+ * Resamples @in_size bytes from @in and writes at most @out_size bytes to
+ * @out.  All input is consumed, @out_size must be at least
+ * resample_in_size(rs, out_size, ...) worth of output.
+ *
+ * Returns number of bytes written to @out.  May be 0 while the filter is
+ * filling up.
+ */
+int resample_process(struct resampler *rs, const char *in, int in_size,
+		char *out, int out_size);
+
+/*
+ * Flushes the samples still held back by the filter at end of stream.
+ *
+ * Returns number of bytes written to @out.
+ */
+int resample_drain(struct resampler *rs, char *out, int out_size);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* pthread_setaffinity_np() */
+#define _GNU_SOURCE
+
+#include "rt.h"
+#include "debug.h"
+
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+const char * const rt_policy_names[] = {
+	"other", "fifo", "rr", NULL
+};
+
+/*
+ * Calls @cb for each CPU in @cpus.  Returns 0 or EINVAL if @cpus is not
+ * a comma separated list of numbers and ranges.
+ */
+static int for_each_cpu(const char *cpus, void (*cb)(int cpu, void *data), void *data)
+{
+	const char *s = cpus;
+
+	while (*s) {
+		char *end;
+		long first, last, i;
+
+		first = strtol(s, &end, 10);
+		if (end == s || first < 0)
+			return EINVAL;
+		last = first;
+		s = end;
+		if (*s == '-') {
+			s++;
+			last = strtol(s, &end, 10);
+			if (end == s || last < first)
+				return EINVAL;
+			s = end;
+		}
+		if (last >= 1024)
+			return EINVAL;
+		if (*s == ',') {
+			s++;
+			if (*s == 0)
+				return EINVAL;
+		} else if (*s) {
+			return EINVAL;
+		}
+		for (i = first; cb && i <= last; i++)
+			cb(i, data);
+	}
+	return 0;
+}
+
+int rt_cpus_valid(const char *cpus)
+{
+	return for_each_cpu(cpus, NULL, NULL) == 0;
+}
+
+#ifdef __linux__
+static void add_cpu(int cpu, void *data)
+{
+	if (cpu < CPU_SETSIZE)
+		CPU_SET(cpu, (cpu_set_t *)data);
+}
+#endif
+
+int rt_set_affinity(pthread_t thread, const char *cpus)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	int rc, i;
+
+	CPU_ZERO(&set);
+	if (*cpus) {
+		rc = for_each_cpu(cpus, add_cpu, &set);
+		if (rc)
+			return rc;
+	} else {
+		for (i = 0; i < CPU_SETSIZE; i++)
+			CPU_SET(i, &set);
+	}
+	rc = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (rc && !*cpus) {
+		/* "all" included CPUs which are not present */
+		return 0;
+	}
+	return rc;
+#else
+	return *cpus ? ENOSYS : 0;
+#endif
+}
+
+int rt_set_scheduling(pthread_t thread, int policy, int priority)
+{
+#ifdef REALTIME_SCHEDULING
+	struct sched_param param;
+	int p = SCHED_OTHER, min, max;
+
+	if (policy == RT_POLICY_FIFO)
+		p = SCHED_FIFO;
+	else if (policy == RT_POLICY_RR)
+		p = SCHED_RR;
+
+	param.sched_priority = 0;
+	if (p != SCHED_OTHER) {
+		min = sched_get_priority_min(p);
+		max = sched_get_priority_max(p);
+		if (priority < min)
+			priority = min;
+		if (priority > max)
+			priority = max;
+		param.sched_priority = priority;
+	}
+	d_print("policy %s, priority %d\n", rt_policy_names[policy], param.sched_priority);
+	return pthread_setschedparam(thread, p, &param);
+#else
+	return policy == RT_POLICY_OTHER ? 0 : ENOSYS;
+#endif
+}
+
+static void page_range(const void **addr, size_t *len)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)*addr & ~(page - 1);
+	uintptr_t end = ((uintptr_t)*addr + *len + page - 1) & ~(page - 1);
+
+	*addr = (const void *)start;
+	*len = end - start;
+}
+
+int rt_mlock(const void *addr, size_t len)
+{
+	page_range(&addr, &len);
+	if (mlock(addr, len))
+		return errno;
+	return 0;
+}
+
+int rt_munlock(const void *addr, size_t len)
+{
+	page_range(&addr, &len);
+	if (munlock(addr, len))
+		return errno;
+	return 0;
+}
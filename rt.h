@@ -0,0 +1,47 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_RT_H
+#define CMUS_RT_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* thread scheduling and memory locking, all return 0 or an errno value */
+
+enum {
+	RT_POLICY_OTHER,
+	RT_POLICY_FIFO,
+	RT_POLICY_RR,
+	NR_RT_POLICIES
+};
+
+extern const char * const rt_policy_names[];
+
+/* checks a CPU list like "0-2,5", empty means all CPUs */
+int rt_cpus_valid(const char *cpus);
+
+int rt_set_affinity(pthread_t thread, const char *cpus);
+
+/* @priority is ignored for RT_POLICY_OTHER */
+int rt_set_scheduling(pthread_t thread, int policy, int priority);
+
+/* rounds @addr and @len out to whole pages */
+int rt_mlock(const void *addr, size_t len);
+int rt_munlock(const void *addr, size_t len);
+
+#endif
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# Copyright 2008-2013 Various Authors
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+# Writes test files for cmus-bench-decode: WAV in the sample formats
+# ip_read() converts, a cue sheet and the compressed formats of whichever
+# encoders are installed.  The signal is the same on every run.
+#
+#   scripts/gen_bench_corpus.py [-s SECONDS] DIR
+#   ./cmus-bench-decode -l . DIR/*
+
+import array
+import math
+import os
+import shutil
+import struct
+import subprocess
+import sys
+from optparse import OptionParser
+
+RATE = 44100
+
+# output name, encoder and its arguments with {src} and {out} filled in
+ENCODERS = [
+    ('flac.flac', 'flac', ['-s', '-f', '-o', '{out}', '{src}']),
+    ('mp3_192.mp3', 'lame', ['--quiet', '-b', '192', '{src}', '{out}']),
+    ('vorbis_q5.ogg', 'oggenc', ['-Q', '-q', '5', '-o', '{out}', '{src}']),
+    ('opus_128.opus', 'opusenc', ['--quiet', '--bitrate', '128', '{src}', '{out}']),
+    ('wavpack.wv', 'wavpack', ['-q', '-y', '{src}', '-o', '{out}']),
+]
+
+# used for the formats above when the encoder is missing, and for AAC
+FFMPEG = [
+    ('flac.flac', ['-c:a', 'flac']),
+    ('mp3_192.mp3', ['-c:a', 'libmp3lame', '-b:a', '192k']),
+    ('vorbis_q5.ogg', ['-c:a', 'libvorbis', '-q:a', '5']),
+    ('opus_128.opus', ['-c:a', 'libopus', '-b:a', '128k']),
+    ('wavpack.wv', ['-c:a', 'wavpack']),
+    ('aac_192.m4a', ['-c:a', 'aac', '-b:a', '192k']),
+    ('aac_192.aac', ['-c:a', 'aac', '-b:a', '192k', '-f', 'adts']),
+]
+
+
+def signal(seconds, channels):
+    """Sweep plus noise in [-1, 1], interleaved."""
+    out = array.array('d')
+    seed = 1
+    phase = 0.0
+    n = int(seconds * RATE)
+    for i in range(n):
+        freq = 100.0 + 4000.0 * (i % (RATE * 5)) / (RATE * 5)
+        phase += 2 * math.pi * freq / RATE
+        tone = 0.5 * math.sin(phase)
+        for c in range(channels):
+            seed = (seed * 1103515245 + 12345) & 0x7fffffff
+            out.append(tone + 0.2 * (seed / 0x3fffffff - 1.0))
+    return out
+
+
+def write_wav(path, samples, channels, bits, is_float=False):
+    if is_float:
+        data = array.array('f', samples)
+        if sys.byteorder == 'big':
+            data.byteswap()
+        data = data.tobytes()
+        fmt_tag = 3
+    elif bits == 8:
+        data = bytes(int(s * 127) + 128 for s in samples)
+        fmt_tag = 1
+    elif bits == 16:
+        data = array.array('h', (int(s * 32767) for s in samples))
+        if sys.byteorder == 'big':
+            data.byteswap()
+        data = data.tobytes()
+        fmt_tag = 1
+    else:
+        data = b''.join(struct.pack('<i', int(s * 8388607))[:3] for s in samples)
+        fmt_tag = 1
+    block = channels * bits // 8
+    with open(path, 'wb') as f:
+        f.write(b'RIFF' + struct.pack('<I', 36 + len(data)) + b'WAVE')
+        f.write(b'fmt ' + struct.pack('<IHHIIHH', 16, fmt_tag, channels, RATE,
+                                      RATE * block, block, bits))
+        f.write(b'data' + struct.pack('<I', len(data)))
+        f.write(data)
+
+
+def write_cue(path, wav, seconds, tracks=4):
+    with open(path, 'w') as f:
+        f.write('PERFORMER "cmus"\nTITLE "bench"\n')
+        f.write('FILE "%s" WAVE\n' % os.path.basename(wav))
+        for t in range(tracks):
+            start = int(seconds * t / tracks)
+            f.write('  TRACK %02d AUDIO\n' % (t + 1))
+            f.write('    TITLE "track %d"\n' % (t + 1))
+            f.write('    INDEX 01 %02d:%02d:00\n' % (start // 60, start % 60))
+
+
+def run(args):
+    return subprocess.call(args, stdout=subprocess.DEVNULL,
+                           stderr=subprocess.DEVNULL) == 0
+
+
+def main():
+    parser = OptionParser(usage='usage: %prog [-s SECONDS] DIR')
+    parser.add_option('-s', '--seconds', type='int', default=30,
+                      help='length of each file [default: %default]')
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('DIR expected')
+    out_dir = args[0]
+    seconds = options.seconds
+    if not os.path.isdir(out_dir):
+        os.makedirs(out_dir)
+
+    stereo = signal(seconds, 2)
+    mono = stereo[::2]
+    src = os.path.join(out_dir, 'pcm16_stereo.wav')
+    write_wav(src, stereo, 2, 16)
+    write_wav(os.path.join(out_dir, 'pcm16_mono.wav'), mono, 1, 16)
+    write_wav(os.path.join(out_dir, 'pcm8_mono.wav'), mono, 1, 8)
+    write_wav(os.path.join(out_dir, 'pcm24_stereo.wav'), stereo, 2, 24)
+    write_wav(os.path.join(out_dir, 'float_stereo.wav'), stereo, 2, 32, True)
+    write_cue(os.path.join(out_dir, 'pcm16_stereo.cue'), src, seconds)
+    written = ['pcm16_stereo.wav', 'pcm16_mono.wav', 'pcm8_mono.wav',
+               'pcm24_stereo.wav', 'float_stereo.wav', 'pcm16_stereo.cue']
+
+    for name, prog, template in ENCODERS:
+        if not shutil.which(prog):
+            continue
+        out = os.path.join(out_dir, name)
+        if run([prog] + [a.format(src=src, out=out) for a in template]):
+            written.append(name)
+
+    if shutil.which('ffmpeg'):
+        for name, codec in FFMPEG:
+            if name in written:
+                continue
+            out = os.path.join(out_dir, name)
+            if run(['ffmpeg', '-y', '-v', 'quiet', '-i', src] + codec + [out]):
+                written.append(name)
+
+    skipped = [name for name, codec in FFMPEG if name not in written]
+    print('wrote %s' % ' '.join(written))
+    if skipped:
+        print('no encoder for %s' % ' '.join(skipped))
+
+
+if __name__ == '__main__':
+    main()
@@ -34,6 +34,7 @@
 #include "keyval.h"
 #include "convert.h"
 #include "format_print.h"
+#include "stats.h"
 
 #include <stdarg.h>
 #include <unistd.h>
@@ -181,6 +182,19 @@ static int cmd_format_print(struct client *client, char *arg)
 	return ret;
 }
 
+static int cmd_stats(struct client *client)
+{
+	GBUF(buf);
+	int ret;
+
+	stats_format(&buf);
+	gbuf_add_ch(&buf, '\n');
+
+	ret = write_all(client->fd, buf.buffer, buf.len);
+	gbuf_free(&buf);
+	return ret;
+}
+
 static ssize_t send_answer(int fd, const char *format, ...)
 {
 	char buf[512];
@@ -276,6 +290,8 @@ static void read_commands(struct client *client)
 					ret = cmd_status(client);
 				} else if (!strcmp(cmd, "format_print")) {
 					ret = cmd_format_print(client, arg);
+				} else if (!strcmp(cmd, "stats") && !arg) {
+					ret = cmd_stats(client);
 				} else {
 					if (strcmp(cmd, "passwd") != 0) {
 						set_client_fd(client->fd);
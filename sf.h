@@ -24,7 +24,11 @@
  *  1     1 is_signed  0-1
  *  2-20 19 rate       0-524286
  * 21-23  3 bits >> 3  0-7 (* 8 = 0-56)
- * 24-31  8 channels   0-255
+ * 24-30  7 channels   0-127
+ * 31     1 is_float   0-1
+ *
+ * Float samples are 32-bit IEEE floats in the range [-1.0, 1.0] with
+ * is_signed set, so code which only looks at bits treats them as s32.
  */
 typedef unsigned int sample_format_t;
 
@@ -32,31 +36,38 @@ typedef unsigned int sample_format_t;
 #define SF_SIGNED_MASK		0x00000002
 #define SF_RATE_MASK		0x001ffffc
 #define SF_BITS_MASK		0x00e00000
-#define SF_CHANNELS_MASK	0xff000000
+#define SF_CHANNELS_MASK	0x7f000000
+#define SF_FLOAT_MASK		0x80000000
 
 #define SF_BIGENDIAN_SHIFT	0
 #define SF_SIGNED_SHIFT		1
 #define SF_RATE_SHIFT		2
 #define SF_BITS_SHIFT		(21-3)
 #define SF_CHANNELS_SHIFT	24
+#define SF_FLOAT_SHIFT		31
 
 #define sf_get_bigendian(sf)	(((sf) & SF_BIGENDIAN_MASK) >> SF_BIGENDIAN_SHIFT)
 #define sf_get_signed(sf)	(((sf) & SF_SIGNED_MASK   ) >> SF_SIGNED_SHIFT)
 #define sf_get_rate(sf)		(((sf) & SF_RATE_MASK     ) >> SF_RATE_SHIFT)
 #define sf_get_bits(sf)		(((sf) & SF_BITS_MASK     ) >> SF_BITS_SHIFT)
 #define sf_get_channels(sf)	(((sf) & SF_CHANNELS_MASK ) >> SF_CHANNELS_SHIFT)
+#define sf_get_float(sf)	(((sf) & SF_FLOAT_MASK    ) >> SF_FLOAT_SHIFT)
 
 #define sf_signed(val)		(((val) << SF_SIGNED_SHIFT   ) & SF_SIGNED_MASK)
 #define sf_rate(val)		(((val) << SF_RATE_SHIFT     ) & SF_RATE_MASK)
 #define sf_bits(val)		(((val) << SF_BITS_SHIFT     ) & SF_BITS_MASK)
 #define sf_channels(val)	(((val) << SF_CHANNELS_SHIFT ) & SF_CHANNELS_MASK)
 #define sf_bigendian(val)	(((val) << SF_BIGENDIAN_SHIFT) & SF_BIGENDIAN_MASK)
+#define sf_float(val)		((((sample_format_t)(val)) << SF_FLOAT_SHIFT) & SF_FLOAT_MASK)
 #ifdef WORDS_BIGENDIAN
 #	define sf_host_endian()	sf_bigendian(1)
 #else
 #	define sf_host_endian()	sf_bigendian(0)
 #endif
 
+/* 32-bit float in host byte order */
+#define sf_host_float()		(sf_float(1) | sf_bits(32) | sf_signed(1) | sf_host_endian())
+
 #define sf_get_sample_size(sf)	(sf_get_bits((sf)) >> 3)
 #define sf_get_frame_size(sf)	(sf_get_sample_size((sf)) * sf_get_channels((sf)))
 #define sf_get_second_size(sf)	(sf_get_rate((sf)) * sf_get_frame_size((sf)))
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/*
+ * Counters are relaxed atomics, so that the producer and consumer never
+ * wait for each other or the UI here.  A reset racing with an update may
+ * lose that update.
+ */
+
+/*
+ * log2 histogram, bucket 0 counts times below 2 us and bucket i times in
+ * [2^i, 2^(i + 1)) us.  The last bucket takes everything from ~8 s up.
+ */
+#define HIST_BUCKETS 24
+
+struct hist {
+	atomic_ulong count[HIST_BUCKETS];
+	atomic_ulong n;
+	_Atomic uint64_t max;
+};
+
+/* input plugins are never unloaded so the names can be kept */
+#define MAX_PLUGINS 32
+
+struct plugin_stats {
+	/* set once, slots are taken in order */
+	_Atomic(const char *) name;
+	struct hist read;
+};
+
+/* fill level in steps of 5 % */
+#define FILL_BUCKETS 21
+
+static atomic_ulong underruns;
+static atomic_ulong short_writes;
+static atomic_ulong output_reopens;
+static atomic_ulong format_changes;
+static atomic_ulong producer_stalls;
+static _Atomic uint64_t producer_stall_us;
+static atomic_ulong fill[FILL_BUCKETS];
+static struct hist seek_latency;
+static struct plugin_stats plugins[MAX_PLUGINS];
+
+#define get(var) atomic_load_explicit(&(var), memory_order_relaxed)
+#define add(var, val) atomic_fetch_add_explicit(&(var), val, memory_order_relaxed)
+#define set(var, val) atomic_store_explicit(&(var), val, memory_order_relaxed)
+
+static void hist_add(struct hist *h, uint64_t us)
+{
+	uint64_t max = get(h->max);
+	int i = 0;
+
+	if (us >= 2)
+		i = 63 - __builtin_clzll(us);
+	if (i >= HIST_BUCKETS)
+		i = HIST_BUCKETS - 1;
+	add(h->count[i], 1);
+	add(h->n, 1);
+	while (us > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, us,
+				memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+static void hist_reset(struct hist *h)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		set(h->count[i], 0);
+	set(h->n, 0);
+	set(h->max, 0);
+}
+
+/* upper bound of the bucket which contains the @p th percentile */
+static uint64_t hist_percentile(const struct hist *h, int p)
+{
+	unsigned long n = get(h->n), want, sum = 0;
+	uint64_t max = get(h->max);
+	int i;
+
+	if (n == 0)
+		return 0;
+	want = (n * p + 99) / 100;
+	for (i = 0; i < HIST_BUCKETS - 1; i++) {
+		sum += get(h->count[i]);
+		if (sum >= want)
+			break;
+	}
+	if (i == HIST_BUCKETS - 1 || (2ULL << i) > max)
+		return max;
+	return 2ULL << i;
+}
+
+static int fill_percentile(int p)
+{
+	unsigned long n = 0, want, sum = 0;
+	int i;
+
+	for (i = 0; i < FILL_BUCKETS; i++)
+		n += get(fill[i]);
+	if (n == 0)
+		return 0;
+	want = (n * p + 99) / 100;
+	for (i = 0; i < FILL_BUCKETS - 1; i++) {
+		sum += get(fill[i]);
+		if (sum >= want)
+			break;
+	}
+	return i * 5;
+}
+
+void stats_underrun(void)
+{
+	add(underruns, 1);
+}
+
+void stats_short_write(void)
+{
+	add(short_writes, 1);
+}
+
+void stats_output_reopen(void)
+{
+	add(output_reopens, 1);
+}
+
+void stats_format_change(void)
+{
+	add(format_changes, 1);
+}
+
+void stats_producer_stall(uint64_t us)
+{
+	add(producer_stalls, 1);
+	add(producer_stall_us, us);
+}
+
+static struct plugin_stats *plugin_stats(const char *name)
+{
+	int i;
+
+	for (i = 0; i < MAX_PLUGINS; i++) {
+		const char *old = NULL;
+
+		if (atomic_compare_exchange_strong(&plugins[i].name, &old, name) ||
+				old == name)
+			return &plugins[i];
+	}
+	return NULL;
+}
+
+void stats_ip_read(const char *name, uint64_t us)
+{
+	struct plugin_stats *ps = plugin_stats(name);
+
+	if (ps)
+		hist_add(&ps->read, us);
+}
+
+void stats_buffer_fill(int percent)
+{
+	if (percent < 0)
+		percent = 0;
+	if (percent > 100)
+		percent = 100;
+	add(fill[percent / 5], 1);
+}
+
+void stats_seek_latency(uint64_t us)
+{
+	hist_add(&seek_latency, us);
+}
+
+void stats_reset(void)
+{
+	int i;
+
+	set(underruns, 0);
+	set(short_writes, 0);
+	set(output_reopens, 0);
+	set(format_changes, 0);
+	set(producer_stalls, 0);
+	set(producer_stall_us, 0);
+	for (i = 0; i < FILL_BUCKETS; i++)
+		set(fill[i], 0);
+	hist_reset(&seek_latency);
+	for (i = 0; i < MAX_PLUGINS; i++)
+		hist_reset(&plugins[i].read);
+}
+
+static void format_hist(struct gbuf *buf, const char *key, const struct hist *h)
+{
+	int i;
+
+	gbuf_addf(buf, "%s n %lu p50 %llu p95 %llu p99 %llu max %llu hist", key,
+			get(h->n),
+			(unsigned long long)hist_percentile(h, 50),
+			(unsigned long long)hist_percentile(h, 95),
+			(unsigned long long)hist_percentile(h, 99),
+			(unsigned long long)get(h->max));
+	for (i = 0; i < HIST_BUCKETS; i++)
+		gbuf_addf(buf, " %lu", get(h->count[i]));
+	gbuf_add_ch(buf, '\n');
+}
+
+void stats_format(struct gbuf *buf)
+{
+	int i;
+
+	gbuf_addf(buf, "underruns %lu\n", get(underruns));
+	gbuf_addf(buf, "short_writes %lu\n", get(short_writes));
+	gbuf_addf(buf, "output_reopens %lu\n", get(output_reopens));
+	gbuf_addf(buf, "format_changes %lu\n", get(format_changes));
+	gbuf_addf(buf, "producer_stalls %lu\n", get(producer_stalls));
+	gbuf_addf(buf, "producer_stall_us %llu\n",
+			(unsigned long long)get(producer_stall_us));
+	gbuf_addf(buf, "buffer_fill p5 %d p50 %d p95 %d\n", fill_percentile(5),
+			fill_percentile(50), fill_percentile(95));
+	format_hist(buf, "seek_latency_us", &seek_latency);
+	for (i = 0; i < MAX_PLUGINS; i++) {
+		const char *name = atomic_load(&plugins[i].name);
+		char key[64];
+
+		if (name == NULL)
+			break;
+		snprintf(key, sizeof(key), "ip_read_us %s", name);
+		format_hist(buf, key, &plugins[i].read);
+	}
+}
+
+void stats_summary(struct gbuf *buf)
+{
+	gbuf_addf(buf, "underruns %lu, short writes %lu, reopens %lu, format changes %lu, "
+			"stalls %lu (%llu ms), fill p5/p50 %d/%d%%, seek p50 %llu ms",
+			get(underruns), get(short_writes), get(output_reopens),
+			get(format_changes), get(producer_stalls),
+			(unsigned long long)get(producer_stall_us) / 1000,
+			fill_percentile(5), fill_percentile(50),
+			(unsigned long long)hist_percentile(&seek_latency, 50) / 1000);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2008-2013 Various Authors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CMUS_STATS_H
+#define CMUS_STATS_H
+
+#include "gbuf.h"
+
+#include <stdint.h>
+
+/*
+ * Audio pipeline health counters.  Always on, can be called from any
+ * thread and never block.  Times are in microseconds.
+ */
+
+/* consumer found the buffer empty before EOF, once per starved stretch */
+void stats_underrun(void);
+/* op_write() accepted less than it was given */
+void stats_short_write(void);
+/* output was closed and opened again after an error */
+void stats_output_reopen(void);
+/* output was reopened for a new sample format or channel map */
+void stats_format_change(void);
+/* one producer_read() blocked for @us */
+void stats_producer_stall(uint64_t us);
+/* one call to the read function of input plugin @name took @us */
+void stats_ip_read(const char *name, uint64_t us);
+/* buffer fill level seen by the consumer, 0-100 */
+void stats_buffer_fill(int percent);
+/* time from seek request to the first sample written to the output */
+void stats_seek_latency(uint64_t us);
+
+void stats_reset(void);
+
+/* one "key value..." line per counter */
+void stats_format(struct gbuf *buf);
+/* one line for the command line */
+void stats_summary(struct gbuf *buf);
+
+#endif
@@ -69,6 +69,8 @@ struct track_info
 	unsigned int play_count;
 
 	int is_va_compilation : 1;
+	/* see ip_duration_estimated(), update-cache probes the file again */
+	unsigned int duration_estimated : 1;
 	int bpm;
 };
 
@@ -52,6 +52,7 @@
 #include "mpris.h"
 #include "locking.h"
 #include "pl_env.h"
+#include "prefetch.h"
 #ifdef HAVE_CONFIG
 #include "config/curses.h"
 #include "config/iconv.h"
@@ -2147,6 +2148,7 @@ static void update(void)
 	{
 		needs_title_update = 1;
 		needs_status_update = 1;
+		prefetch_update();
 	}
 	if (player_info.metadata_changed)
 		needs_title_update = 1;
@@ -2683,6 +2685,7 @@ static void init_all(void)
 
 	/* does not select output plugin */
 	player_init();
+	prefetch_init();
 
 	/* plugins have been loaded so we know what plugin options are available */
 	options_add();
@@ -2771,7 +2774,9 @@ static void exit_all(void)
 	cmus_save(lib_for_each, lib_autosave_filename, NULL);
 
 	pl_exit();
+	prefetch_exit();
 	player_exit();
+	ip_exit_plugins();
 	op_exit_plugins();
 	commands_exit();
 	search_mode_exit();
@@ -193,6 +193,21 @@ static inline void ms_sleep(int ms)
 	ns_sleep(ms * 1e6);
 }
 
+/* monotonic time in microseconds */
+static inline uint64_t us_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* monotonic time in milliseconds */
+static inline uint64_t ms_now(void)
+{
+	return us_now() / 1000;
+}
+
 static inline int is_http_url(const char *name)
 {
 	return strncmp(name, "http://", 7) == 0;